@@ -17,10 +17,33 @@ LOCAL_MODULE_RELATIVE_PATH := res/images
 include $$(BUILD_PREBUILT)
 endef
 
+# With TARGET_CHARGE_IMAGE_FORMAT := qoi the images are installed as
+# QOI instead, converted by minui/mkqoi.c, which decodes several times
+# faster than PNG.
+define _add-charge-qoi-image
+include $$(CLEAR_VARS)
+LOCAL_MODULE := charge_$(notdir $(basename $(1))).qoi
+LOCAL_MODULE_STEM := $(notdir $(basename $(1))).qoi
+_img_modules += $$(LOCAL_MODULE)
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_CLASS := ETC
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_RELATIVE_PATH := res/images
+include $$(BUILD_SYSTEM)/base_rules.mk
+$$(LOCAL_BUILT_MODULE): $$(LOCAL_PATH)/$(1) $$(HOST_OUT_EXECUTABLES)/charge_mkqoi
+	@mkdir -p $$(dir $$@)
+	$$(hide) $$(HOST_OUT_EXECUTABLES)/charge_mkqoi $$< $$@
+endef
+
 _img_modules :=
 _images :=
+ifeq ($(TARGET_CHARGE_IMAGE_FORMAT),qoi)
+$(foreach _img, $(call find-subdir-subdir-files, "images", "*.png"), \
+  $(eval $(call _add-charge-qoi-image,$(_img))))
+else
 $(foreach _img, $(call find-subdir-subdir-files, "images", "*.png"), \
   $(eval $(call _add-charge-image,$(_img))))
+endif
 
 include $(CLEAR_VARS)
 LOCAL_MODULE := charge_res_images
@@ -30,6 +53,61 @@ include $(BUILD_PHONY_PACKAGE)
 
 _img_modules :=
 _add-charge-image :=
+_add-charge-qoi-image :=
+
+# The master images prebuilt for the panel, see minui/mkbundle.c.  Without
+# the panel size the charger decodes the PNGs at boot instead.
+_charge_bundle :=
+ifneq ($(TARGET_SCREEN_WIDTH)$(TARGET_SCREEN_HEIGHT),)
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_images.bundle
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_TAGS := optional
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_RELATIVE_PATH := res
+include $(BUILD_SYSTEM)/base_rules.mk
+
+_bundle_images := $(addprefix $(LOCAL_PATH)/,$(call find-subdir-subdir-files, "images", "*_1440X2560.png"))
+_mkbundle := $(HOST_OUT_EXECUTABLES)/charge_mkbundle
+$(LOCAL_BUILT_MODULE): PRIVATE_IMAGES := $(_bundle_images)
+$(LOCAL_BUILT_MODULE): PRIVATE_MKBUNDLE := $(_mkbundle)
+$(LOCAL_BUILT_MODULE): PRIVATE_FLAGS := -p $(TARGET_SCREEN_WIDTH)x$(TARGET_SCREEN_HEIGHT) \
+	$(if $(filter true,$(TARGET_CHARGE_BUNDLE_ROTATED)),-r)
+$(LOCAL_BUILT_MODULE): $(_bundle_images) $(_mkbundle)
+	@mkdir -p $(dir $@)
+	$(hide) $(PRIVATE_MKBUNDLE) -o $@ $(PRIVATE_FLAGS) $(PRIVATE_IMAGES)
+
+_charge_bundle := charge_images.bundle
+_bundle_images :=
+_mkbundle :=
+endif
+
+# With TARGET_CHARGE_STREAM_ANIMATION := true the progress bar frames are
+# also packed into one animation, see minui/res_anim.h, which the charger
+# then plays instead of keeping every frame decoded.
+_charge_anim :=
+ifeq ($(TARGET_CHARGE_STREAM_ANIMATION),true)
+include $(CLEAR_VARS)
+LOCAL_MODULE := charge_indeterminate_1440X2560.anim
+LOCAL_MODULE_STEM := indeterminate_1440X2560.anim
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_TAGS := optional
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_MODULE_RELATIVE_PATH := res/images
+include $(BUILD_SYSTEM)/base_rules.mk
+
+_anim_frames := $(foreach i,0 1 2 3 4 5 6,$(LOCAL_PATH)/images/indeterminate$(i)_1440X2560.png)
+_mkqoi := $(HOST_OUT_EXECUTABLES)/charge_mkqoi
+$(LOCAL_BUILT_MODULE): PRIVATE_FRAMES := $(_anim_frames)
+$(LOCAL_BUILT_MODULE): PRIVATE_MKQOI := $(_mkqoi)
+$(LOCAL_BUILT_MODULE): $(_anim_frames) $(_mkqoi)
+	@mkdir -p $(dir $@)
+	$(hide) $(PRIVATE_MKQOI) -a $@ $(PRIVATE_FRAMES)
+
+_charge_anim := $(LOCAL_MODULE)
+_anim_frames :=
+_mkqoi :=
+endif
 include $(CLEAR_VARS)
 commands_recovery_local_path := $(LOCAL_PATH)
 
@@ -40,12 +118,18 @@ LOCAL_SRC_FILES := \
 	power.c \
 	log.c \
 	ui.c \
+	reactor.c \
+	frame_clock.c \
 	rtc.c
 
 ifeq ($(strip $(HAVE_KEYBOARD_BACKLIGHT)),true)
 LOCAL_CFLAGS += -DK_BACKLIGHT
 endif
 
+ifeq ($(strip $(CHARGE_USE_REACTOR)),true)
+LOCAL_CFLAGS += -DCHARGE_REACTOR
+endif
+
 LOCAL_MODULE := charge
 LOCAL_MODULE_TAGS := optional
 LOCAL_MODULE_PATH := $(TARGET_SYSTEM_OUT_BIN)
@@ -54,7 +138,7 @@ LOCAL_UNSTRIPPED_PATH := $(TARGET_ROOT_OUT_BIN_UNSTRIPPED)
 LOCAL_STATIC_LIBRARIES := libliteui libpng
 LOCAL_STATIC_LIBRARIES += libcharge_suspend libz
 LOCAL_SHARED_LIBRARIES += libhardware_legacy libcutils
-LOCAL_REQUIRED_MODULES := charge_res_images
+LOCAL_REQUIRED_MODULES := charge_res_images $(_charge_bundle) $(_charge_anim)
 
 #LOCAL_INIT_RC := charge.rc
 LOCAL_PROPRIETARY_MODULE := true
@@ -65,6 +149,8 @@ include $(commands_recovery_local_path)/minui/Android.mk
 include $(commands_recovery_local_path)/suspend/Android.mk
 
 commands_recovery_local_path :=
+_charge_bundle :=
+_charge_anim :=
 
 endif   # TARGET_ARCH == arm
 endif    # !TARGET_SIMULATOR
@@ -27,6 +27,10 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <pthread.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <linux/netlink.h>
 #include "common.h"
 
 
@@ -41,6 +45,9 @@
 #define POWER_SUPPLY_ACPATH "/sys/class/power_supply/ac/online"
 #define POWER_SUPPLY_USBPATH "/sys/class/power_supply/usb/online"
 
+#define UEVENT_MSG_LEN 2048
+#define UEVENT_RCVBUF_SIZE (64 * 1024)
+
 enum gFieldID gFieldIds;
 
 struct BatteryManagerConstants {
@@ -69,16 +76,192 @@ struct PowerSupplyPaths {
     char* batteryVoltagePath;
     char* batteryTemperaturePath;
     char* batteryTechnologyPath;
+    char* acUeventPath;
+    char* usbUeventPath;
+    char* batteryUeventPath;
 };
 
 static struct PowerSupplyPaths gPaths;
 
+/* power_supply names (sysfs directory names) as reported in uevents */
+struct PowerSupplyNames {
+    char* ac;
+    char* usb;
+    char* battery;
+};
+
+static struct PowerSupplyNames gNames;
+
+/* gAttrFds[] slots of the per-supply uevent files, after the gFieldID ones */
+enum {
+    ATTR_AC_UEVENT = mBatteryEnd,
+    ATTR_USB_UEVENT,
+    ATTR_BATTERY_UEVENT,
+    ATTR_END,
+};
+
+/*
+ * Attribute files found by battery_status_init() stay open for the whole
+ * charge session and are re-read with pread() at offset 0, which makes
+ * sysfs regenerate the value without another path lookup.  Indexed by
+ * enum gFieldID or ATTR_*_UEVENT, -1 means not opened yet.
+ */
+static int gAttrFds[ATTR_END] = { [0 ... ATTR_END - 1] = -1 };
+
 int PowerSupplyStatus[mBatteryEnd];
 
 pthread_mutex_t gBatteryMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int gVoltageDivisor = 1;
 
+/*
+ * NETLINK_KOBJECT_UEVENT socket.  While it is open PowerSupplyStatus[] is
+ * only updated from kernel change events, plus a full re-read once per
+ * sampling interval in case an event was missed.
+ */
+static int gUeventFd = -1;
+static long long gLastRefreshMs;
+
+/*
+ * Seqlock-published copy of PowerSupplyStatus[] for lock-free readers.
+ * Writers hold gBatteryMutex; the sequence is odd while a copy is in
+ * progress and readers retry until they see the same even value on
+ * both sides of their copy.
+ */
+static atomic_uint gSnapshotSeq;
+static atomic_int gSnapshotFields[mBatteryEnd];
+static atomic_llong gSnapshotTime;
+
+/*
+ * Adaptive sampling.  The interval doubles on every sample that changes
+ * nothing the UI shows, up to a limit that depends on the screen state
+ * and on how close the battery is to a visible threshold, and drops
+ * back to BATTERY_SAMPLE_MIN_MS as soon as something changes.  All
+ * fields are protected by gBatteryMutex.
+ */
+struct BatterySampler {
+    int interval_ms;
+    int screen_on;
+    long long last_change_ms;
+    unsigned long samples;
+    unsigned long changes;
+    int changed;            // visible change since the last retune
+};
+
+static struct BatterySampler gSampler = {
+    .interval_ms = BATTERY_SAMPLE_MIN_MS,
+    .screen_on = 1,
+};
+
+static pthread_cond_t gSamplerCond;
+static pthread_once_t gSamplerOnce = PTHREAD_ONCE_INIT;
+
+static long long monotonicMs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void samplerCondInit(void) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&gSamplerCond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// Health the battery actually reports as bad.  Devices without a health
+// attribute read 0, and "Unknown" is no reason to sample faster either.
+static int healthIsBad(int health) {
+	switch (health) {
+	case BATTERY_HEALTH_OVERHEAT:
+	case BATTERY_HEALTH_COLD:
+	case BATTERY_HEALTH_DEAD:
+	case BATTERY_HEALTH_OVER_VOLTAGE:
+	case BATTERY_HEALTH_UNSPECIFIED_FAILURE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int samplerLimitLocked(void) {
+	int level = PowerSupplyStatus[mBatteryLevel];
+	int limit = gSampler.screen_on ? BATTERY_SAMPLE_SCREEN_ON_MS : BATTERY_SAMPLE_MAX_MS;
+
+	// Without uevents a charger unplug is only seen by sampling.
+	if (gUeventFd < 0 && limit > BATTERY_SAMPLE_POLL_MAX_MS)
+		limit = BATTERY_SAMPLE_POLL_MAX_MS;
+
+	// Stay close to the LED switch, to full and to a bad health.
+	if ((level >= LED_GREEN_LEVEL - 1 && level <= LED_GREEN_LEVEL) ||
+	    (level >= 99 && PowerSupplyStatus[mBatteryStatus] != BATTERY_STATUS_FULL) ||
+	    healthIsBad(PowerSupplyStatus[mBatteryHealth])) {
+		if (limit > BATTERY_SAMPLE_NEAR_MS)
+			limit = BATTERY_SAMPLE_NEAR_MS;
+	}
+	return limit;
+}
+
+// After a sample, from the periodic refresh or a uevent.  Snapshots
+// published by the accessors in between only mark a change for it.
+static void samplerRetuneLocked(void) {
+	int limit = samplerLimitLocked();
+	int interval = gSampler.interval_ms;
+
+	if (gSampler.changed) {
+		gSampler.changed = 0;
+		gSampler.changes++;
+		interval = BATTERY_SAMPLE_MIN_MS;
+	} else {
+		interval *= 2;
+	}
+	if (interval > limit)
+		interval = limit;
+
+	if (interval != gSampler.interval_ms)
+		LOGD("battery sample interval %d -> %d ms (%lu samples, %lu changes)\n",
+		     gSampler.interval_ms, interval, gSampler.samples, gSampler.changes);
+	gSampler.interval_ms = interval;
+}
+
+// Fields whose change is visible to the user (UI, LED, power off).
+static int snapshotFieldVisible(int fieldID) {
+	return fieldID == mBatteryLevel || fieldID == mBatteryStatus ||
+	       fieldID == mBatteryHealth || fieldID == mAcOnline ||
+	       fieldID == mUsbOnline;
+}
+
+static void publishSnapshotLocked(void) {
+	unsigned seq = atomic_load_explicit(&gSnapshotSeq, memory_order_relaxed);
+	long long now = monotonicMs();
+	int changed = 0;
+	int i;
+
+	for (i = 0; i < mBatteryEnd; i++) {
+		if (snapshotFieldVisible(i) &&
+		    atomic_load_explicit(&gSnapshotFields[i], memory_order_relaxed) !=
+		    PowerSupplyStatus[i])
+			changed = 1;
+	}
+	if (changed) {
+		gSampler.changed = 1;
+		gSampler.last_change_ms = now;
+		pthread_once(&gSamplerOnce, samplerCondInit);
+		pthread_cond_broadcast(&gSamplerCond);
+	}
+
+	atomic_store_explicit(&gSnapshotSeq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (i = 0; i < mBatteryEnd; i++)
+		atomic_store_explicit(&gSnapshotFields[i], PowerSupplyStatus[i],
+				      memory_order_relaxed);
+	atomic_store_explicit(&gSnapshotTime, now, memory_order_relaxed);
+	atomic_store_explicit(&gSnapshotSeq, seq + 2, memory_order_release);
+}
+
 static int getBatteryStatus(const char* status) {
 	switch (status[0]) {
         case 'C': return gConstants.statusCharging;         /* Charging */
@@ -146,12 +329,63 @@ static int readFromFile(const char* path, char* buf, size_t size) {
 	return (int)count;
 }
 
+static void closeAttrFds(void) {
+	int i;
+
+	for (i = 0; i < ATTR_END; i++) {
+		if (gAttrFds[i] >= 0)
+			close(gAttrFds[i]);
+		gAttrFds[i] = -1;
+	}
+}
+
+static int openAttrFd(int slot, const char* path) {
+	if (!path)
+		return -1;
+	if (gAttrFds[slot] < 0) {
+		gAttrFds[slot] = open(path, O_RDONLY | O_CLOEXEC, 0);
+		if (gAttrFds[slot] < 0)
+			LOGE("Could not open '%s'", path);
+	}
+	return gAttrFds[slot];
+}
+
+/*
+ * Same contract as readFromFile(), but reads through the cached fd in
+ * 'slot'.  The fd is reopened once if the read fails, e.g. after the
+ * driver was unbound and rebound.
+ */
+static int readFromAttr(int slot, const char* path, char* buf, size_t size) {
+	ssize_t count;
+	int retry;
+
+	for (retry = 0; retry < 2; retry++) {
+		int fd = openAttrFd(slot, path);
+		if (fd < 0)
+			break;
+
+		count = pread(fd, buf, size, 0);
+		if (count > 0) {
+			count = ((size_t)count < size) ? count : (ssize_t)size - 1;
+			while (count > 0 && buf[count-1] == '\n') count--;
+			buf[count] = '\0';
+			return (int)count;
+		}
+
+		close(fd);
+		gAttrFds[slot] = -1;
+	}
+
+	buf[0] = '\0';
+	return -1;
+}
+
 static void setBooleanField(const char* path, enum gFieldID fieldID) {
     const int SIZE = 16;
     char buf[SIZE];
 
     char value = 0;
-    if (readFromFile(path, buf, SIZE) > 0) {
+    if (readFromAttr(fieldID, path, buf, SIZE) > 0) {
         if (buf[0] == '1') {
             value = 1;
         }
@@ -164,7 +398,7 @@ static void setIntField(const char* path, enum gFieldID fieldID) {
 	char buf[SIZE];
 
 	int value = 0;
-	if (readFromFile(path, buf, SIZE) > 0) {
+	if (readFromAttr(fieldID, path, buf, SIZE) > 0) {
 		value = atoi(buf);
 	}
 	PowerSupplyStatus[fieldID] = value;
@@ -178,35 +412,225 @@ static void setVoltageField(const char* path, enum gFieldID fieldID) {
 	char buf[SIZE];
 
 	int value = 0;
-	if (readFromFile(path, buf, SIZE) > 0) {
+	if (readFromAttr(fieldID, path, buf, SIZE) > 0) {
 		value = atoi(buf);
 		value /= gVoltageDivisor;
 	}
 	PowerSupplyStatus[fieldID] = value;
 }
 
-void battery_status_update(void) {
+static void batteryStatusUpdateLocked(void);
+
+/*
+ * Returns 1 if the caller has to read its attribute itself, 0 if
+ * PowerSupplyStatus[] is kept current by the uevent monitor.  Caller
+ * holds gBatteryMutex.
+ */
+static int batteryNeedsRead(void) {
+	if (gUeventFd < 0)
+		return 1;
+	if (monotonicMs() - gLastRefreshMs >= gSampler.interval_ms)
+		batteryStatusUpdateLocked();
+	return 0;
+}
+
+// "/sys/class/power_supply/usb/online" -> "usb"
+static char* supplyNameFromPath(const char* path) {
+	const char* start;
+	const char* end;
+
+	if (!path)
+		return NULL;
+	end = strrchr(path, '/');
+	if (!end)
+		return NULL;
+	for (start = end; start > path && start[-1] != '/'; start--)
+		;
+	return strndup(start, end - start);
+}
+
+// Path of the uevent file of supply 'name', or NULL; frees 'old'.
+static char* supplyUeventPath(char* old, const char* name) {
+	char path[PATH_MAX];
+
+	free(old);
+	if (!name)
+		return NULL;
+	snprintf(path, sizeof(path), "%s/%s/uevent", POWER_SUPPLY_PATH, name);
+	if (access(path, R_OK))
+		return NULL;
+	return strdup(path);
+}
+
+static int supplyIs(const char* supply, const char* name) {
+	return supply && name && strcmp(supply, name) == 0;
+}
+
+/*
+ * Apply one POWER_SUPPLY_<key>=<value> property of power supply 'name'
+ * to PowerSupplyStatus[].  Returns 1 if the stored value changed.  If
+ * 'seen' is not NULL the bit of the field is set in it.  Caller holds
+ * gBatteryMutex.
+ */
+static int applySupplyProperty(const char* name, const char* key, const char* value,
+			       unsigned* seen) {
+	enum gFieldID fieldID;
+	int val;
+
+	if (strcmp(key, "ONLINE") == 0) {
+		if (supplyIs(gNames.ac, name))
+			fieldID = mAcOnline;
+		else if (supplyIs(gNames.usb, name))
+			fieldID = mUsbOnline;
+		else
+			return 0;
+		val = (value[0] == '1');
+	} else if (!supplyIs(gNames.battery, name)) {
+		return 0;
+	} else if (strcmp(key, "STATUS") == 0) {
+		fieldID = mBatteryStatus;
+		val = getBatteryStatus(value);
+	} else if (strcmp(key, "HEALTH") == 0) {
+		fieldID = mBatteryHealth;
+		val = getBatteryHealth(value);
+	} else if (strcmp(key, "PRESENT") == 0) {
+		fieldID = mBatteryPresent;
+		val = (value[0] == '1');
+	} else if (strcmp(key, "CAPACITY") == 0) {
+		fieldID = mBatteryLevel;
+		val = atoi(value);
+	} else if (strcmp(key, "VOLTAGE_NOW") == 0) {
+		// voltage_now is in microvolts, not millivolts
+		fieldID = mBatteryVoltage;
+		val = atoi(value) / 1000;
+	} else if (strcmp(key, "TEMP") == 0) {
+		fieldID = mBatteryTemperature;
+		val = atoi(value);
+	} else {
+		return 0;
+	}
+
+	if (seen)
+		*seen |= 1u << fieldID;
+	if (PowerSupplyStatus[fieldID] == val)
+		return 0;
+	PowerSupplyStatus[fieldID] = val;
+	return 1;
+}
+
+/*
+ * Parse one kernel uevent ("action@devpath\0KEY=value\0...") and apply
+ * it if it belongs to the power_supply subsystem.  Returns 1 if any
+ * field changed.  Caller holds gBatteryMutex.
+ */
+static int parseUevent(const char* msg, size_t len) {
+	const char* end = msg + len;
+	const char* subsystem = NULL;
+	const char* name = NULL;
+	const char* p;
+	int changed = 0;
+
+	for (p = msg; p < end; p += strlen(p) + 1) {
+		if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if (strncmp(p, "POWER_SUPPLY_NAME=", 18) == 0)
+			name = p + 18;
+	}
+	if (!subsystem || strcmp(subsystem, "power_supply") || !name)
+		return 0;
+
+	for (p = msg; p < end; p += strlen(p) + 1) {
+		char key[32];
+		const char* eq;
+
+		if (strncmp(p, "POWER_SUPPLY_", 13))
+			continue;
+		eq = strchr(p + 13, '=');
+		if (!eq || (size_t)(eq - p - 13) >= sizeof(key))
+			continue;
+		memcpy(key, p + 13, eq - p - 13);
+		key[eq - p - 13] = '\0';
+		changed |= applySupplyProperty(name, key, eq + 1, NULL);
+	}
+	return changed;
+}
+
+/*
+ * Read the uevent file of power supply 'name' in one go and apply every
+ * POWER_SUPPLY_* line of it, recording the fields found in 'seen'.
+ */
+static void readSupplyUevent(int slot, const char* path, const char* name, unsigned* seen) {
+	char buf[4096];
+	char* line;
+	char* next;
+
+	if (!path || !name)
+		return;
+	if (readFromAttr(slot, path, buf, sizeof(buf)) <= 0)
+		return;
+
+	for (line = buf; line && *line; line = next) {
+		char* eq;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		if (strncmp(line, "POWER_SUPPLY_", 13))
+			continue;
+		eq = strchr(line + 13, '=');
+		if (!eq)
+			continue;
+		*eq = '\0';
+		applySupplyProperty(name, line + 13, eq + 1, seen);
+	}
+}
+
+#define FIELD_SEEN(seen, fieldID) ((seen) & (1u << (fieldID)))
+
+static void batteryStatusUpdateLocked(void) {
 	const int SIZE = 128;
 	char buf[SIZE];
+	unsigned seen = 0;
 
-	pthread_mutex_lock(&gBatteryMutex);
+	// One read per supply, per-attribute files only for what is missing.
+	readSupplyUevent(ATTR_AC_UEVENT, gPaths.acUeventPath, gNames.ac, &seen);
+	readSupplyUevent(ATTR_USB_UEVENT, gPaths.usbUeventPath, gNames.usb, &seen);
+	readSupplyUevent(ATTR_BATTERY_UEVENT, gPaths.batteryUeventPath, gNames.battery, &seen);
 
-	setBooleanField(gPaths.acOnlinePath, mAcOnline);
-	setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
-	setBooleanField(gPaths.batteryPresentPath, mBatteryPresent);
+	if (!FIELD_SEEN(seen, mAcOnline))
+		setBooleanField(gPaths.acOnlinePath, mAcOnline);
+	if (!FIELD_SEEN(seen, mUsbOnline))
+		setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
+	if (!FIELD_SEEN(seen, mBatteryPresent))
+		setBooleanField(gPaths.batteryPresentPath, mBatteryPresent);
 
-	setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
-	setVoltageField(gPaths.batteryVoltagePath, mBatteryVoltage);
-	setIntField(gPaths.batteryTemperaturePath, mBatteryTemperature);
+	if (!FIELD_SEEN(seen, mBatteryLevel))
+		setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
+	if (!FIELD_SEEN(seen, mBatteryVoltage))
+		setVoltageField(gPaths.batteryVoltagePath, mBatteryVoltage);
+	if (!FIELD_SEEN(seen, mBatteryTemperature))
+		setIntField(gPaths.batteryTemperaturePath, mBatteryTemperature);
 
-	if (readFromFile(gPaths.batteryStatusPath, buf, SIZE) > 0)
+	if (FIELD_SEEN(seen, mBatteryStatus))
+		;
+	else if (readFromAttr(mBatteryStatus, gPaths.batteryStatusPath, buf, SIZE) > 0)
 		setInt(mBatteryStatus, getBatteryStatus(buf));
 	else
 		setInt(mBatteryStatus, gConstants.statusUnknown);
 
-	if (readFromFile(gPaths.batteryHealthPath, buf, SIZE) > 0)
+	if (!FIELD_SEEN(seen, mBatteryHealth) &&
+	    readFromAttr(mBatteryHealth, gPaths.batteryHealthPath, buf, SIZE) > 0)
 		setInt(mBatteryHealth, getBatteryHealth(buf));
 
+	gLastRefreshMs = monotonicMs();
+	gSampler.samples++;
+	publishSnapshotLocked();
+	samplerRetuneLocked();
+}
+
+void battery_status_update(void) {
+	pthread_mutex_lock(&gBatteryMutex);
+	batteryStatusUpdateLocked();
 	pthread_mutex_unlock(&gBatteryMutex);
 }
 
@@ -220,6 +644,10 @@ int battery_status_init(void) {
 		return -1;
 	}
 
+	pthread_mutex_lock(&gBatteryMutex);
+	closeAttrFds();
+	pthread_mutex_unlock(&gBatteryMutex);
+
 	if (access(POWER_SUPPLY_ACPATH, R_OK) == 0)
 		gPaths.acOnlinePath = strdup(POWER_SUPPLY_ACPATH);
 	if (access(POWER_SUPPLY_USBPATH, R_OK) == 0)
@@ -304,6 +732,16 @@ int battery_status_init(void) {
 	}
 	closedir(dir);
 
+	free(gNames.ac);
+	free(gNames.usb);
+	free(gNames.battery);
+	gNames.ac = supplyNameFromPath(gPaths.acOnlinePath);
+	gNames.usb = supplyNameFromPath(gPaths.usbOnlinePath);
+	gNames.battery = supplyNameFromPath(gPaths.batteryCapacityPath);
+	gPaths.acUeventPath = supplyUeventPath(gPaths.acUeventPath, gNames.ac);
+	gPaths.usbUeventPath = supplyUeventPath(gPaths.usbUeventPath, gNames.usb);
+	gPaths.batteryUeventPath = supplyUeventPath(gPaths.batteryUeventPath, gNames.battery);
+
 	if (!gPaths.acOnlinePath || !gPaths.usbOnlinePath) {
 		LOGE("ac or usb OnlinePath not found");
 		return -1;
@@ -336,6 +774,21 @@ int battery_status_init(void) {
 	gConstants.healthOverVoltage = BATTERY_HEALTH_OVER_VOLTAGE;
 	gConstants.healthUnspecifiedFailure = BATTERY_HEALTH_UNSPECIFIED_FAILURE;
 
+	pthread_mutex_lock(&gBatteryMutex);
+	openAttrFd(mAcOnline, gPaths.acOnlinePath);
+	openAttrFd(mUsbOnline, gPaths.usbOnlinePath);
+	openAttrFd(mBatteryStatus, gPaths.batteryStatusPath);
+	openAttrFd(mBatteryHealth, gPaths.batteryHealthPath);
+	openAttrFd(mBatteryPresent, gPaths.batteryPresentPath);
+	openAttrFd(mBatteryLevel, gPaths.batteryCapacityPath);
+	openAttrFd(mBatteryVoltage, gPaths.batteryVoltagePath);
+	openAttrFd(mBatteryTemperature, gPaths.batteryTemperaturePath);
+	openAttrFd(mBatteryTechnology, gPaths.batteryTechnologyPath);
+	openAttrFd(ATTR_AC_UEVENT, gPaths.acUeventPath);
+	openAttrFd(ATTR_USB_UEVENT, gPaths.usbUeventPath);
+	openAttrFd(ATTR_BATTERY_UEVENT, gPaths.batteryUeventPath);
+	pthread_mutex_unlock(&gBatteryMutex);
+
 	battery_status_update();
 	return 0;
 }
@@ -349,8 +802,10 @@ int battery_ac_online(void) {
 			return -1;
 	}
 	pthread_mutex_lock(&gBatteryMutex);
-	setBooleanField(gPaths.acOnlinePath, mAcOnline);
+	if (batteryNeedsRead())
+		setBooleanField(gPaths.acOnlinePath, mAcOnline);
 	ret = PowerSupplyStatus[mAcOnline];
+	publishSnapshotLocked();
 	pthread_mutex_unlock(&gBatteryMutex);
 	return ret;
 }
@@ -363,8 +818,10 @@ int battery_usb_online(void) {
 			return -1;
 	}
 	pthread_mutex_lock(&gBatteryMutex);
-	setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
+	if (batteryNeedsRead())
+		setBooleanField(gPaths.usbOnlinePath, mUsbOnline);
 	ret = PowerSupplyStatus[mUsbOnline];
+	publishSnapshotLocked();
 	pthread_mutex_unlock(&gBatteryMutex);
 	return ret;
 }
@@ -377,8 +834,10 @@ int battery_capacity(void) {
 			return -1;
 	}
 	pthread_mutex_lock(&gBatteryMutex);
-	setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
+	if (batteryNeedsRead())
+		setIntField(gPaths.batteryCapacityPath, mBatteryLevel);
 	ret = PowerSupplyStatus[mBatteryLevel];
+	publishSnapshotLocked();
 	pthread_mutex_unlock(&gBatteryMutex);
 	return ret;
 }
@@ -394,12 +853,15 @@ int battery_status(void) {
 			return -1;
 	}
 	pthread_mutex_lock(&gBatteryMutex);
-	if (readFromFile(gPaths.batteryStatusPath, buf, SIZE) > 0)
+	if (!batteryNeedsRead())
+		;
+	else if (readFromAttr(mBatteryStatus, gPaths.batteryStatusPath, buf, SIZE) > 0)
 		setInt(mBatteryStatus, getBatteryStatus(buf));
 	else
 		setInt(mBatteryStatus, gConstants.statusUnknown);
 
 	ret = PowerSupplyStatus[mBatteryStatus];
+	publishSnapshotLocked();
 	pthread_mutex_unlock(&gBatteryMutex);
 	return ret;
 }
@@ -416,13 +878,211 @@ int battery_health(void)
 			return -1;
 	}
         pthread_mutex_lock(&gBatteryMutex);
-        if (readFromFile(gPaths.batteryHealthPath, buf, SIZE) > 0)
+        if (!batteryNeedsRead())
+                ;
+        else if (readFromAttr(mBatteryHealth, gPaths.batteryHealthPath, buf, SIZE) > 0)
                 setInt(mBatteryHealth, getBatteryHealth(buf));
         else
                 setInt(mBatteryHealth, gConstants.healthUnknown);
 
         ret = PowerSupplyStatus[mBatteryHealth];
+        publishSnapshotLocked();
 
 	pthread_mutex_unlock(&gBatteryMutex);
         return ret;
 }
+
+int battery_uevent_init(void) {
+	struct sockaddr_nl addr;
+	int size = UEVENT_RCVBUF_SIZE;
+	int fd;
+
+	if (gUeventFd >= 0)
+		return gUeventFd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1;	// kernel broadcast group
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		LOGE("uevent socket failed errno=%d(%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	// SO_RCVBUFFORCE needs CAP_NET_ADMIN, fall back to the capped size
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		LOGE("uevent bind failed errno=%d(%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// Events sent before the bind are lost, start from a full read.
+	pthread_mutex_lock(&gBatteryMutex);
+	gUeventFd = fd;
+	batteryStatusUpdateLocked();
+	pthread_mutex_unlock(&gBatteryMutex);
+	return fd;
+}
+
+int battery_uevent_handle(void) {
+	char msg[UEVENT_MSG_LEN + 2];
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	ssize_t n;
+	int changed = 0;
+
+	if (gUeventFd < 0)
+		return -1;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		n = recvfrom(gUeventFd, msg, UEVENT_MSG_LEN, 0,
+			     (struct sockaddr*)&addr, &addrlen);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				// Events were dropped, resync from sysfs.
+				LOGW("uevent overrun, re-reading power_supply\n");
+				pthread_mutex_lock(&gBatteryMutex);
+				batteryStatusUpdateLocked();
+				pthread_mutex_unlock(&gBatteryMutex);
+				changed = 1;
+				continue;
+			}
+			break;
+		}
+		// Only trust messages sent by the kernel, drop truncated ones.
+		if (n == 0 || addr.nl_pid != 0 || n >= UEVENT_MSG_LEN)
+			continue;
+		msg[n] = '\0';
+		msg[n + 1] = '\0';
+
+		pthread_mutex_lock(&gBatteryMutex);
+		if (parseUevent(msg, n)) {
+			publishSnapshotLocked();
+			samplerRetuneLocked();
+			changed = 1;
+		}
+		pthread_mutex_unlock(&gBatteryMutex);
+	}
+	return changed;
+}
+
+int battery_uevent_wait(int timeout_ms) {
+	struct pollfd pfd;
+
+	if (gUeventFd < 0)
+		return -1;
+
+	pfd.fd = gUeventFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+	return battery_uevent_handle();
+}
+
+int battery_snapshot_update(void) {
+	if (!gPaths.acOnlinePath || !gPaths.usbOnlinePath ||
+	    !gPaths.batteryCapacityPath) {
+		if (battery_status_init())
+			return -1;
+	}
+
+	pthread_mutex_lock(&gBatteryMutex);
+	if (batteryNeedsRead())
+		batteryStatusUpdateLocked();
+	pthread_mutex_unlock(&gBatteryMutex);
+	return 0;
+}
+
+int battery_snapshot_get(struct battery_snapshot* snap) {
+	int fields[mBatteryEnd];
+	long long timestamp;
+	unsigned seq;
+	int i;
+
+	do {
+		seq = atomic_load_explicit(&gSnapshotSeq, memory_order_acquire);
+		for (i = 0; i < mBatteryEnd; i++)
+			fields[i] = atomic_load_explicit(&gSnapshotFields[i],
+							 memory_order_relaxed);
+		timestamp = atomic_load_explicit(&gSnapshotTime, memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) ||
+		 seq != atomic_load_explicit(&gSnapshotSeq, memory_order_relaxed));
+
+	if (timestamp == 0)
+		return -1;
+
+	snap->level = fields[mBatteryLevel];
+	snap->status = fields[mBatteryStatus];
+	snap->health = fields[mBatteryHealth];
+	snap->ac_online = fields[mAcOnline];
+	snap->usb_online = fields[mUsbOnline];
+	snap->present = fields[mBatteryPresent];
+	snap->voltage = fields[mBatteryVoltage];
+	snap->temperature = fields[mBatteryTemperature];
+	snap->timestamp_ms = timestamp;
+	return 0;
+}
+
+int battery_sample_interval(void) {
+	int ret;
+
+	pthread_mutex_lock(&gBatteryMutex);
+	ret = gSampler.interval_ms;
+	pthread_mutex_unlock(&gBatteryMutex);
+	return ret;
+}
+
+void battery_sampler_screen(int on) {
+	pthread_once(&gSamplerOnce, samplerCondInit);
+	pthread_mutex_lock(&gBatteryMutex);
+	if (gSampler.screen_on != on) {
+		gSampler.screen_on = on;
+		// Refresh right away when the user starts looking.
+		if (on)
+			gSampler.interval_ms = BATTERY_SAMPLE_MIN_MS;
+		pthread_cond_broadcast(&gSamplerCond);
+	}
+	pthread_mutex_unlock(&gBatteryMutex);
+}
+
+int battery_sampler_wait(long long since_ms, int timeout_ms) {
+	struct timespec ts;
+	int ret = 0;
+
+	pthread_once(&gSamplerOnce, samplerCondInit);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&gBatteryMutex);
+	while (!gSampler.screen_on && gSampler.last_change_ms <= since_ms) {
+		if (pthread_cond_timedwait(&gSamplerCond, &gBatteryMutex, &ts)) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&gBatteryMutex);
+	return ret;
+}
+
+void battery_sampler_stats(struct battery_sampler_stats* stats) {
+	pthread_mutex_lock(&gBatteryMutex);
+	stats->interval_ms = gSampler.interval_ms;
+	stats->samples = gSampler.samples;
+	stats->changes = gSampler.changes;
+	pthread_mutex_unlock(&gBatteryMutex);
+}
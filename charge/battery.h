@@ -36,6 +36,25 @@ enum gFieldID{
     mBatteryEnd,
 };
 
+// Consistent view of the power supplies, see battery_snapshot_get().
+struct battery_snapshot {
+    int level;
+    int status;
+    int health;
+    int ac_online;
+    int usb_online;
+    int present;
+    int voltage;
+    int temperature;
+    long long timestamp_ms;     // CLOCK_MONOTONIC time it was published
+};
+
+struct battery_sampler_stats {
+    int interval_ms;            // current sampling interval
+    unsigned long samples;      // full power_supply refreshes
+    unsigned long changes;      // published snapshots with a visible change
+};
+
 extern int battery_status_init(void);
 extern void battery_status_update(void);
 extern int battery_ac_online(void);
@@ -43,6 +62,34 @@ extern int battery_usb_online(void);
 extern int battery_capacity(void);
 extern int battery_status(void);
 extern int battery_health(void);
+
+// power_supply uevent monitor.  battery_uevent_init() returns the netlink
+// fd (or -1), after which the accessors above return the state reported
+// by the kernel instead of re-reading sysfs on every call.
+extern int battery_uevent_init(void);
+// Drain pending uevents, returns 1 if any power_supply field changed,
+// 0 if not, -1 if the monitor is not running.
+extern int battery_uevent_handle(void);
+// Wait up to timeout_ms for uevents and handle them, same return values.
+extern int battery_uevent_wait(int timeout_ms);
+
+// Producer side: refresh whatever is stale and publish a new snapshot.
+// Returns -1 if the power_supply paths cannot be found.
+extern int battery_snapshot_update(void);
+// Copy the last published snapshot without locking or touching sysfs.
+// Returns -1 if nothing has been published yet.
+extern int battery_snapshot_get(struct battery_snapshot* snap);
+
+// Adaptive sampling: how long the producer may sleep before the next
+// battery_snapshot_update().  Widens while nothing changes and the
+// screen is off, tightens near the LED, full and health thresholds.
+extern int battery_sample_interval(void);
+// Tell the sampler whether anybody is looking at the screen.
+extern void battery_sampler_screen(int on);
+// Sleep up to timeout_ms, or until the screen is turned on or a change
+// newer than since_ms is published.  Returns -1 on timeout.
+extern int battery_sampler_wait(long long since_ms, int timeout_ms);
+extern void battery_sampler_stats(struct battery_sampler_stats* stats);
 #ifdef __cplusplus
 }
 #endif
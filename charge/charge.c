@@ -82,8 +82,17 @@ main(int argc,  char **argv) {
 	if (ret < 0) {
 		LOGE("battery_status_init failed\n");
 	}
+	if (battery_uevent_init() < 0)
+		LOGE("power_supply uevent monitor unavailable, polling\n");
 	ui_set_background();
 	backlight_init();
+#ifdef CHARGE_REACTOR
+	if (charge_reactor_run() == 0) {
+		LOGD("charge app exit\n");
+		return EXIT_SUCCESS;
+	}
+	LOGE("charge reactor failed,  falling back to threads\n");
+#endif
 	pthread_t t_1,  t_2,  t_3;
 
 	ret = pthread_create(&t_1, NULL, charge_thread, NULL);
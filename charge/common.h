@@ -27,6 +27,14 @@
 #define WAKEUP_ON_MS 2000
 #define POWER_KEY_TIMEOUT_MS 1500
 #define POLLING_MS 100
+// adaptive battery sampling intervals, see battery_sample_interval()
+#define BATTERY_SAMPLE_MIN_MS 500
+#define BATTERY_SAMPLE_SCREEN_ON_MS 2000
+#define BATTERY_SAMPLE_POLL_MAX_MS 2000
+#define BATTERY_SAMPLE_NEAR_MS 5000
+#define BATTERY_SAMPLE_MAX_MS 60000
+// level at which the charging LED turns from red to green
+#define LED_GREEN_LEVEL 90
 
 #ifdef __cplusplus
 extern "C"
@@ -35,6 +43,16 @@ extern "C"
 void *charge_thread(void *cookie);
 void *power_thread(void *cookie);
 void *input_thread(void *write_fd);
+// Single-threaded alternative to the three threads above, built on
+// epoll.  Returns when the charge app exits, or -1 if it cannot start.
+int charge_reactor_run(void);
+struct battery_snapshot;
+// One charging UI pass from the published battery state: LED, health
+// check and, with the screen on, the next animation frame.  Returns the
+// battery level or -1.
+int charge_ui_update(struct battery_snapshot *snap);
+// Refresh the battery state, returns 1 if no charger is connected.
+int charge_plugged_out(void);
 // Initialize the graphics system.
 int ui_init(void);
 // Initialize thr rtc
@@ -119,13 +137,6 @@ enum thread_ctrl{
 	INPUT_THREAD_CTRL,
 };
 
-enum pixel{
-        SIZE_360X640,
-        SIZE_480X800,
-        SIZE_720X1280,
-        SIZE_1080X1920,
-        SIZE_1440X2560,
-};
 int is_exit;
 int status_index;
 //enum thread_status thread_ext_ctrl;
@@ -0,0 +1,121 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <cutils/properties.h>
+
+#include "common.h"
+#include "frame_clock.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+int frame_clock_fps(void) {
+	char value[PROPERTY_VALUE_MAX];
+	int fps;
+
+	property_get("ro.vendor.charge.fps", value, "");
+	fps = value[0] ? atoi(value) : PROGRESSBAR_INDETERMINATE_FPS;
+	if (fps < 1)
+		fps = 1;
+	else if (fps > FRAME_CLOCK_FPS_MAX)
+		fps = FRAME_CLOCK_FPS_MAX;
+	return fps;
+}
+
+int frame_clock_init(struct frame_clock *fc, int fps) {
+	memset(fc, 0, sizeof(*fc));
+	if (fps < 1 || fps > FRAME_CLOCK_FPS_MAX)
+		fps = PROGRESSBAR_INDETERMINATE_FPS;
+	fc->fps = fps;
+	fc->period_ns = NSEC_PER_SEC / fps;
+	fc->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fc->fd < 0) {
+		LOGE("frame clock timerfd failed errno=%d(%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+void frame_clock_exit(struct frame_clock *fc) {
+	if (fc->fd >= 0)
+		close(fc->fd);
+	fc->fd = -1;
+	fc->running = 0;
+}
+
+int frame_clock_start(struct frame_clock *fc) {
+	struct itimerspec its;
+	struct timespec now;
+	long long first;
+
+	if (fc->fd < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	first = now.tv_sec * NSEC_PER_SEC + now.tv_nsec + fc->period_ns;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = first / NSEC_PER_SEC;
+	its.it_value.tv_nsec = first % NSEC_PER_SEC;
+	its.it_interval.tv_sec = fc->period_ns / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = fc->period_ns % NSEC_PER_SEC;
+	// The kernel advances a periodic absolute timer from the previous
+	// deadline, not from when it was read.
+	if (timerfd_settime(fc->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		LOGE("frame clock settime failed errno=%d(%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	fc->running = 1;
+	return 0;
+}
+
+void frame_clock_stop(struct frame_clock *fc) {
+	struct itimerspec its;
+
+	if (fc->fd < 0 || !fc->running)
+		return;
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(fc->fd, 0, &its, NULL);
+	fc->running = 0;
+}
+
+int frame_clock_consume(struct frame_clock *fc) {
+	uint64_t expirations;
+
+	if (read(fc->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return 0;
+	fc->frames++;
+	if (expirations > 1) {
+		fc->missed += expirations - 1;
+		LOGD("frame clock: %llu frame(s) missed, %lu total\n",
+		     (unsigned long long)(expirations - 1), fc->missed);
+	}
+	return (int)expirations;
+}
+
+int frame_clock_wait(struct frame_clock *fc) {
+	struct pollfd pfd;
+	int n;
+
+	if (fc->fd < 0 || !fc->running)
+		return -1;
+	pfd.fd = fc->fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		n = frame_clock_consume(fc);
+		if (n > 0)
+			return n;
+	}
+}
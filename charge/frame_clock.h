@@ -0,0 +1,46 @@
+/********************************************************************************
+**  Copyright:  2016 Spreadtrum, Incorporated. All Rights Reserved.
+*********************************************************************************/
+
+#ifndef FRAME_CLOCK_H_
+#define FRAME_CLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_CLOCK_FPS_MAX 60
+
+// Animation clock on a CLOCK_MONOTONIC timerfd.  Deadlines are absolute
+// (start + n * period), so render and flip time never push the next
+// frame back and the rate does not drift.  Deadlines that pass while a
+// frame is still being drawn are counted as missed, not queued.
+struct frame_clock {
+	int fd;
+	int fps;
+	long long period_ns;
+	int running;
+	unsigned long frames;	// deadlines that produced a frame
+	unsigned long missed;	// deadlines skipped because a frame ran late
+};
+
+// Frame rate from ro.vendor.charge.fps, PROGRESSBAR_INDETERMINATE_FPS if
+// unset, clamped to 1..FRAME_CLOCK_FPS_MAX.
+extern int frame_clock_fps(void);
+extern int frame_clock_init(struct frame_clock *fc, int fps);
+extern void frame_clock_exit(struct frame_clock *fc);
+// Start ticking, the first deadline is one period from now.
+extern int frame_clock_start(struct frame_clock *fc);
+extern void frame_clock_stop(struct frame_clock *fc);
+// Block until the next deadline.  Returns the number of deadlines that
+// passed (1 when on time), or -1 on error or if the clock is stopped.
+extern int frame_clock_wait(struct frame_clock *fc);
+// Same accounting for callers polling fc->fd themselves, returns 0 if
+// no deadline has passed yet.
+extern int frame_clock_consume(struct frame_clock *fc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
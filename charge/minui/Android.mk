@@ -2,7 +2,7 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := graphics.c graphics_drm.c \
-graphics_fbdev.c events.c resources.c
+graphics_fbdev.c graphics_simd.c graphics_rotate.c graphics_scale.c graphics_ring.c events.c resources.c
 
 LOCAL_WHOLE_STATIC_LIBRARIES += libdrm libpng
 LOCAL_SHARED_LIBRARIES += libcutils
@@ -14,11 +14,23 @@ LOCAL_VENDOR_MODULE := true
 # ordinary characters in this context).  Strip double-quotes from the
 # value so that either will work.
 
+# mkbundle below must be built with the same pixel format.
+charge_pixel_cflags :=
 ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),RGBX_8888)
-  LOCAL_CFLAGS += -DRECOVERY_RGBX
+  charge_pixel_cflags += -DRECOVERY_RGBX
 endif
 ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),BGRA_8888)
-  LOCAL_CFLAGS += -DRECOVERY_BGRA
+  charge_pixel_cflags += -DRECOVERY_BGRA
+endif
+ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),RGB_565)
+  charge_pixel_cflags += -DRECOVERY_RGB565
+endif
+LOCAL_CFLAGS += $(charge_pixel_cflags)
+
+ifneq ($(TARGET_CHARGE_DRM_BUFFERS),)
+  LOCAL_CFLAGS += -DDRM_BUFFER_COUNT=$(TARGET_CHARGE_DRM_BUFFERS)
+else
+  LOCAL_CFLAGS += -DDRM_BUFFER_COUNT=3
 endif
 
 ifneq ($(TARGET_RECOVERY_OVERSCAN_PERCENT),)
@@ -28,3 +40,20 @@ else
 endif
 
 include $(BUILD_STATIC_LIBRARY)
+
+# Host tool that prebuilds the image bundle, see mkbundle.c.
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := mkbundle.c resources.c graphics_simd.c graphics_rotate.c graphics_scale.c
+LOCAL_STATIC_LIBRARIES := libpng libz
+LOCAL_CFLAGS += $(charge_pixel_cflags)
+LOCAL_MODULE := charge_mkbundle
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host tool that converts the images to QOI, see mkqoi.c.
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := mkqoi.c
+LOCAL_STATIC_LIBRARIES := libpng libz
+LOCAL_MODULE := charge_mkqoi
+include $(BUILD_HOST_EXECUTABLE)
+
+charge_pixel_cflags :=
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include <unistd.h>
 
 #include <dirent.h>
+#include <sys/epoll.h>
 #include <sys/poll.h>
 
 #include <linux/input.h>
@@ -29,9 +31,24 @@
 #include "../common.h"
 
 #define MAX_DEVICES 16
+#define MAX_MISC_FDS 16
 #define EVIOCSSUSPENDBLOCK _IOW('E', 0x91, int)
 static struct pollfd ev_fds[MAX_DEVICES];
 static unsigned ev_count = 0;
+static int ev_rtc_fd = -1;
+
+/* epoll dispatch, used when everything runs from one event loop */
+struct fd_info {
+    int fd;
+    ev_callback cb;
+    void *data;
+};
+
+static int epollfd = -1;
+static struct fd_info ev_fdinfo[MAX_DEVICES + MAX_MISC_FDS];
+static unsigned ev_fdinfo_count = 0;
+static struct epoll_event polledevents[MAX_DEVICES + MAX_MISC_FDS];
+static int npolledevents = 0;
 
 int ev_init(void) {
     DIR *dir;
@@ -45,6 +62,7 @@ int ev_init(void) {
         ev_fds[ev_count].fd = fd;
         ev_fds[ev_count].events = POLLIN;
         ev_count++;
+        ev_rtc_fd = fd;
     }
     dir = opendir("/dev/input");
     if(dir == NULL){
@@ -70,6 +88,97 @@ void ev_exit(void) {
     while (ev_count > 0) {
         close(ev_fds[--ev_count].fd);
     }
+    ev_rtc_fd = -1;
+    ev_fdinfo_count = 0;
+    npolledevents = 0;
+    if (epollfd >= 0) {
+        close(epollfd);
+        epollfd = -1;
+    }
+}
+
+int ev_add_fd(int fd, ev_callback cb, void *data) {
+    struct epoll_event ev;
+
+    if (fd < 0 || ev_fdinfo_count == MAX_DEVICES + MAX_MISC_FDS)
+        return -1;
+
+    if (epollfd < 0) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd < 0) {
+            LOGE("epoll_create1 failed errno=%d(%s)\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    ev_fdinfo[ev_fdinfo_count].fd = fd;
+    ev_fdinfo[ev_fdinfo_count].cb = cb;
+    ev_fdinfo[ev_fdinfo_count].data = data;
+
+    ev.events = EPOLLIN | EPOLLWAKEUP;
+    ev.data.ptr = &ev_fdinfo[ev_fdinfo_count];
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("epoll_ctl add fd %d failed errno=%d(%s)\n", fd, errno, strerror(errno));
+        return -1;
+    }
+    ev_fdinfo_count++;
+    return 0;
+}
+
+int ev_add_input_fds(ev_callback cb, void *data) {
+    unsigned n;
+
+    for (n = 0; n < ev_count; n++) {
+        if (ev_add_fd(ev_fds[n].fd, cb, data) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int ev_wait(int timeout) {
+    if (epollfd < 0)
+        return -1;
+
+    npolledevents = epoll_wait(epollfd, polledevents,
+                               MAX_DEVICES + MAX_MISC_FDS, timeout);
+    if (npolledevents <= 0)
+        return -1;
+    return 0;
+}
+
+void ev_dispatch(void) {
+    int n;
+
+    for (n = 0; n < npolledevents; n++) {
+        struct fd_info *fdi = polledevents[n].data.ptr;
+        if (fdi->cb)
+            fdi->cb(fdi->fd, polledevents[n].events, fdi->data);
+    }
+    npolledevents = 0;
+}
+
+int ev_get_input(int fd, uint32_t epevents, struct input_event *ev) {
+    unsigned long alarm_data;
+    ssize_t r;
+
+    if (!(epevents & EPOLLIN))
+        return -1;
+
+    if (fd == ev_rtc_fd) {
+        r = read(fd, &alarm_data, sizeof(alarm_data));
+        if (r != sizeof(alarm_data))
+            return -1;
+        LOGD("get form rtc is %lu\n", alarm_data);
+        ev->type = EV_KEY;
+        ev->code = KEY_BRL_DOT8;
+        ev->value = 1;
+        return 0;
+    }
+
+    r = read(fd, ev, sizeof(*ev));
+    if (r != sizeof(*ev) || ev->type != EV_KEY)
+        return -1;
+    return 0;
 }
 
 /* wait: 0 dont wait; -1 wait forever; >0 wait ms */
@@ -37,6 +37,10 @@
 #include "../common.h"
 /* SPRD: add for support rotate @{ */
 #include "cutils/properties.h"
+// rotate is the layout the charger UI picks from the first gr_init();
+// it turns its images itself and draws upright.  rotation turns the
+// primitives, and is only set by a second gr_init() with rotate already
+// set, or by gr_init_backend(); the charger calls gr_init() once.
 static int rotation = FB_ROTATE_UR;
 int rotate = FB_ROTATE_UR;
 /* @} */
@@ -62,16 +66,55 @@ static unsigned char gr_current_b = 255;
 static unsigned char gr_current_a = 255;
 
 static GRSurface* gr_draw = NULL;
+
 /* SPRD: add for support rotate @{ */
-static int fix_width = 0;
-static int fix_height = 0;
-void change_resolution_for_rotate(int enable);
-static void gr_rotate_90(void);
-static void gr_rotate_180(void);
-static void gr_rotate_270(void);
+// Callers draw in logical coordinates: the panel turned by rotation.
+// The primitives map them onto gr_draw, which is always in scanout
+// orientation, so a finished frame needs no rotation pass.
+static int gr_width(void) {
+    return (rotation == FB_ROTATE_CW || rotation == FB_ROTATE_CCW) ?
+            gr_draw->height : gr_draw->width;
+}
+
+static int gr_height(void) {
+    return (rotation == FB_ROTATE_CW || rotation == FB_ROTATE_CCW) ?
+            gr_draw->width : gr_draw->height;
+}
+
+// Where a logical rectangle lands in gr_draw, and how to read a source
+// stored in logical order (stride pixels per row) to fill it row by
+// row: pixel c of row r comes from index start + r*rstep + c*cstep.
+typedef struct {
+    int x, y, w, h;
+    int start, cstep, rstep;
+} GRMapping;
+
+static void gr_map(int x, int y, int w, int h, int stride, GRMapping* m) {
+    int fw = gr_draw->width, fh = gr_draw->height;
+
+    switch (rotation) {
+    case FB_ROTATE_CW:
+        *m = (GRMapping){ fw - y - h, x, h, w, (h - 1) * stride, -stride, 1 };
+        break;
+    case FB_ROTATE_CCW:
+        *m = (GRMapping){ y, fh - x - w, h, w, w - 1, stride, -1 };
+        break;
+    case FB_ROTATE_UD:
+        *m = (GRMapping){ fw - x - w, fh - y - h, w, h, (h - 1) * stride + w - 1, -1, -stride };
+        break;
+    default:
+        *m = (GRMapping){ x, y, w, h, 0, 1, stride };
+        break;
+    }
+}
+
+static unsigned char* gr_pixel(int x, int y) {
+    return gr_draw->data + y * gr_draw->row_bytes + x * gr_draw->pixel_bytes;
+}
 /* @} */
+
 static bool outside(int x, int y) {
-    return x < 0 || x >= gr_draw->width || y < 0 || y >= gr_draw->height;
+    return x < 0 || x >= gr_width() || y < 0 || y >= gr_height();
 }
 
 int gr_measure(const char *s) {
@@ -83,35 +126,35 @@ void gr_font_size(int *x, int *y) {
     *y = gr_font->cheight;
 }
 
+static uint32_t gr_current_color(void) {
+    return GR_COLOR(gr_current_r, gr_current_g, gr_current_b, gr_current_a);
+}
+
+// Blend the color through an 8-bit coverage image onto the logical
+// rectangle at (x, y).  When rotated, each row of the panel rectangle
+// gathers its coverage first so the row kernel still does the work.
 static void text_blend(unsigned char* src_p, int src_row_bytes,
-                       unsigned char* dst_p, int dst_row_bytes,
-                       int width, int height) {
-    int i, j;
-    for (j = 0; j < height; ++j) {
-        unsigned char* sx = src_p;
-        unsigned char* px = dst_p;
-        for (i = 0; i < width; ++i) {
-            unsigned char a = *sx++;
-            if (gr_current_a < 255) a = ((int)a * gr_current_a) / 255;
-            if (a == 255) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            } else if (a > 0) {
-                *px = (*px * (255-a) + gr_current_r * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_g * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_b * a) / 255;
-                ++px;
-                ++px;
-            } else {
-                px += 4;
-            }
+                       int x, int y, int width, int height) {
+    uint32_t color = gr_current_color();
+    unsigned char coverage[256];
+    GRMapping m;
+    int r, c, n;
+
+    gr_map(x, y, width, height, src_row_bytes, &m);
+    for (r = 0; r < m.h; ++r) {
+        unsigned char* dst_p = gr_pixel(m.x, m.y + r);
+        if (rotation == FB_ROTATE_UR) {
+            gr_span.text(src_p + r * src_row_bytes, dst_p, m.w, color);
+            continue;
+        }
+        for (c = 0; c < m.w; c += n) {
+            const unsigned char* sx = src_p + m.start + r * m.rstep + c * m.cstep;
+            int i;
+            n = m.w - c < (int)sizeof(coverage) ? m.w - c : (int)sizeof(coverage);
+            for (i = 0; i < n; ++i)
+                coverage[i] = sx[i * m.cstep];
+            gr_span.text(coverage, dst_p + c * gr_draw->pixel_bytes, n, color);
         }
-        src_p += src_row_bytes;
-        dst_p += dst_row_bytes;
     }
 }
 
@@ -134,10 +177,8 @@ void gr_text(int x, int y, const char *s, int bold) {
         if (off < 96) {
             unsigned char* src_p = font->texture->data + (off * font->cwidth) +
                 (bold ? font->cheight * font->texture->row_bytes : 0);
-            unsigned char* dst_p = gr_draw->data + y*gr_draw->row_bytes + x*gr_draw->pixel_bytes;
             text_blend(src_p, font->texture->row_bytes,
-                       dst_p, gr_draw->row_bytes,
-                       font->cwidth, font->cheight);
+                       x, y, font->cwidth, font->cheight);
         }
         x += font->cwidth;
     }
@@ -156,12 +197,7 @@ void gr_texticon(int x, int y, GRSurface* icon) {
 
     if (outside(x, y) || outside(x+icon->width-1, y+icon->height-1)) return;
 
-    unsigned char* src_p = icon->data;
-    unsigned char* dst_p = gr_draw->data + y*gr_draw->row_bytes + x*gr_draw->pixel_bytes;
-
-    text_blend(src_p, icon->row_bytes,
-               dst_p, gr_draw->row_bytes,
-               icon->width, icon->height);
+    text_blend(icon->data, icon->row_bytes, x, y, icon->width, icon->height);
 }
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
@@ -172,20 +208,19 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
 }
 
 void gr_clear() {
+    // Grey is one repeated byte in 4-byte formats, in RGB565 only black
+    // and white are.
     if (gr_current_r == gr_current_g &&
-        gr_current_r == gr_current_b) {
+        gr_current_r == gr_current_b &&
+        (GR_PIXEL_BYTES == 4 || gr_current_r == 0 || gr_current_r == 255)) {
         memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
     } else {
-        int x, y;
+        uint32_t color = gr_current_color();
+        int y;
         unsigned char* px = gr_draw->data;
         for (y = 0; y < gr_draw->height; ++y) {
-            for (x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
+            gr_span.fill(px, gr_draw->width, color);
+            px += gr_draw->row_bytes;
         }
     }
 }
@@ -199,32 +234,19 @@ void gr_fill(int x1, int y1, int x2, int y2) {
 
     if (outside(x1, y1) || outside(x2-1, y2-1)) return;
 
-    unsigned char* p = gr_draw->data + y1 * gr_draw->row_bytes + x1 * gr_draw->pixel_bytes;
+    GRMapping m;
+    gr_map(x1, y1, x2 - x1, y2 - y1, 0, &m);
+    unsigned char* p = gr_pixel(m.x, m.y);
+    uint32_t color = gr_current_color();
+    int y;
     if (gr_current_a == 255) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
+        for (y = 0; y < m.h; ++y) {
+            gr_span.fill(p, m.w, color);
             p += gr_draw->row_bytes;
         }
     } else if (gr_current_a > 0) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px = (*px * (255-gr_current_a) + gr_current_r * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_g * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_b * gr_current_a) / 255;
-                ++px;
-                ++px;
-            }
+        for (y = 0; y < m.h; ++y) {
+            gr_span.blend(p, m.w, color);
             p += gr_draw->row_bytes;
         }
     }
@@ -244,16 +266,115 @@ void gr_blit(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
 
     if (outside(dx, dy) || outside(dx+w-1, dy+h-1)) return;
     unsigned char* src_p = source->data + sy*source->row_bytes + sx*source->pixel_bytes;
-    unsigned char* dst_p = gr_draw->data + dy*gr_draw->row_bytes + dx*gr_draw->pixel_bytes;
 
-    int i;
-    for (i = 0; i < h; ++i) {
-        memcpy(dst_p, src_p, w * source->pixel_bytes);
-        src_p += source->row_bytes;
-        dst_p += gr_draw->row_bytes;
+    GRMapping m;
+    gr_map(dx, dy, w, h, source->row_bytes / GR_PIXEL_BYTES, &m);
+    unsigned char* dst_p = gr_pixel(m.x, m.y);
+
+    int i, j;
+    switch (rotation) {
+    case FB_ROTATE_CW:
+        gr_rotate_cw(src_p, source->row_bytes, dst_p, gr_draw->row_bytes, w, h);
+        break;
+    case FB_ROTATE_CCW:
+        gr_rotate_ccw(src_p, source->row_bytes, dst_p, gr_draw->row_bytes, w, h);
+        break;
+    case FB_ROTATE_UD:
+        for (i = 0; i < m.h; ++i) {
+            const gr_pixel_t* sx = (const gr_pixel_t*)src_p + m.start + i * m.rstep;
+            gr_pixel_t* px = (gr_pixel_t*)dst_p;
+            for (j = 0; j < m.w; ++j)
+                px[j] = sx[-j];
+            dst_p += gr_draw->row_bytes;
+        }
+        break;
+    default:
+        for (i = 0; i < h; ++i) {
+            memcpy(dst_p, src_p, w * source->pixel_bytes);
+            src_p += source->row_bytes;
+            dst_p += gr_draw->row_bytes;
+        }
+        break;
     }
 }
 
+// Composite the logical rectangle of a surface with alpha.  Upright,
+// each source row is walked by its runs: opaque runs are copied,
+// transparent pixels skipped and only the rest blended.  Rotated, each
+// row of the panel rectangle gathers its pixels and alpha first and is
+// split into opaque and blended spans the same way.
+static void blit_blend(GRSurface* source, unsigned char* src_p, const unsigned char* cov_p,
+                       int sx, int sy, int w, int h, int dx, int dy) {
+    const GRSurfaceAlpha* alpha = source->alpha;
+    int pb = GR_PIXEL_BYTES;
+    GRMapping m;
+    int r, c, n;
+
+    gr_map(dx, dy, w, h, source->width, &m);
+    for (r = 0; r < m.h; ++r) {
+        unsigned char* dst_p = gr_pixel(m.x, m.y + r);
+        if (rotation == FB_ROTATE_UR) {
+            const GRAlphaRun* run = alpha->runs + alpha->row_runs[sy + r];
+            const GRAlphaRun* end = alpha->runs + alpha->row_runs[sy + r + 1];
+            for (; run < end; ++run) {
+                int x0 = run->x > sx ? run->x : sx;
+                int x1 = run->x + run->n < sx + w ? run->x + run->n : sx + w;
+                if (x0 >= x1) continue;
+                if (run->opaque) {
+                    memcpy(dst_p + (x0 - sx) * pb, src_p + (x0 - sx) * pb, (x1 - x0) * pb);
+                } else {
+                    gr_span.over(src_p + (x0 - sx) * pb, cov_p + (x0 - sx),
+                                 dst_p + (x0 - sx) * pb, x1 - x0);
+                }
+            }
+            src_p += source->row_bytes;
+            cov_p += source->width;
+            continue;
+        }
+        for (c = 0; c < m.w; c += n) {
+            gr_pixel_t pixels[128];
+            unsigned char coverage[128];
+            int k = m.start + r * m.rstep + c * m.cstep;
+            int i;
+            n = m.w - c < 128 ? m.w - c : 128;
+            for (i = 0; i < n; ++i, k += m.cstep) {
+                pixels[i] = ((const gr_pixel_t*)src_p)[k];
+                coverage[i] = cov_p[k];
+            }
+            for (i = 0; i < n; i = k) {
+                int opaque = coverage[i] == 255;
+                for (k = i + 1; k < n && (coverage[k] == 255) == opaque; ++k) {}
+                if (opaque)
+                    memcpy(dst_p + (c + i) * pb, pixels + i, (k - i) * pb);
+                else
+                    gr_span.over((unsigned char*)(pixels + i), coverage + i,
+                                 dst_p + (c + i) * pb, k - i);
+            }
+        }
+    }
+}
+
+void gr_blit_blend(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
+    if (source == NULL)    return;
+
+    if (source->alpha == NULL) {
+        gr_blit(source, sx, sy, w, h, dx, dy);
+        return;
+    }
+
+    if (gr_draw->pixel_bytes != source->pixel_bytes) {
+        printf("gr_blit_blend: source has wrong format\n");
+        return;
+    }
+
+    dx += overscan_offset_x;
+    dy += overscan_offset_y;
+
+    if (outside(dx, dy) || outside(dx+w-1, dy+h-1)) return;
+    blit_blend(source, source->data + sy*source->row_bytes + sx*source->pixel_bytes,
+               source->alpha->coverage + sy*source->width + sx, sx, sy, w, h, dx, dy);
+}
+
 unsigned int gr_get_width(GRSurface* surface) {
     if (surface == NULL) {
         return 0;
@@ -314,44 +435,66 @@ void gr_sync(void) {
         return;
 
     if (gr_backend->sync)
-        gr_backend->sync(gr_draw);
+        gr_backend->sync(gr_backend);
 }
+
+int gr_fb_event_fd(void) {
+    if (gr_backend == NULL || !gr_backend->event_fd)
+        return -1;
+    return gr_backend->event_fd(gr_backend);
+}
+
+void gr_fb_handle_event(void) {
+    if (gr_backend && gr_backend->handle_event)
+        gr_backend->handle_event(gr_backend);
+}
+int gr_fb_buffer_age(void) {
+    if (gr_backend == NULL || !gr_backend->buffer_age)
+        return 0;
+    return gr_backend->buffer_age(gr_backend);
+}
+
 extern int adf_blank_done;
 extern int flip_enter;
 void gr_flip() {
+    gr_flip_damage(NULL, 0);
+}
+
+void gr_flip_damage(const GRRect* rects, int count) {
+       GRRect clips[GR_DAMAGE_MAX];
+       int i;
+
        flip_enter = 1;
        LOGE("adf_blank_status = %d (1: splash screen 0: not splash screen)\n",adf_blank_done);
        if (!adf_blank_done){
                 flip_enter = 0;
                 return;
        }
-/* SPRD: add for support rotate @{ */
-       switch(rotation){
-                case FB_ROTATE_CW:
-                        gr_rotate_90();
-                        break;
-                case FB_ROTATE_UD:
-                        gr_rotate_180();
-                        break;
-                case FB_ROTATE_CCW:
-                        gr_rotate_270();
-                        break;
-                default:
-                        ;
-       }
-/* @} */
-      gr_draw = gr_backend->flip(gr_backend);
-/* SPRD: add for support rotate @{ */
-      if((rotation == FB_ROTATE_CW) || (rotation == FB_ROTATE_CCW)){
-            change_resolution_for_rotate(true);
+      if (rects && count > 0 && count <= GR_DAMAGE_MAX && gr_backend->flip_damage) {
+            for (i = 0; i < count; i++) {
+                  GRMapping m;
+                  gr_map(rects[i].x + overscan_offset_x, rects[i].y + overscan_offset_y,
+                         rects[i].w, rects[i].h, 0, &m);
+                  clips[i].x = m.x;
+                  clips[i].y = m.y;
+                  clips[i].w = m.w;
+                  clips[i].h = m.h;
+            }
+            gr_draw = gr_backend->flip_damage(gr_backend, clips, count);
+      } else if (gr_backend->flip_damage) {
+            gr_draw = gr_backend->flip_damage(gr_backend, NULL, 0);
+      } else {
+            gr_draw = gr_backend->flip(gr_backend);
       }
-/* @} */
       flip_enter = 0;
 }
 
+static int gr_init_draw(void);
+
 int gr_init(void) {
 /* SPRD: add for support rotate @{ */
         char rotate_str[PROPERTY_VALUE_MAX+1];
+        char atomic_str[PROPERTY_VALUE_MAX+1];
         property_get("ro.vendor.minui.hwrotation", rotate_str, "0");
         LOGD("in %s: ro.vendor.minui.hwrotation=%s\n",__func__,rotate_str);
 	if (rotate == FB_ROTATE_UR) {
@@ -375,6 +518,7 @@ int gr_init(void) {
 	}
 /* @} */
 
+    gr_span_init();
     gr_init_font();
 
     gr_vt_fd = open("/dev/tty0", O_RDWR | O_SYNC);
@@ -388,11 +532,26 @@ int gr_init(void) {
         return -1;
     }
 
-    gr_backend = open_drm();
-    if (gr_backend) {
-        gr_draw = gr_backend->init(gr_backend);
-        if (!gr_draw) {
-            gr_backend->exit(gr_backend);
+    // Atomic KMS first, then legacy KMS, then fbdev.
+    // ro.vendor.minui.atomic=0 skips the atomic backend.
+    property_get("ro.vendor.minui.atomic", atomic_str, "1");
+    if (strcmp(atomic_str, "0")) {
+        gr_backend = open_drm_atomic();
+        if (gr_backend) {
+            gr_draw = gr_backend->init(gr_backend);
+            if (!gr_draw) {
+                gr_backend->exit(gr_backend);
+            }
+        }
+    }
+
+    if (!gr_draw) {
+        gr_backend = open_drm();
+        if (gr_backend) {
+            gr_draw = gr_backend->init(gr_backend);
+            if (!gr_draw) {
+                gr_backend->exit(gr_backend);
+            }
         }
     }
 
@@ -403,17 +562,38 @@ int gr_init(void) {
             return -1;
         }
     }
-    //add sprd for roate
-    fix_width = gr_draw->width;
-    fix_height = gr_draw->height;
+    return gr_init_draw();
+}
 
-/* SPRD: add for support rotate @{ */
-    if((rotation == FB_ROTATE_CW) || (rotation == FB_ROTATE_CCW)){
-           change_resolution_for_rotate(true);
+int gr_init_backend(minui_backend* backend, int r) {
+    rotation = r;
+    gr_span_init();
+    if (gr_font == NULL)
+        gr_init_font();
+
+    gr_backend = backend;
+    gr_draw = gr_backend->init(gr_backend);
+    if (gr_draw == NULL)
+        return -1;
+    return gr_init_draw();
+}
+
+// The part of gr_init() after the backend is up.
+static int gr_init_draw(void) {
+    if (gr_draw->pixel_bytes != GR_PIXEL_BYTES) {
+        LOGE("in %s: display has %d bytes per pixel, minui draws %d\n",
+             __func__, gr_draw->pixel_bytes, GR_PIXEL_BYTES);
     }
-/* @} */
-    overscan_offset_x = gr_draw->width * overscan_percent / 100;
-    overscan_offset_y = gr_draw->height * overscan_percent / 100;
+
+    // Let the display rotate if it can, the primitives then draw upright.
+    if (rotation != FB_ROTATE_UR && gr_backend->set_rotation &&
+        gr_backend->set_rotation(gr_backend, rotation) == 0) {
+        LOGD("in %s: hardware rotation %d\n", __func__, rotation);
+        rotation = FB_ROTATE_UR;
+    }
+
+    overscan_offset_x = gr_width() * overscan_percent / 100;
+    overscan_offset_y = gr_height() * overscan_percent / 100;
 
     gr_flip();
     gr_flip();
@@ -427,126 +607,18 @@ void gr_exit(void) {
     ioctl(gr_vt_fd, KDSETMODE, (void*) KD_TEXT);
     close(gr_vt_fd);
     gr_vt_fd = -1;
-    fix_width = 0;
-    fix_height = 0;
 }
 
 int gr_fb_width(void) {
-    return gr_draw->width - 2*overscan_offset_x;
+    return gr_width() - 2*overscan_offset_x;
 }
 
 int gr_fb_height(void) {
-    return gr_draw->height - 2*overscan_offset_y;
+    return gr_height() - 2*overscan_offset_y;
 }
 
 void gr_fb_blank(bool blank) {
     gr_backend->blank(gr_backend, blank);
 }
 
-/* SPRD: add for support rotate @{ */
-void change_resolution_for_rotate(int enable)
-{
-    if (enable) {
-        gr_draw->width = fix_height;
-        gr_draw->height = fix_width;
-    } else {
-        gr_draw->width = fix_width;
-        gr_draw->height = fix_height;
-    }
-    gr_draw->row_bytes = gr_draw->width * 4;
-}
-static void gr_rotate_90()
-{
-    change_resolution_for_rotate(false);
-    unsigned int height = gr_draw->height;
-    unsigned int width = gr_draw->width;
-    unsigned int row_bytes = gr_draw->row_bytes;
-    unsigned char* src_p = gr_draw->data;
-    unsigned char* dst_p ;
-    unsigned char* src_p_b;
-    unsigned int i, j;
-    unsigned long mem_size;
-
-    mem_size = (unsigned long)gr_draw->row_bytes * height;
-    dst_p = (unsigned char*)malloc(mem_size);
-    if(!dst_p){
-        return;
-    }
-
-    src_p_b = dst_p;
-
-    for (i = 0; i < height; i++)
-        for (j = 0; j < width; j++)
-            src_p_b[i * width + j] = src_p[(width -j -1)*height+ i];
-
-    memcpy(gr_draw->data, dst_p, mem_size);
-    free(dst_p);
-}
-
-static void gr_rotate_180(void)
-{
-        unsigned int height = gr_draw->height;
-        unsigned int width = gr_draw->width;
-        unsigned int row_bytes = gr_draw->row_bytes;
-        unsigned char* src_p = gr_draw->data;
-        unsigned char* dst_p ;
-        unsigned char* src_p_b;
-        unsigned int i, j;
-        unsigned long mem_size;
-
-        mem_size = (unsigned long)row_bytes * height;
-        dst_p = malloc(mem_size);
-        if(!dst_p){
-             return;
-        }
-
-        src_p_b = dst_p + mem_size -1;
-        for (j = 0; j < height; ++j) {
-            unsigned char* sx = src_p;
-            unsigned char* px = src_p_b ;
-            for (i = 0; i < width; ++i) {
-                *(px-0) = *(sx+3);
-                *(px-1) = *(sx+2);
-                *(px-2) = *(sx+1);
-                *(px-3) = *(sx+0);
-                px-=4;
-                sx+=4;
-            }
-            src_p += row_bytes;
-            src_p_b -= row_bytes;
-        }
-
-        memcpy(gr_draw->data, dst_p, mem_size);
-        free(dst_p);
-}
-
-
-static void gr_rotate_270()
-{
-    change_resolution_for_rotate(false);
-    unsigned int height = gr_draw->height;
-    unsigned int width = gr_draw->width;
-    unsigned int row_bytes = gr_draw->row_bytes;
-    unsigned char* src_p = gr_draw->data;
-    unsigned char* dst_p ;
-    unsigned char* src_p_b;
-    unsigned int i, j;
-    unsigned long mem_size;
-
-    mem_size = (unsigned long)gr_draw->row_bytes * height;
-    dst_p = (unsigned char*)malloc(mem_size);
-    if(!dst_p){
-        return;
-    }
-
-    src_p_b = dst_p;
-
-    for (i = 0; i < height; i++)
-        for (j = 0; j < width; j++)
-            src_p_b[(height - i) * width - j] = src_p[(width -j -1)*height+ i];
-
-    memcpy(gr_draw->data, dst_p, mem_size);
-    free(dst_p);
-}
-/* @} */
 
@@ -26,24 +26,155 @@ extern "C" {
 typedef struct minui_backend {
     // Initializes the backend and returns a gr_surface to draw into.
     gr_surface (*init)(struct minui_backend*);
-    // Sync display surface buffer.
-    void (*sync)(struct GRSurface*);
+    // Wait until the current drawing surface may be written, e.g. until
+    // a page flip queued by flip() has completed.  Optional.
+    void (*sync)(struct minui_backend*);
 
     // Causes the current drawing surface (returned by the most recent
     // call to flip() or init()) to be displayed, and returns a new
     // drawing surface.
     gr_surface (*flip)(struct minui_backend*);
 
+    // Like flip(), with the rectangles that changed since the previous
+    // frame (NULL for all of them).  Optional, flip() is used if unset.
+    gr_surface (*flip_damage)(struct minui_backend*, const GRRect* rects, int count);
+
+    // Age of the current drawing surface as gr_fb_buffer_age() defines
+    // it.  Optional, surfaces are assumed undefined (0) if unset.
+    int (*buffer_age)(struct minui_backend*);
+
+    // Scan out rotated by rotation (FB_ROTATE_*) in hardware, called
+    // after init().  On success the drawing surfaces have the rotated
+    // size and need no software rotation; returns -1 if unsupported.
+    // Optional.
+    int (*set_rotation)(struct minui_backend*, int rotation);
+
     // Blank (or unblank) the screen.
     void (*blank)(struct minui_backend*, bool);
 
     // Device cleanup when drawing is done.
     void (*exit)(struct minui_backend*);
+
+    // fd that becomes readable when the display has an event (a flip
+    // completion) for handle_event(), or -1.  Optional.
+    int (*event_fd)(struct minui_backend*);
+    void (*handle_event)(struct minui_backend*);
 } minui_backend;
 
+// Pixel format of the drawing surfaces and of every display surface,
+// fixed at build time by TARGET_RECOVERY_PIXEL_FORMAT: RECOVERY_RGB565
+// is 16-bit 5:6:5, RECOVERY_BGRA is B, G, R, A bytes, anything else is
+// R, G, B, X bytes.  Images are converted to it once when loaded.
+#if defined(RECOVERY_RGB565)
+#define GR_PIXEL_BYTES 2
+typedef uint16_t gr_pixel_t;
+#else
+#define GR_PIXEL_BYTES 4
+typedef uint32_t gr_pixel_t;
+#endif
+
+// Color argument of the span kernels.  4-byte formats take it with
+// the channels in memory order, so BGRA shares the RGBX kernels.
+#if defined(RECOVERY_BGRA)
+#define GR_COLOR(r, g, b, a) \
+    ((uint32_t)(b) | ((uint32_t)(g) << 8) | ((uint32_t)(r) << 16) | ((uint32_t)(a) << 24))
+#else
+#define GR_COLOR(r, g, b, a) \
+    ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+#endif
+
+// Row kernels for GR_PIXEL_BYTES pixels behind the drawing primitives.
+// The color is packed by GR_COLOR(), and the fourth byte of each 4-byte
+// destination pixel is left as it was.
+typedef struct {
+    const char* name;
+    // Set n pixels to (r, g, b).
+    void (*fill)(unsigned char* px, int n, uint32_t color);
+    // Blend (r, g, b) over n pixels with the constant alpha a.
+    void (*blend)(unsigned char* px, int n, uint32_t color);
+    // Blend (r, g, b) over n pixels with alpha coverage[i] * a / 255.
+    void (*text)(const unsigned char* coverage, unsigned char* px, int n, uint32_t color);
+    // Convert n R, G, B, X pixels to the surface format.  px may be
+    // the same row as rgbx.
+    void (*convert)(const unsigned char* rgbx, unsigned char* px, int n);
+    // Composite n premultiplied pixels with alpha alpha[i] over px:
+    // px = src + px * (255 - alpha) / 255, saturating.
+    void (*over)(const unsigned char* src, const unsigned char* alpha,
+                 unsigned char* px, int n);
+} gr_span_ops;
+
+extern gr_span_ops gr_span;
+// The C reference kernels gr_span starts with, which every other set
+// must match byte for byte.
+extern const gr_span_ops gr_span_c;
+
+// A run of pixels in one row of a display surface that are either all
+// opaque or all partly transparent.  Fully transparent pixels are not
+// in any run.
+typedef struct {
+    unsigned short x;
+    unsigned short n;
+    unsigned char opaque;
+} GRAlphaRun;
+
+// Transparency of a display surface, built once when it is loaded so
+// gr_blit_blend() can copy opaque runs and skip transparent pixels.
+typedef struct GRSurfaceAlpha {
+    // Alpha of each pixel, width bytes per row.
+    unsigned char* coverage;
+    // The runs of row y are runs[row_runs[y]] up to runs[row_runs[y + 1]].
+    int* row_runs;
+    GRAlphaRun* runs;
+} GRSurfaceAlpha;
+
+// Build the GRSurfaceAlpha of a width x height image whose alpha values
+// are 'stride' bytes apart per row.  Returns NULL if the image is fully
+// opaque, or if there is no memory, which draws it opaque.  Free it
+// with free().
+GRSurfaceAlpha* gr_surface_alpha_create(const unsigned char* coverage, int stride,
+                                        int width, int height);
+
+// Switch gr_span to the fastest kernels the CPU supports.
+void gr_span_init(void);
+
+// Rotate a w x h image of GR_PIXEL_BYTES pixels into dst, which is h x w.
+// Strides are in bytes and src and dst must not overlap.
+void gr_rotate_cw(const unsigned char* src, int src_stride,
+                  unsigned char* dst, int dst_stride, int w, int h);
+void gr_rotate_ccw(const unsigned char* src, int src_stride,
+                   unsigned char* dst, int dst_stride, int w, int h);
+// Rotate a w x h image of GR_PIXEL_BYTES pixels by 180 degrees in place.
+void gr_rotate_180_inplace(unsigned char* px, int stride, int w, int h);
+
+// Shrinks an R, G, B, A image by area averaging, one source row at a
+// time in order.
+typedef struct GRScaler GRScaler;
+
+// NULL if out of memory or if dst is larger than src along either axis.
+GRScaler* gr_scaler_create(int src_w, int src_h, int dst_w, int dst_h);
+// Add the next source row, src_w * 4 bytes.  Returns the destination
+// row it completed, dst_w * 4 bytes valid until the next call, or NULL.
+const unsigned char* gr_scaler_push(GRScaler* s, const unsigned char* rgba);
+void gr_scaler_destroy(GRScaler* s);
+
 minui_backend* open_fbdev();
+// An fbdev backend on size bytes of memory at bits instead of the
+// device, for tests: width x height pixels, row_bytes apart, and
+// double-buffered if size holds two frames.
+minui_backend* open_fbdev_memory(void* bits, size_t size, int width, int height, int row_bytes);
 minui_backend* open_adf();
 minui_backend* open_drm();
+minui_backend* open_drm_atomic();
+
+// The DRM_MODE_ROTATE_* bit a plane rotation property (a libdrm
+// drmModePropertyRes) offers for rotation, 0 if none; *swap is set if
+// width and height trade places.  Exported for tests.
+struct _drmModeProperty;
+uint64_t drm_rotation_bit(const struct _drmModeProperty* prop, int rotation, bool* swap);
+
+// gr_init() on backend rather than the display it would find, with the
+// primitives turned by rotation (FB_ROTATE_*), for tests.
+int gr_init_backend(minui_backend* backend, int rotation);
 
 #ifdef __cplusplus
 }
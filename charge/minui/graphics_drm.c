@@ -27,6 +27,8 @@
 #include <sys/cdefs.h>
 #include <sys/mman.h>
 
+#include <linux/fb.h>
+
 #include <drm_fourcc.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -36,18 +38,76 @@
 
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(*(A)))
 
+// Dumb buffers per display: 2 for double, 3 for triple buffering.
+#ifndef DRM_BUFFER_COUNT
+#define DRM_BUFFER_COUNT 3
+#endif
+#if DRM_BUFFER_COUNT < 2 || DRM_BUFFER_COUNT > 3
+#error "DRM_BUFFER_COUNT must be 2 or 3"
+#endif
+
+enum drm_buffer_state {
+    DRM_BUFFER_FREE,       // may be drawn into
+    DRM_BUFFER_QUEUED,     // flip queued, waiting for vblank
+    DRM_BUFFER_SCANOUT,    // on screen
+};
+
 struct drm_surface_pdata {
     GRSurface base;
     uint32_t fb_id;
     uint32_t handle;
+    // Frame number this buffer was last presented as, 0 if never.
+    unsigned long frame;
+    enum drm_buffer_state state;
+    // Framebuffer over the same dumb buffer with width and height swapped,
+    // scanned out through a plane rotated by 90 or 270 degrees.
+    uint32_t rotated_fb_id;
+    size_t map_size;
 };
 
 typedef struct drm_surface_pdata* gr_surface_drm;
 
+// Property ids used by the atomic backend, 0 if the object lacks one.
+struct drm_atomic_props {
+    uint32_t conn_crtc_id;
+    uint32_t crtc_mode_id;
+    uint32_t crtc_active;
+    uint32_t plane_fb_id;
+    uint32_t plane_crtc_id;
+    uint32_t plane_src_x;
+    uint32_t plane_src_y;
+    uint32_t plane_src_w;
+    uint32_t plane_src_h;
+    uint32_t plane_crtc_x;
+    uint32_t plane_crtc_y;
+    uint32_t plane_crtc_w;
+    uint32_t plane_crtc_h;
+    uint32_t plane_damage_clips;
+    uint32_t plane_rotation;
+};
+
 struct drm_pdata {
     minui_backend base;
-    struct drm_surface_pdata* GRSurfaceDrms[2];
+    struct drm_surface_pdata* GRSurfaceDrms[DRM_BUFFER_COUNT];
+    int buffer_count;
+    // Buffer handed out for drawing, buffer on screen, and the buffer of
+    // a flip whose completion event has not been handled yet (or -1).
+    // The kernel takes one flip per crtc at a time.
     int current_buffer;
+    int scanout_buffer;
+    int queued_buffer;
+    // Frames presented so far, for buffer ages.
+    unsigned long frame_count;
+    // drmModeDirtyFB() is not implemented by the driver, stop calling it.
+    bool no_dirty_fb;
+    // Atomic modesetting: every state change is one drmModeAtomicCommit().
+    bool atomic;
+    int crtc_index;
+    uint32_t plane_id;
+    uint32_t mode_blob_id;
+    // Value of the plane's rotation property, 0 to leave it alone.
+    uint64_t rotation;
+    struct drm_atomic_props props;
     drmModeCrtc* main_monitor_crtc;
     drmModeConnector* main_monitor_connector;
     int drm_fd;
@@ -76,14 +136,20 @@ static void DrmEnableCrtc(struct drm_pdata* pdata,
   }
 }
 
+static void drm_wait_flip(struct drm_pdata *pdata);
+static int drm_atomic_set_active(struct drm_pdata *pdata, bool active);
+
 static void drm_blank(struct minui_backend *backend, bool blank) {
   struct drm_pdata *pdata = (struct drm_pdata *)backend;
 
-  if (blank) {
+  drm_wait_flip(pdata);
+  if (pdata->atomic) {
+    drm_atomic_set_active(pdata, !blank);
+  } else if (blank) {
     DrmDisableCrtc(pdata->drm_fd, pdata->main_monitor_crtc);
   } else {
     DrmEnableCrtc(pdata, pdata->main_monitor_crtc,
-                  pdata->GRSurfaceDrms[pdata->current_buffer]);
+                  pdata->GRSurfaceDrms[pdata->scanout_buffer]);
   }
 }
 
@@ -91,8 +157,14 @@ static void DrmDestroySurface(int drm_fd, gr_surface_drm surface) {
   if (!surface) return;
 
   if (surface->base.data) {
-    munmap(surface->base.data,
-          surface->base.row_bytes * surface->base.height);
+    munmap(surface->base.data, surface->map_size);
+  }
+
+  if (surface->rotated_fb_id) {
+    int ret = drmModeRmFB(drm_fd, surface->rotated_fb_id);
+    if (ret) {
+      printf("drmModeRmFB failed ret=%d\n", ret);
+    }
   }
 
   if (surface->fb_id) {
@@ -132,19 +204,23 @@ static int drm_format_to_bpp(uint32_t format) {
   }
 }
 
-static gr_surface_drm DrmCreateSurface(int drm_fd, int width, int height) {
-  gr_surface_drm surface = calloc(1, sizeof(*surface));
-
-  uint32_t format;
-#if defined(RECOVERY_ABGR)
-  format = DRM_FORMAT_RGBA8888;
+// The scanout format matching the pixels minui draws, see GR_PIXEL_BYTES.
+static uint32_t drm_format(void) {
+#if defined(RECOVERY_RGB565)
+  return DRM_FORMAT_RGB565;
+#elif defined(RECOVERY_ABGR)
+  return DRM_FORMAT_RGBA8888;
 #elif defined(RECOVERY_BGRA)
-  format = DRM_FORMAT_ARGB8888;
-#elif defined(RECOVERY_RGBX)
-  format = DRM_FORMAT_XBGR8888;
+  return DRM_FORMAT_ARGB8888;
 #else
-  format = DRM_FORMAT_RGB565;
+  return DRM_FORMAT_XBGR8888;
 #endif
+}
+
+static gr_surface_drm DrmCreateSurface(int drm_fd, int width, int height) {
+  gr_surface_drm surface = calloc(1, sizeof(*surface));
+
+  uint32_t format = drm_format();
 
   struct drm_mode_create_dumb create_dumb = {};
   create_dumb.height = height;
@@ -187,8 +263,8 @@ static gr_surface_drm DrmCreateSurface(int drm_fd, int width, int height) {
   surface->base.width = width;
   surface->base.row_bytes = create_dumb.pitch;
   surface->base.pixel_bytes = create_dumb.bpp / 8;
-  surface->base.data = (unsigned char*)(mmap(NULL, surface->base.height *
-                                                   surface->base.row_bytes,
+  surface->map_size = (size_t)surface->base.height * surface->base.row_bytes;
+  surface->base.data = (unsigned char*)(mmap(NULL, surface->map_size,
                                                    PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd,
                                                    map_dumb.offset));
   if (surface->base.data == MAP_FAILED) {
@@ -321,6 +397,237 @@ static void DisableNonMainCrtcs(int fd, drmModeRes* resources, drmModeCrtc* main
   }
 }
 
+static uint32_t drm_get_prop_id(int fd, uint32_t object_id, uint32_t object_type,
+                                const char *name) {
+  drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object_id, object_type);
+  uint32_t id = 0;
+
+  if (!props) return 0;
+  for (uint32_t i = 0; i < props->count_props && !id; i++) {
+    drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+    if (!prop) continue;
+    if (!strcmp(prop->name, name)) id = prop->prop_id;
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return id;
+}
+
+static uint64_t drm_get_prop_value(int fd, uint32_t object_id, uint32_t object_type,
+                                   uint32_t prop_id) {
+  drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object_id, object_type);
+  uint64_t value = 0;
+
+  if (!props) return 0;
+  for (uint32_t i = 0; i < props->count_props; i++) {
+    if (props->props[i] == prop_id) {
+      value = props->prop_values[i];
+      break;
+    }
+  }
+  drmModeFreeObjectProperties(props);
+  return value;
+}
+
+// The primary plane that can scan out on the crtc with the given index.
+static uint32_t drm_find_primary_plane(int fd, int crtc_index) {
+  drmModePlaneResPtr planes = drmModeGetPlaneResources(fd);
+  uint32_t plane_id = 0;
+
+  if (!planes) return 0;
+  for (uint32_t i = 0; i < planes->count_planes && !plane_id; i++) {
+    drmModePlanePtr plane = drmModeGetPlane(fd, planes->planes[i]);
+    if (!plane) continue;
+    if (plane->possible_crtcs & (1u << crtc_index)) {
+      uint32_t type = drm_get_prop_id(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type");
+      if (type && drm_get_prop_value(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, type) ==
+                      DRM_PLANE_TYPE_PRIMARY)
+        plane_id = plane->plane_id;
+    }
+    drmModeFreePlane(plane);
+  }
+  drmModeFreePlaneResources(planes);
+  return plane_id;
+}
+
+// The DRM_MODE_ROTATE_* bit that turns the scanout by rotation
+// (FB_ROTATE_*) if the plane rotation property prop accepts it, else 0;
+// *swap tells whether width and height trade places.  The property
+// turns counter-clockwise (see drm_mode.h), FB_ROTATE_CW is clockwise.
+uint64_t drm_rotation_bit(const drmModePropertyRes *prop, int rotation, bool *swap) {
+  uint64_t bit, mask = 0;
+
+  switch (rotation) {
+    case FB_ROTATE_CW:  bit = DRM_MODE_ROTATE_270; *swap = true;  break;
+    case FB_ROTATE_UD:  bit = DRM_MODE_ROTATE_180; *swap = false; break;
+    case FB_ROTATE_CCW: bit = DRM_MODE_ROTATE_90;  *swap = true;  break;
+    default: return 0;
+  }
+  if (!prop) return 0;
+  // Bitmask property: each enum value is a bit number.
+  for (int i = 0; i < prop->count_enums; i++) {
+    if (prop->enums[i].value < 64) mask |= 1ULL << prop->enums[i].value;
+  }
+  return mask & bit;
+}
+
+// Point the primary plane at the full surface, scaled to the full mode.
+static void drm_atomic_add_plane(drmModeAtomicReqPtr req, struct drm_pdata *pdata,
+                                 gr_surface_drm surface) {
+  struct drm_atomic_props *p = &pdata->props;
+  uint32_t w = surface->base.width;
+  uint32_t h = surface->base.height;
+  uint32_t crtc_w = pdata->main_monitor_crtc->mode.hdisplay;
+  uint32_t crtc_h = pdata->main_monitor_crtc->mode.vdisplay;
+  uint32_t fb_id = surface->rotated_fb_id ? surface->rotated_fb_id : surface->fb_id;
+
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_fb_id, fb_id);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_crtc_id,
+                           pdata->main_monitor_crtc->crtc_id);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_src_x, 0);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_src_y, 0);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_src_w, (uint64_t)w << 16);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_src_h, (uint64_t)h << 16);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_crtc_x, 0);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_crtc_y, 0);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_crtc_w, crtc_w);
+  drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_crtc_h, crtc_h);
+  if (pdata->rotation)
+    drmModeAtomicAddProperty(req, pdata->plane_id, p->plane_rotation, pdata->rotation);
+}
+
+// Blocking modeset: connector, mode, ACTIVE and the scanout buffer in
+// one commit.  Used for the first frame and for blank/unblank.
+static int drm_atomic_modeset(struct drm_pdata *pdata, bool active, gr_surface_drm surface) {
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  struct drm_atomic_props *p = &pdata->props;
+  uint32_t crtc_id = pdata->main_monitor_crtc->crtc_id;
+
+  if (!req) return -1;
+  drmModeAtomicAddProperty(req, pdata->main_monitor_connector->connector_id,
+                           p->conn_crtc_id, crtc_id);
+  drmModeAtomicAddProperty(req, crtc_id, p->crtc_mode_id, pdata->mode_blob_id);
+  drmModeAtomicAddProperty(req, crtc_id, p->crtc_active, active);
+  if (active)
+    drm_atomic_add_plane(req, pdata, surface);
+
+  int ret = drmModeAtomicCommit(pdata->drm_fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+  drmModeAtomicFree(req);
+  if (ret) {
+    printf("atomic modeset (active=%d) failed ret=%d\n", active, ret);
+  }
+  return ret;
+}
+
+static int drm_atomic_set_active(struct drm_pdata *pdata, bool active) {
+  return drm_atomic_modeset(pdata, active,
+                            pdata->GRSurfaceDrms[pdata->scanout_buffer]);
+}
+
+static int drm_atomic_setup(struct drm_pdata *pdata) {
+  struct drm_atomic_props *p = &pdata->props;
+  int fd = pdata->drm_fd;
+  uint32_t conn = pdata->main_monitor_connector->connector_id;
+  uint32_t crtc = pdata->main_monitor_crtc->crtc_id;
+  uint32_t plane;
+
+  pdata->plane_id = plane = drm_find_primary_plane(fd, pdata->crtc_index);
+  if (!plane) {
+    printf("no primary plane for crtc %u\n", crtc);
+    return -1;
+  }
+
+  p->conn_crtc_id = drm_get_prop_id(fd, conn, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+  p->crtc_mode_id = drm_get_prop_id(fd, crtc, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+  p->crtc_active = drm_get_prop_id(fd, crtc, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+  p->plane_fb_id = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "FB_ID");
+  p->plane_crtc_id = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+  p->plane_src_x = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_X");
+  p->plane_src_y = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+  p->plane_src_w = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_W");
+  p->plane_src_h = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "SRC_H");
+  p->plane_crtc_x = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+  p->plane_crtc_y = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+  p->plane_crtc_w = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+  p->plane_crtc_h = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+  p->plane_damage_clips = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS");
+  p->plane_rotation = drm_get_prop_id(fd, plane, DRM_MODE_OBJECT_PLANE, "rotation");
+  if (!p->conn_crtc_id || !p->crtc_mode_id || !p->crtc_active || !p->plane_fb_id ||
+      !p->plane_crtc_id || !p->plane_src_w || !p->plane_crtc_w) {
+    printf("atomic properties missing\n");
+    return -1;
+  }
+
+  if (drmModeCreatePropertyBlob(fd, &pdata->main_monitor_crtc->mode,
+                                sizeof(pdata->main_monitor_crtc->mode),
+                                &pdata->mode_blob_id)) {
+    printf("drmModeCreatePropertyBlob failed\n");
+    return -1;
+  }
+  return drm_atomic_modeset(pdata, true,
+                            pdata->GRSurfaceDrms[pdata->scanout_buffer]);
+}
+
+// Clamp damage rectangles to the framebuffer, dropping the empty ones.
+// Overscan can move them off the edges, and the kernel takes only clips
+// inside the framebuffer.  Returns how many are left in out.
+static int drm_clamp_damage(const GRSurface *fb, const GRRect *rects, int count,
+                            GRRect *out) {
+  int i, n = 0;
+
+  for (i = 0; i < count && i < GR_DAMAGE_MAX; i++) {
+    int x1 = rects[i].x < 0 ? 0 : rects[i].x;
+    int y1 = rects[i].y < 0 ? 0 : rects[i].y;
+    int x2 = rects[i].x + rects[i].w;
+    int y2 = rects[i].y + rects[i].h;
+
+    if (x2 > fb->width) x2 = fb->width;
+    if (y2 > fb->height) y2 = fb->height;
+    if (x1 >= x2 || y1 >= y2) continue;
+    out[n].x = x1;
+    out[n].y = y1;
+    out[n].w = x2 - x1;
+    out[n].h = y2 - y1;
+    n++;
+  }
+  return n;
+}
+
+// Queue the surface for the next vblank without blocking.  Damage goes
+// to the plane's FB_DAMAGE_CLIPS when the driver has it.
+static int drm_atomic_flip(struct drm_pdata *pdata, gr_surface_drm surface,
+                           const GRRect *rects, int count) {
+  drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+  struct drm_mode_rect clips[GR_DAMAGE_MAX];
+  GRRect damage[GR_DAMAGE_MAX];
+  uint32_t blob_id = 0;
+  int i, n = 0;
+
+  if (!req) return -1;
+  drmModeAtomicAddProperty(req, pdata->plane_id, pdata->props.plane_fb_id,
+                           surface->rotated_fb_id ? surface->rotated_fb_id : surface->fb_id);
+  if (pdata->props.plane_damage_clips && rects) {
+    n = drm_clamp_damage(&surface->base, rects, count, damage);
+    for (i = 0; i < n; i++) {
+      clips[i].x1 = damage[i].x;
+      clips[i].y1 = damage[i].y;
+      clips[i].x2 = damage[i].x + damage[i].w;
+      clips[i].y2 = damage[i].y + damage[i].h;
+    }
+    if (n && !drmModeCreatePropertyBlob(pdata->drm_fd, clips, n * sizeof(clips[0]), &blob_id))
+      drmModeAtomicAddProperty(req, pdata->plane_id, pdata->props.plane_damage_clips, blob_id);
+  }
+
+  int ret = drmModeAtomicCommit(pdata->drm_fd, req,
+                                DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+                                pdata);
+  drmModeAtomicFree(req);
+  // The committed state holds its own reference to the blob.
+  if (blob_id)
+    drmModeDestroyPropertyBlob(pdata->drm_fd, blob_id);
+  return ret;
+}
+
 static gr_surface drm_init(struct minui_backend *backend) {
   struct drm_pdata *pdata = (struct drm_pdata *)backend;
   drmModeRes* res = NULL;
@@ -343,12 +650,14 @@ static gr_surface drm_init(struct minui_backend *backend) {
     ret = drmGetCap(pdata->drm_fd, DRM_CAP_DUMB_BUFFER, &cap);
     if (ret || cap == 0) {
       close(pdata->drm_fd);
+      pdata->drm_fd = -1;
       continue;
     }
 
     res = drmModeGetResources(pdata->drm_fd);
     if (!res) {
       close(pdata->drm_fd);
+      pdata->drm_fd = -1;
       continue;
     }
 
@@ -359,6 +668,7 @@ static gr_surface drm_init(struct minui_backend *backend) {
 
     drmModeFreeResources(res);
     close(pdata->drm_fd);
+    pdata->drm_fd = -1;
     res = NULL;
   }
 
@@ -367,6 +677,16 @@ static gr_surface drm_init(struct minui_backend *backend) {
     return NULL;
   }
 
+  if (pdata->atomic &&
+      (drmSetClientCap(pdata->drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+       drmSetClientCap(pdata->drm_fd, DRM_CLIENT_CAP_ATOMIC, 1))) {
+    printf("drm device has no atomic modesetting\n");
+    drmModeFreeResources(res);
+    close(pdata->drm_fd);
+    pdata->drm_fd = -1;
+    return NULL;
+  }
+
   uint32_t selected_mode;
   pdata->main_monitor_connector = FindMainMonitor(pdata->drm_fd, res, &selected_mode);
 
@@ -374,6 +694,7 @@ static gr_surface drm_init(struct minui_backend *backend) {
     printf("main_monitor_connector not found\n");
     drmModeFreeResources(res);
     close(pdata->drm_fd);
+    pdata->drm_fd = -1;
     return NULL;
   }
 
@@ -384,9 +705,17 @@ static gr_surface drm_init(struct minui_backend *backend) {
     printf("main_monitor_crtc not found\n");
     drmModeFreeResources(res);
     close(pdata->drm_fd);
+    pdata->drm_fd = -1;
     return NULL;
   }
 
+  for (int i = 0; i < res->count_crtcs; i++) {
+    if (res->crtcs[i] == pdata->main_monitor_crtc->crtc_id) {
+      pdata->crtc_index = i;
+      break;
+    }
+  }
+
   DisableNonMainCrtcs(pdata->drm_fd, res, pdata->main_monitor_crtc);
 
   pdata->main_monitor_crtc->mode =
@@ -397,80 +726,297 @@ static gr_surface drm_init(struct minui_backend *backend) {
 
   drmModeFreeResources(res);
 
-  pdata->GRSurfaceDrms[0] = DrmCreateSurface(pdata->drm_fd, width, height);
-  pdata->GRSurfaceDrms[1] = DrmCreateSurface(pdata->drm_fd, width, height);
-  if (!pdata->GRSurfaceDrms[0] || !pdata->GRSurfaceDrms[1]) {
+  for (int i = 0; i < DRM_BUFFER_COUNT; i++) {
+    pdata->GRSurfaceDrms[i] = DrmCreateSurface(pdata->drm_fd, width, height);
+    if (!pdata->GRSurfaceDrms[i]) break;
+    pdata->buffer_count++;
+  }
+  if (pdata->buffer_count < 2) {
     // GRSurfaceDrms and drm_fd should be freed in d'tor.
     return NULL;
   }
+  printf("drm: %d buffers\n", pdata->buffer_count);
 
   pdata->current_buffer = 0;
+  pdata->scanout_buffer = pdata->buffer_count - 1;
+  pdata->queued_buffer = -1;
+  pdata->GRSurfaceDrms[pdata->scanout_buffer]->state = DRM_BUFFER_SCANOUT;
 
-  DrmEnableCrtc(pdata, pdata->main_monitor_crtc,
-                pdata->GRSurfaceDrms[1]);
+  if (pdata->atomic) {
+    if (drm_atomic_setup(pdata)) return NULL;
+  } else {
+    DrmEnableCrtc(pdata, pdata->main_monitor_crtc,
+                  pdata->GRSurfaceDrms[pdata->scanout_buffer]);
+  }
 
   return pdata->GRSurfaceDrms[0];
 }
 
+// The queued buffer is on screen now, the one it replaced is free.
+static void drm_flip_done(struct drm_pdata *pdata) {
+  if (pdata->queued_buffer < 0) return;
+  pdata->GRSurfaceDrms[pdata->scanout_buffer]->state = DRM_BUFFER_FREE;
+  pdata->scanout_buffer = pdata->queued_buffer;
+  pdata->GRSurfaceDrms[pdata->scanout_buffer]->state = DRM_BUFFER_SCANOUT;
+  pdata->queued_buffer = -1;
+}
+
 static void page_flip_complete(__unused int fd,
                                __unused unsigned int sequence,
                                __unused unsigned int tv_sec,
                                __unused unsigned int tv_usec,
                                void *user_data) {
-  *(bool *)user_data = false;
+  drm_flip_done((struct drm_pdata *)user_data);
 }
 
-static gr_surface drm_flip(struct minui_backend *backend) {
+static void drm_handle_event(struct minui_backend *backend) {
   struct drm_pdata *pdata = (struct drm_pdata *)backend;
-  bool ongoing_flip = true;
+  drmEventContext evctx = {
+    .version = DRM_EVENT_CONTEXT_VERSION,
+    .page_flip_handler = page_flip_complete
+  };
 
-  int ret = drmModePageFlip(pdata->drm_fd, pdata->main_monitor_crtc->crtc_id,
-                            pdata->GRSurfaceDrms[pdata->current_buffer]->fb_id,
-                            DRM_MODE_PAGE_FLIP_EVENT, &ongoing_flip);
-  if (ret < 0) {
-    printf("drmModePageFlip failed ret=%d\n", ret);
-    return NULL;
+  int ret = drmHandleEvent(pdata->drm_fd, &evctx);
+  if (ret != 0) {
+    printf("drmHandleEvent failed ret=%d\n", ret);
+    drm_flip_done(pdata);
   }
+}
 
-  while (ongoing_flip) {
+// Block until the queued flip, if any, has completed.  Usually an event
+// loop has already handled it and this returns at once.
+static void drm_wait_flip(struct drm_pdata *pdata) {
+  while (pdata->queued_buffer >= 0) {
     struct pollfd fds = {
       .fd = pdata->drm_fd,
       .events = POLLIN
     };
 
-    ret = poll(&fds, 1, -1);
+    int ret = poll(&fds, 1, -1);
     if (ret == -1 || !(fds.revents & POLLIN)) {
       printf("poll() failed on drm fd\n");
+      drm_flip_done(pdata);
       break;
     }
+    drm_handle_event(&pdata->base);
+  }
+}
 
-    drmEventContext evctx = {
-      .version = DRM_EVENT_CONTEXT_VERSION,
-      .page_flip_handler = page_flip_complete
-    };
+// Wait until the drawing buffer has left the screen.  With three
+// buffers it was free when flip() handed it out and this never blocks;
+// with two it is the buffer the queued flip is replacing.
+static void drm_sync(struct minui_backend *backend) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
 
-    ret = drmHandleEvent(pdata->drm_fd, &evctx);
-    if (ret != 0) {
-      printf("drmHandleEvent failed ret=%d\n", ret);
-      break;
+  if (pdata->GRSurfaceDrms[pdata->current_buffer]->state != DRM_BUFFER_FREE)
+    drm_wait_flip(pdata);
+}
+
+static int drm_event_fd(struct minui_backend *backend) {
+  return ((struct drm_pdata *)backend)->drm_fd;
+}
+
+static int drm_buffer_age(struct minui_backend *backend) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
+  gr_surface_drm surface = pdata->GRSurfaceDrms[pdata->current_buffer];
+
+  return surface->frame ? (int)(pdata->frame_count - surface->frame + 1) : 0;
+}
+
+// Tell the driver which parts of the framebuffer changed.  Drivers for
+// panels that need manual updates (command-mode DSI, USB/SPI displays)
+// only transfer these clips; scanout drivers ignore the call.
+static void drm_dirty_fb(struct drm_pdata *pdata, gr_surface_drm surface,
+                         const GRRect *rects, int count) {
+  drmModeClip clips[GR_DAMAGE_MAX];
+  GRRect damage[GR_DAMAGE_MAX];
+  int i, n;
+
+  if (pdata->no_dirty_fb || rects == NULL)
+    return;
+
+  n = drm_clamp_damage(&surface->base, rects, count, damage);
+  if (n == 0)
+    return;
+  for (i = 0; i < n; i++) {
+    clips[i].x1 = damage[i].x;
+    clips[i].y1 = damage[i].y;
+    clips[i].x2 = damage[i].x + damage[i].w;
+    clips[i].y2 = damage[i].y + damage[i].h;
+  }
+
+  int ret = drmModeDirtyFB(pdata->drm_fd, surface->fb_id, clips, n);
+  if (ret == -ENOSYS || ret == -EOPNOTSUPP || ret == -EINVAL)
+    pdata->no_dirty_fb = true;
+}
+
+// Next buffer to draw into: a free one if there is any, otherwise the
+// one on screen, which drm_sync() waits for.
+static int drm_next_buffer(struct drm_pdata *pdata) {
+  for (int i = 1; i <= pdata->buffer_count; i++) {
+    int n = (pdata->current_buffer + i) % pdata->buffer_count;
+    if (pdata->GRSurfaceDrms[n]->state == DRM_BUFFER_FREE) return n;
+  }
+  return pdata->scanout_buffer;
+}
+
+// Queue a flip to the buffer just drawn and return the next one without
+// waiting for vblank.  Only if the previous flip is still queued does
+// this wait for it, as the kernel takes one flip at a time.
+static gr_surface drm_flip_damage(struct minui_backend *backend,
+                                  const GRRect *rects, int count) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
+  gr_surface_drm surface = pdata->GRSurfaceDrms[pdata->current_buffer];
+
+  drm_wait_flip(pdata);
+
+  pdata->queued_buffer = pdata->current_buffer;
+  surface->state = DRM_BUFFER_QUEUED;
+  if (pdata->atomic) {
+    int ret = drm_atomic_flip(pdata, surface, rects, count);
+    if (ret) {
+      // Nothing was queued: keep drawing into the same buffer.
+      printf("atomic flip failed ret=%d\n", ret);
+      pdata->queued_buffer = -1;
+      surface->state = DRM_BUFFER_FREE;
+      return &surface->base;
+    }
+  } else {
+    int ret = drmModePageFlip(pdata->drm_fd, pdata->main_monitor_crtc->crtc_id,
+                              surface->fb_id,
+                              DRM_MODE_PAGE_FLIP_EVENT, pdata);
+    if (ret < 0) {
+      printf("drmModePageFlip failed ret=%d\n", ret);
+      pdata->queued_buffer = -1;
+      surface->state = DRM_BUFFER_FREE;
+      return NULL;
+    }
+    drm_dirty_fb(pdata, surface, rects, count);
+  }
+  surface->frame = ++pdata->frame_count;
+
+  pdata->current_buffer = drm_next_buffer(pdata);
+  return &pdata->GRSurfaceDrms[pdata->current_buffer]->base;
+}
+
+// Swap the surface between its own framebuffer and one with width and
+// height exchanged over the same memory.
+static int drm_surface_rotate(int drm_fd, gr_surface_drm surface, bool rotated) {
+  GRSurface *base = &surface->base;
+
+  if (!rotated) {
+    if (surface->rotated_fb_id) {
+      drmModeRmFB(drm_fd, surface->rotated_fb_id);
+      surface->rotated_fb_id = 0;
     }
+    return 0;
+  }
+
+  uint32_t format = drm_format();
+  uint32_t handles[4] = { surface->handle }, pitches[4], offsets[4] = { 0 };
+
+  pitches[0] = base->height * base->pixel_bytes;
+  if ((size_t)pitches[0] * base->width > surface->map_size) return -1;
+  int ret = drmModeAddFB2(drm_fd, base->height, base->width, format, handles, pitches,
+                          offsets, &surface->rotated_fb_id, 0);
+  if (ret) {
+    printf("drmModeAddFB2 (rotated) failed ret=%d\n", ret);
+    surface->rotated_fb_id = 0;
+  }
+  return ret;
+}
+
+static void drm_surface_set_size(gr_surface_drm surface, int width, int height) {
+  surface->base.width = width;
+  surface->base.height = height;
+  surface->base.row_bytes = surface->rotated_fb_id ? width * surface->base.pixel_bytes
+                                                   : surface->map_size / height;
+}
+
+static void drm_swap_sizes(struct drm_pdata *pdata) {
+  for (int i = 0; i < pdata->buffer_count; i++) {
+    gr_surface_drm surface = pdata->GRSurfaceDrms[i];
+    drm_surface_set_size(surface, surface->base.height, surface->base.width);
+  }
+}
+
+// Let the primary plane rotate the scanout.  For 90 and 270 degrees the
+// surfaces are re-described with width and height swapped, so callers
+// draw upright and no pixel is ever moved by the CPU.
+static int drm_set_rotation(struct minui_backend *backend, int rotation) {
+  struct drm_pdata *pdata = (struct drm_pdata *)backend;
+  drmModePropertyPtr prop = NULL;
+  uint64_t bit;
+  bool swap, swapped;
+  int i, ret = 0;
+
+  if (pdata->atomic && pdata->props.plane_rotation)
+    prop = drmModeGetProperty(pdata->drm_fd, pdata->props.plane_rotation);
+  bit = drm_rotation_bit(prop, rotation, &swap);
+  if (prop) drmModeFreeProperty(prop);
+  if (!bit) {
+    printf("plane has no hardware rotation %d\n", rotation);
+    return -1;
+  }
+
+  drm_wait_flip(pdata);
+  for (i = 0; i < pdata->buffer_count && swap && !ret; i++)
+    ret = drm_surface_rotate(pdata->drm_fd, pdata->GRSurfaceDrms[i], true);
+  // The plane takes SRC_W and SRC_H from the surface, so it must have
+  // the size of the rotated framebuffer before the commit.
+  swapped = !ret && swap;
+  if (swapped)
+    drm_swap_sizes(pdata);
+  if (!ret) {
+    pdata->rotation = bit;
+    ret = drm_atomic_set_active(pdata, true);
+  }
+  if (ret) {
+    pdata->rotation = 0;
+    for (i = 0; i < pdata->buffer_count; i++)
+      drm_surface_rotate(pdata->drm_fd, pdata->GRSurfaceDrms[i], false);
+    if (swapped)
+      drm_swap_sizes(pdata);
+    drm_atomic_set_active(pdata, true);
+    return -1;
   }
 
-  pdata->current_buffer = 1 - pdata->current_buffer;
-  return pdata->GRSurfaceDrms[pdata->current_buffer];
+  // Every buffer now holds an unrotated image.
+  for (i = 0; i < pdata->buffer_count; i++)
+    pdata->GRSurfaceDrms[i]->frame = 0;
+  return 0;
+}
+
+static gr_surface drm_flip(struct minui_backend *backend) {
+  return drm_flip_damage(backend, NULL, 0);
 }
 
 static void drm_exit(struct minui_backend *backend) {
     struct drm_pdata *pdata = (struct drm_pdata *)backend;
     unsigned int i;
 
-    for (i = 0; i < 2; i++)
+    if (pdata->drm_fd >= 0)
+        drm_wait_flip(pdata);
+    if (pdata->mode_blob_id)
+        drmModeDestroyPropertyBlob(pdata->drm_fd, pdata->mode_blob_id);
+    for (i = 0; i < DRM_BUFFER_COUNT; i++)
         DrmDestroySurface(pdata->drm_fd, pdata->GRSurfaceDrms[i]);
     if (pdata->drm_fd >= 0)
         close(pdata->drm_fd);
     free(pdata);
 }
 
+// Same backend on the atomic API: every commit is non-blocking except
+// modesets, and blank/unblank is a single commit that flips ACTIVE.
+// Its init() fails on drivers without atomic support.
+minui_backend *open_drm_atomic() {
+    struct drm_pdata *pdata = (struct drm_pdata *)open_drm();
+
+    if (pdata)
+        pdata->atomic = true;
+    return pdata ? &pdata->base : NULL;
+}
+
 minui_backend *open_drm() {
     struct drm_pdata *pdata = calloc(1, sizeof(*pdata));
     if (!pdata) {
@@ -481,10 +1027,20 @@ minui_backend *open_drm() {
     pdata->main_monitor_crtc = NULL;
     pdata->main_monitor_connector = NULL;
     pdata->drm_fd = -1;
+    // Nothing is on screen or queued until drm_init() gets that far, so
+    // drm_exit() after a failed init has no flip to wait for.
+    pdata->scanout_buffer = -1;
+    pdata->queued_buffer = -1;
 
     pdata->base.init = drm_init;
+    pdata->base.sync = drm_sync;
     pdata->base.flip = drm_flip;
+    pdata->base.flip_damage = drm_flip_damage;
+    pdata->base.buffer_age = drm_buffer_age;
+    pdata->base.set_rotation = drm_set_rotation;
     pdata->base.blank = drm_blank;
     pdata->base.exit = drm_exit;
+    pdata->base.event_fd = drm_event_fd;
+    pdata->base.handle_event = drm_handle_event;
     return &pdata->base;
 }
@@ -34,7 +34,10 @@
 #include "graphics.h"
 
 static gr_surface fbdev_init(minui_backend*);
+static gr_surface fbdev_init_memory(minui_backend*);
 static gr_surface fbdev_flip(minui_backend*);
+static gr_surface fbdev_flip_damage(minui_backend*, const GRRect*, int);
+static int fbdev_buffer_age(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
 
@@ -42,6 +45,11 @@ static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = NULL;
 static int displayed_buffer;
+// Frame number each buffer was last presented as (0: never), to report
+// buffer ages.  Index 0 and 1 are the pages of a double-buffered fb,
+// index 0 alone is the in-memory buffer otherwise.
+static unsigned long buffer_frame[2];
+static unsigned long frame_count;
 
 static struct fb_var_screeninfo vi;
 static int fb_fd = -1;
@@ -49,6 +57,22 @@ static int fb_fd = -1;
 static minui_backend my_backend = {
     .init = fbdev_init,
     .flip = fbdev_flip,
+    .flip_damage = fbdev_flip_damage,
+    .buffer_age = fbdev_buffer_age,
+    .blank = fbdev_blank,
+    .exit = fbdev_exit,
+};
+
+// Framebuffer of open_fbdev_memory().
+static unsigned char* memory_bits;
+static size_t memory_size;
+static int memory_width, memory_height, memory_row_bytes;
+
+static minui_backend memory_backend = {
+    .init = fbdev_init_memory,
+    .flip = fbdev_flip,
+    .flip_damage = fbdev_flip_damage,
+    .buffer_age = fbdev_buffer_age,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
 };
@@ -57,9 +81,19 @@ minui_backend* open_fbdev() {
     return &my_backend;
 }
 
+minui_backend* open_fbdev_memory(void* bits, size_t size, int width, int height, int row_bytes) {
+    memory_bits = bits;
+    memory_size = size;
+    memory_width = width;
+    memory_height = height;
+    memory_row_bytes = row_bytes;
+    return &memory_backend;
+}
+
 static void fbdev_blank(minui_backend* backend __unused, bool blank) {
     int ret;
 
+    if (fb_fd < 0) return;
     ret = ioctl(fb_fd, FBIOBLANK, blank ? FB_BLANK_POWERDOWN : FB_BLANK_UNBLANK);
     if (ret < 0)
         perror("ioctl(): blank");
@@ -71,12 +105,64 @@ static void set_displayed_framebuffer(unsigned n) {
     // vi.yres_virtual = gr_framebuffer[0].height * 2;
     vi.yoffset = n * gr_framebuffer[0].height;
     vi.bits_per_pixel = gr_framebuffer[0].pixel_bytes * 8;
-    if (ioctl(fb_fd, FBIOPUT_VSCREENINFO, &vi) < 0) {
+    if (fb_fd >= 0 && ioctl(fb_fd, FBIOPUT_VSCREENINFO, &vi) < 0) {
         perror("active fb swap failed");
     }
     displayed_buffer = n;
 }
 
+// Set up the drawing surfaces on the smem_len bytes of framebuffer at
+// bits, laid out as vi says.  fd is the device, -1 for memory.
+static gr_surface fbdev_setup(int fd, void* bits, size_t smem_len, int line_length) {
+    memset(bits, 0, smem_len);
+
+    gr_framebuffer[0].width = vi.xres;
+    gr_framebuffer[0].height = vi.yres;
+    gr_framebuffer[0].row_bytes = line_length;
+    gr_framebuffer[0].pixel_bytes = vi.bits_per_pixel / 8;
+    gr_framebuffer[0].data = bits;
+    memset(gr_framebuffer[0].data, 0, gr_framebuffer[0].height * gr_framebuffer[0].row_bytes);
+
+    /* check if we can use double buffering */
+    if (vi.yres * line_length * 2 <= smem_len) {
+        double_buffered = true;
+
+        memcpy(gr_framebuffer+1, gr_framebuffer, sizeof(GRSurface));
+        gr_framebuffer[1].data = gr_framebuffer[0].data +
+            gr_framebuffer[0].height * gr_framebuffer[0].row_bytes;
+
+        gr_draw = gr_framebuffer+1;
+
+    } else {
+        double_buffered = false;
+
+        // Without double-buffering, we allocate RAM for a buffer to
+        // draw in, and then "flipping" the buffer consists of a
+        // memcpy from the buffer we allocated to the framebuffer.
+
+        gr_draw = (GRSurface*) malloc(sizeof(GRSurface));
+        if (!gr_draw) {
+            perror("failed to allocate in-memory surface");
+            return NULL;
+        }
+        memcpy(gr_draw, gr_framebuffer, sizeof(GRSurface));
+        gr_draw->data = (unsigned char*) malloc(gr_draw->height * gr_draw->row_bytes);
+        if (!gr_draw->data) {
+            perror("failed to allocate in-memory surface");
+            free(gr_draw);
+            gr_draw = NULL;
+            return NULL;
+        }
+    }
+
+    memset(gr_draw->data, 0, gr_draw->height * gr_draw->row_bytes);
+    memset(buffer_frame, 0, sizeof(buffer_frame));
+    frame_count = 0;
+    fb_fd = fd;
+    set_displayed_framebuffer(0);
+    return gr_draw;
+}
+
 static gr_surface fbdev_init(minui_backend* backend) {
     int fd;
     void *bits;
@@ -102,15 +188,12 @@ static gr_surface fbdev_init(minui_backend* backend) {
     }
 
     // We print this out for informational purposes only, but
-    // throughout we assume that the framebuffer device uses an RGBX
-    // pixel format.  This is the case for every development device I
-    // have access to.  For some of those devices (eg, hammerhead aka
+    // throughout we assume that the framebuffer device uses the pixel
+    // format minui was built for (RGBX unless TARGET_RECOVERY_PIXEL_FORMAT
+    // says BGRA_8888 or RGB_565).  For some devices (eg, hammerhead aka
     // Nexus 5), FBIOGET_VSCREENINFO *reports* that it wants a
     // different format (XBGR) but actually produces the correct
     // results on the display when you write RGBX.
-    //
-    // If you have a device that actually *needs* another pixel format
-    // (ie, BGRX, or 565), patches welcome...
 
     printf("fb0 reports (possibly inaccurate):\n"
            "  vi.bits_per_pixel = %d\n"
@@ -129,84 +212,95 @@ static gr_surface fbdev_init(minui_backend* backend) {
         return NULL;
     }
 
-    memset(bits, 0, fi.smem_len);
+    if (!fbdev_setup(fd, bits, fi.smem_len, fi.line_length)) {
+        close(fd);
+        return NULL;
+    }
 
-    gr_framebuffer[0].width = vi.xres;
-    gr_framebuffer[0].height = vi.yres;
-    gr_framebuffer[0].row_bytes = fi.line_length;
-    gr_framebuffer[0].pixel_bytes = vi.bits_per_pixel / 8;
-    gr_framebuffer[0].data = bits;
-    memset(gr_framebuffer[0].data, 0, gr_framebuffer[0].height * gr_framebuffer[0].row_bytes);
+    printf("framebuffer: %d (%d x %d)\n", fb_fd, gr_draw->width, gr_draw->height);
 
-    /* check if we can use double buffering */
-    if (vi.yres * fi.line_length * 2 <= fi.smem_len) {
-        double_buffered = true;
+    fbdev_blank(backend, true);
+    fbdev_blank(backend, false);
 
-        memcpy(gr_framebuffer+1, gr_framebuffer, sizeof(GRSurface));
-        gr_framebuffer[1].data = gr_framebuffer[0].data +
-            gr_framebuffer[0].height * gr_framebuffer[0].row_bytes;
+    return gr_draw;
+}
 
-        gr_draw = gr_framebuffer+1;
+static gr_surface fbdev_init_memory(minui_backend* backend __unused) {
+    memset(&vi, 0, sizeof(vi));
+    vi.xres = memory_width;
+    vi.yres = memory_height;
+    vi.bits_per_pixel = GR_PIXEL_BYTES * 8;
+    return fbdev_setup(-1, memory_bits, memory_size, memory_row_bytes);
+}
 
-    } else {
-        double_buffered = false;
+static int fbdev_buffer_age(minui_backend* backend __unused) {
+    unsigned long frame;
 
-        // Without double-buffering, we allocate RAM for a buffer to
-        // draw in, and then "flipping" the buffer consists of a
-        // memcpy from the buffer we allocated to the framebuffer.
+    if (double_buffered)
+        frame = buffer_frame[gr_draw - gr_framebuffer];
+    else
+        frame = buffer_frame[0];
+    return frame ? (int)(frame_count - frame + 1) : 0;
+}
 
-        gr_draw = (GRSurface*) malloc(sizeof(GRSurface));
-        memcpy(gr_draw, gr_framebuffer, sizeof(GRSurface));
-        gr_draw->data = (unsigned char*) malloc(gr_draw->height * gr_draw->row_bytes);
-        if (!gr_draw->data) {
-            perror("failed to allocate in-memory surface");
-            close(fd);
-            return NULL;
-        }
+// Copy one rectangle of the in-memory surface to the framebuffer.
+static void fbdev_copy_rect(const GRRect* r) {
+    int bytes = r->w * gr_draw->pixel_bytes;
+    size_t offset = r->y * gr_draw->row_bytes + r->x * gr_draw->pixel_bytes;
+    unsigned char* dst = gr_framebuffer[0].data + offset;
+    unsigned char* src = gr_draw->data + offset;
+    int y;
+
+    for (y = 0; y < r->h; ++y) {
+        memcpy(dst, src, bytes);
+        dst += gr_draw->row_bytes;
+        src += gr_draw->row_bytes;
     }
+}
 
-    memset(gr_draw->data, 0, gr_draw->height * gr_draw->row_bytes);
-    fb_fd = fd;
-    set_displayed_framebuffer(0);
-
-    printf("framebuffer: %d (%d x %d)\n", fb_fd, gr_draw->width, gr_draw->height);
-
-    fbdev_blank(backend, true);
-    fbdev_blank(backend, false);
-
+static gr_surface fbdev_flip_damage(minui_backend* backend, const GRRect* rects, int count) {
+    GRRect r;
+    int i;
+
+    // Pages are flipped whole; only the copy to a single buffer gains.
+    if (double_buffered || rects == NULL)
+        return fbdev_flip(backend);
+
+    for (i = 0; i < count; ++i) {
+        r = rects[i];
+        if (r.x < 0) { r.w += r.x; r.x = 0; }
+        if (r.y < 0) { r.h += r.y; r.y = 0; }
+        if (r.x + r.w > gr_draw->width) r.w = gr_draw->width - r.x;
+        if (r.y + r.h > gr_draw->height) r.h = gr_draw->height - r.y;
+        if (r.w > 0 && r.h > 0)
+            fbdev_copy_rect(&r);
+    }
+    buffer_frame[0] = ++frame_count;
     return gr_draw;
 }
 
 static gr_surface fbdev_flip(minui_backend* backend __unused) {
+    frame_count++;
     if (double_buffered) {
+        buffer_frame[gr_draw - gr_framebuffer] = frame_count;
         // Change gr_draw to point to the buffer currently displayed,
         // then flip the driver so we're displaying the other buffer
         // instead.
         gr_draw = gr_framebuffer + displayed_buffer;
         set_displayed_framebuffer(1-displayed_buffer);
     } else {
-        // Copy from the in-memory surface to the framebuffer.
-
-#if defined(RECOVERY_BGRA)
-        unsigned int idx;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_framebuffer[0].data;
-        unsigned char* ucbuffer_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes); idx += 4) {
-            ucfb_vaddr[idx    ] = ucbuffer_vaddr[idx + 2];
-            ucfb_vaddr[idx + 1] = ucbuffer_vaddr[idx + 1];
-            ucfb_vaddr[idx + 2] = ucbuffer_vaddr[idx    ];
-            ucfb_vaddr[idx + 3] = ucbuffer_vaddr[idx + 3];
-        }
-#else
+        // Copy from the in-memory surface to the framebuffer.  It is
+        // drawn in the scanout format already, see GR_PIXEL_BYTES.
         memcpy(gr_framebuffer[0].data, gr_draw->data,
                gr_draw->height * gr_draw->row_bytes);
-#endif
+        buffer_frame[0] = frame_count;
     }
     return gr_draw;
 }
 
 static void fbdev_exit(minui_backend* backend __unused) {
-    close(fb_fd);
+    if (fb_fd >= 0)
+        close(fb_fd);
     fb_fd = -1;
 
     if (!double_buffered && gr_draw) {
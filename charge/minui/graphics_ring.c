@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Anti-aliased progress ring, rendered into a display surface.
+ *
+ * The geometry is worked out once per ring: the coverage of every pixel
+ * of the annulus, its angle clockwise from 12 o'clock and how much angle
+ * one pixel spans at its radius.  The pixels are kept sorted by angle,
+ * so moving the end of the arc recolors only the pixels between the old
+ * and the new end.  The coverage never changes, so the surface alpha
+ * (and its opaque runs) is built once too.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+// Angles are in 1/65536 of a turn, clockwise from 12 o'clock.
+#define RING_TURN 65536
+#define RING_BUCKET_SHIFT 8
+#define RING_BUCKETS (RING_TURN >> RING_BUCKET_SHIFT)
+
+typedef struct {
+    int offset;       // pixel index in the surface
+    uint16_t angle;
+    uint16_t span;    // angle one pixel covers at this radius
+    unsigned char coverage;
+} RingPixel;
+
+struct GRRing {
+    GRSurface surface;
+    uint32_t track, arc;
+    int count;
+    int max_span;
+    RingPixel* pixels;            // sorted by angle
+    int bucket[RING_BUCKETS + 1]; // first pixel of each angle bucket
+    int end;                      // end of the arc, 0 to RING_TURN
+};
+
+// 0 to 255: how much of the arc color the pixel shows.  Each edge of
+// the arc is smoothed over one pixel.
+static int arc_weight(const RingPixel* p, int end) {
+    int a = p->angle, w;
+
+    if (end <= 0) return 0;
+    if (end >= RING_TURN) return 255;
+    // Signed distance to the nearest edge, negative outside the arc.
+    if (a < end)
+        w = a < end - a ? a : end - a;
+    else
+        w = -(a - end < RING_TURN - a ? a - end : RING_TURN - a);
+    w = w * 255 / p->span + 128;
+    return w < 0 ? 0 : w > 255 ? 255 : w;
+}
+
+static void ring_paint(GRRing* ring, const RingPixel* p) {
+    int w = arc_weight(p, ring->end);
+    unsigned char rgbx[4];
+    int c;
+
+    for (c = 0; c < 3; ++c) {
+        int track = (ring->track >> (16 - 8 * c)) & 0xff;
+        int arc = (ring->arc >> (16 - 8 * c)) & 0xff;
+        int v = (track * (255 - w) + arc * w + 127) / 255;
+        rgbx[c] = (v * p->coverage + 127) / 255;
+    }
+    rgbx[3] = p->coverage;
+    gr_span.convert(rgbx, ring->surface.data + p->offset * GR_PIXEL_BYTES, 1);
+}
+
+// Repaint the pixels of angle buckets first to last.
+static void ring_paint_buckets(GRRing* ring, int first, int last) {
+    int i;
+
+    if (first < 0) first = 0;
+    if (last >= RING_BUCKETS) last = RING_BUCKETS - 1;
+    if (first > last) return;
+    for (i = ring->bucket[first]; i < ring->bucket[last + 1]; ++i)
+        ring_paint(ring, &ring->pixels[i]);
+}
+
+GRRing* gr_ring_create(int radius, int thickness, uint32_t track_rgb, uint32_t arc_rgb) {
+    GRRing* ring;
+    RingPixel* unsorted;
+    unsigned char* coverage;
+    float r0, r1, center;
+    int size, x, y, i;
+
+    if (radius <= 0 || thickness <= 0) return NULL;
+    r0 = radius - thickness / 2.0f;
+    r1 = radius + thickness / 2.0f;
+    if (r0 < 0) r0 = 0;
+    size = 2 * (int)ceilf(r1) + 2;
+    center = size / 2.0f;
+
+    ring = calloc(1, sizeof(*ring));
+    coverage = calloc(size, size);
+    unsorted = malloc(size * size * sizeof(RingPixel));
+    if (ring) ring->surface.data = calloc(size * size, GR_PIXEL_BYTES);
+    if (!ring || !coverage || !unsorted || !ring->surface.data) goto fail;
+    ring->surface.width = size;
+    ring->surface.height = size;
+    ring->surface.row_bytes = size * GR_PIXEL_BYTES;
+    ring->surface.pixel_bytes = GR_PIXEL_BYTES;
+    ring->track = track_rgb;
+    ring->arc = arc_rgb;
+
+    for (y = 0; y < size; ++y) {
+        for (x = 0; x < size; ++x) {
+            float dx = x + 0.5f - center, dy = y + 0.5f - center;
+            float d = sqrtf(dx * dx + dy * dy);
+            float edge = (r1 - d < d - r0 ? r1 - d : d - r0) + 0.5f;
+            RingPixel* p = &unsorted[ring->count];
+            float a;
+
+            if (edge <= 0) continue;
+            if (edge > 1) edge = 1;
+            a = atan2f(dx, -dy);
+            if (a < 0) a += 2 * (float)M_PI;
+            p->offset = y * size + x;
+            p->angle = (int)(a * (RING_TURN / (2 * (float)M_PI))) & (RING_TURN - 1);
+            p->span = d > 0.5f ? (int)(RING_TURN / (2 * (float)M_PI * d)) + 1 : RING_TURN - 1;
+            p->coverage = (int)(edge * 255 + 0.5f);
+            if (p->coverage == 0) continue;
+            if (p->span > ring->max_span) ring->max_span = p->span;
+            coverage[p->offset] = p->coverage;
+            ring->bucket[(p->angle >> RING_BUCKET_SHIFT) + 1]++;
+            ring->count++;
+        }
+    }
+
+    // Counting sort by angle bucket.
+    ring->pixels = malloc(ring->count * sizeof(RingPixel));
+    if (ring->pixels == NULL) goto fail;
+    for (i = 0; i < RING_BUCKETS; ++i)
+        ring->bucket[i + 1] += ring->bucket[i];
+    {
+        int next[RING_BUCKETS];
+        memcpy(next, ring->bucket, sizeof(next));
+        for (i = 0; i < ring->count; ++i)
+            ring->pixels[next[unsorted[i].angle >> RING_BUCKET_SHIFT]++] = unsorted[i];
+    }
+
+    ring->surface.alpha = gr_surface_alpha_create(coverage, size, size, size);
+    ring_paint_buckets(ring, 0, RING_BUCKETS - 1);
+    free(unsorted);
+    free(coverage);
+    return ring;
+
+  fail:
+    free(unsorted);
+    free(coverage);
+    gr_ring_destroy(ring);
+    return NULL;
+}
+
+void gr_ring_set(GRRing* ring, int value, int max) {
+    int end, lo, hi, closed;
+
+    if (ring == NULL || max <= 0) return;
+    if (value < 0) value = 0;
+    if (value > max) value = max;
+    end = (int)((int64_t)value * RING_TURN / max);
+    if (end == ring->end) return;
+
+    lo = (end < ring->end ? end : ring->end) - ring->max_span;
+    hi = (end > ring->end ? end : ring->end) + ring->max_span;
+    closed = end <= 0 || end >= RING_TURN || ring->end <= 0 || ring->end >= RING_TURN;
+    ring->end = end;
+    ring_paint_buckets(ring, lo >> RING_BUCKET_SHIFT, hi >> RING_BUCKET_SHIFT);
+    if (closed) {
+        // An empty or full arc has no edges, so the seam at 12 o'clock
+        // changes too.
+        int seam = ring->max_span >> RING_BUCKET_SHIFT;
+        ring_paint_buckets(ring, 0, seam);
+        ring_paint_buckets(ring, RING_BUCKETS - 1 - seam, RING_BUCKETS - 1);
+    }
+}
+
+gr_surface gr_ring_surface(GRRing* ring) {
+    return ring ? &ring->surface : NULL;
+}
+
+void gr_ring_destroy(GRRing* ring) {
+    if (ring == NULL) return;
+    free(ring->surface.alpha);
+    free(ring->surface.data);
+    free(ring->pixels);
+    free(ring);
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Frame rotation for panels mounted sideways or upside down.
+ *
+ * 90 and 270 degree rotations walk the image in 16x16 pixel tiles, so
+ * both the rows read and the rows written stay in cache, and move each
+ * 4x4 block with one register transpose (NEON or SSE2 for 4-byte
+ * pixels, plain C otherwise).  The 180 degree rotation swaps rows from
+ * both ends and needs no scratch.
+ */
+
+#include <stdint.h>
+
+#include "graphics.h"
+
+// The vector transposes move 4-byte pixels.
+#if GR_PIXEL_BYTES == 4
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GR_ROTATE_NEON 1
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__SSE2__)
+#define GR_ROTATE_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
+
+#define ROTATE_TILE 16
+
+#define PIXEL(base, stride, x, y) \
+    ((gr_pixel_t*)((base) + (long)(y) * (stride)) + (x))
+
+// d[k][j] = s[j][k] for a 4x4 block of pixels.
+static inline void transpose4(const gr_pixel_t* s0, const gr_pixel_t* s1,
+                              const gr_pixel_t* s2, const gr_pixel_t* s3,
+                              gr_pixel_t* d0, gr_pixel_t* d1, gr_pixel_t* d2, gr_pixel_t* d3) {
+#if defined(GR_ROTATE_NEON)
+    uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(s0), vld1q_u32(s1));
+    uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(s2), vld1q_u32(s3));
+    vst1q_u32(d0, vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0])));
+    vst1q_u32(d1, vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1])));
+    vst1q_u32(d2, vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0])));
+    vst1q_u32(d3, vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1])));
+#elif defined(GR_ROTATE_SSE2)
+    __m128i a = _mm_loadu_si128((const __m128i*)s0);
+    __m128i b = _mm_loadu_si128((const __m128i*)s1);
+    __m128i c = _mm_loadu_si128((const __m128i*)s2);
+    __m128i d = _mm_loadu_si128((const __m128i*)s3);
+    __m128i ab_lo = _mm_unpacklo_epi32(a, b), ab_hi = _mm_unpackhi_epi32(a, b);
+    __m128i cd_lo = _mm_unpacklo_epi32(c, d), cd_hi = _mm_unpackhi_epi32(c, d);
+    _mm_storeu_si128((__m128i*)d0, _mm_unpacklo_epi64(ab_lo, cd_lo));
+    _mm_storeu_si128((__m128i*)d1, _mm_unpackhi_epi64(ab_lo, cd_lo));
+    _mm_storeu_si128((__m128i*)d2, _mm_unpacklo_epi64(ab_hi, cd_hi));
+    _mm_storeu_si128((__m128i*)d3, _mm_unpackhi_epi64(ab_hi, cd_hi));
+#else
+    gr_pixel_t* d[4] = { d0, d1, d2, d3 };
+    int k;
+    for (k = 0; k < 4; ++k) {
+        gr_pixel_t p0 = s0[k], p1 = s1[k], p2 = s2[k], p3 = s3[k];
+        d[k][0] = p0;
+        d[k][1] = p1;
+        d[k][2] = p2;
+        d[k][3] = p3;
+    }
+#endif
+}
+
+// Source pixel (x, y) goes to (h-1-y, x) for clockwise, (y, w-1-x)
+// for counter-clockwise.
+static inline gr_pixel_t* rotate_dst(unsigned char* dst, int dst_stride,
+                                   int w, int h, int x, int y, int cw) {
+    return cw ? PIXEL(dst, dst_stride, h - 1 - y, x)
+              : PIXEL(dst, dst_stride, y, w - 1 - x);
+}
+
+static void rotate_quarter(const unsigned char* src, int src_stride,
+                           unsigned char* dst, int dst_stride, int w, int h, int cw) {
+    int w4 = w & ~3, h4 = h & ~3;
+    int tx, ty, x, y;
+
+    for (ty = 0; ty < h4; ty += ROTATE_TILE) {
+        int ty_end = ty + ROTATE_TILE < h4 ? ty + ROTATE_TILE : h4;
+        for (tx = 0; tx < w4; tx += ROTATE_TILE) {
+            int tx_end = tx + ROTATE_TILE < w4 ? tx + ROTATE_TILE : w4;
+            for (y = ty; y < ty_end; y += 4) {
+                const gr_pixel_t* r0 = PIXEL(src, src_stride, 0, y);
+                const gr_pixel_t* r1 = PIXEL(src, src_stride, 0, y + 1);
+                const gr_pixel_t* r2 = PIXEL(src, src_stride, 0, y + 2);
+                const gr_pixel_t* r3 = PIXEL(src, src_stride, 0, y + 3);
+                for (x = tx; x < tx_end; x += 4) {
+                    if (cw) {
+                        // Rows y+3..y land left to right in dst rows x..x+3.
+                        int dx = h - 4 - y;
+                        transpose4(r3 + x, r2 + x, r1 + x, r0 + x,
+                                   PIXEL(dst, dst_stride, dx, x),
+                                   PIXEL(dst, dst_stride, dx, x + 1),
+                                   PIXEL(dst, dst_stride, dx, x + 2),
+                                   PIXEL(dst, dst_stride, dx, x + 3));
+                    } else {
+                        // Rows y..y+3 land left to right in dst rows
+                        // w-1-x down to w-4-x.
+                        int dy = w - 1 - x;
+                        transpose4(r0 + x, r1 + x, r2 + x, r3 + x,
+                                   PIXEL(dst, dst_stride, y, dy),
+                                   PIXEL(dst, dst_stride, y, dy - 1),
+                                   PIXEL(dst, dst_stride, y, dy - 2),
+                                   PIXEL(dst, dst_stride, y, dy - 3));
+                    }
+                }
+            }
+        }
+    }
+
+    // Right and bottom strips that do not fill a 4x4 block.
+    for (y = 0; y < h; ++y) {
+        const gr_pixel_t* row = PIXEL(src, src_stride, 0, y);
+        for (x = y < h4 ? w4 : 0; x < w; ++x)
+            *rotate_dst(dst, dst_stride, w, h, x, y, cw) = row[x];
+    }
+}
+
+void gr_rotate_cw(const unsigned char* src, int src_stride,
+                  unsigned char* dst, int dst_stride, int w, int h) {
+    rotate_quarter(src, src_stride, dst, dst_stride, w, h, 1);
+}
+
+void gr_rotate_ccw(const unsigned char* src, int src_stride,
+                   unsigned char* dst, int dst_stride, int w, int h) {
+    rotate_quarter(src, src_stride, dst, dst_stride, w, h, 0);
+}
+
+// Reverse the n pixels of row a into row b and those of b into a.
+// a == b reverses one row in place.  Each step moves four pixels from
+// both ends of both rows, reading all of them before writing any.
+static void reverse_swap(gr_pixel_t* a, gr_pixel_t* b, int n) {
+    int i = 0, j = n;
+
+#if defined(GR_ROTATE_NEON)
+    for (; j - i >= 8; i += 4, j -= 4) {
+        uint32x4_t ai = vrev64q_u32(vld1q_u32(a + i));
+        uint32x4_t aj = vrev64q_u32(vld1q_u32(a + j - 4));
+        uint32x4_t bi = vrev64q_u32(vld1q_u32(b + i));
+        uint32x4_t bj = vrev64q_u32(vld1q_u32(b + j - 4));
+        vst1q_u32(a + i, vcombine_u32(vget_high_u32(bj), vget_low_u32(bj)));
+        vst1q_u32(a + j - 4, vcombine_u32(vget_high_u32(bi), vget_low_u32(bi)));
+        vst1q_u32(b + i, vcombine_u32(vget_high_u32(aj), vget_low_u32(aj)));
+        vst1q_u32(b + j - 4, vcombine_u32(vget_high_u32(ai), vget_low_u32(ai)));
+    }
+#elif defined(GR_ROTATE_SSE2)
+    for (; j - i >= 8; i += 4, j -= 4) {
+        __m128i ai = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(a + i)), 0x1b);
+        __m128i aj = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(a + j - 4)), 0x1b);
+        __m128i bi = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(b + i)), 0x1b);
+        __m128i bj = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(b + j - 4)), 0x1b);
+        _mm_storeu_si128((__m128i*)(a + i), bj);
+        _mm_storeu_si128((__m128i*)(a + j - 4), bi);
+        _mm_storeu_si128((__m128i*)(b + i), aj);
+        _mm_storeu_si128((__m128i*)(b + j - 4), ai);
+    }
+#endif
+    for (; i < j; ++i, --j) {
+        gr_pixel_t ai = a[i], aj = a[j - 1], bi = b[i], bj = b[j - 1];
+        a[i] = bj;
+        a[j - 1] = bi;
+        b[i] = aj;
+        b[j - 1] = ai;
+    }
+}
+
+void gr_rotate_180_inplace(unsigned char* px, int stride, int w, int h) {
+    int y;
+
+    for (y = 0; y < h - 1 - y; ++y)
+        reverse_swap(PIXEL(px, stride, 0, y), PIXEL(px, stride, 0, h - 1 - y), w);
+    if (y == h - 1 - y)
+        reverse_swap(PIXEL(px, stride, 0, y), PIXEL(px, stride, 0, y), w);
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Area-averaging downscale of R, G, B, A images, used to size sprites
+ * for the panel once at load time.
+ *
+ * Every destination pixel is the average of the source area it covers,
+ * partly covered source pixels weighted by how much of them it covers.
+ * The filter is separable: each source row is first scaled across into
+ * 8.8 fixed point, then added with its weight to the one or two
+ * destination rows it falls in.  Rows are consumed in decode order, so
+ * the full size image is never held in memory.  Weights are 12-bit and
+ * add up to exactly 1.0 for every destination pixel.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graphics.h"
+
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GR_SCALE_NEON 1
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__SSE2__)
+#define GR_SCALE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define WEIGHT_BITS 12
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+// The source pixels each destination pixel of one axis averages.
+typedef struct {
+    int* start;
+    int* count;
+    uint16_t* weight;  // max_taps per destination pixel
+    int max_taps;
+} ScaleTaps;
+
+struct GRScaler {
+    int src_w, src_h, dst_w, dst_h;
+    ScaleTaps h, v;
+    uint16_t* hrow;    // the current source row scaled across, 8.8
+    uint32_t* acc[2];  // destination rows y and y + 1 being summed
+    unsigned char* out;
+    int src_y;
+    int dst_y;
+};
+
+// Destination pixel o covers [o * src, (o + 1) * src) and source pixel i
+// covers [i * dst, (i + 1) * dst), in units of 1 / (src * dst) pixel.
+static int build_taps(ScaleTaps* t, int src, int dst) {
+    int o;
+
+    t->max_taps = (src + dst - 1) / dst + 1;
+    t->start = malloc(dst * sizeof(int));
+    t->count = malloc(dst * sizeof(int));
+    t->weight = malloc(dst * t->max_taps * sizeof(uint16_t));
+    if (!t->start || !t->count || !t->weight) return -1;
+
+    for (o = 0; o < dst; ++o) {
+        int s0 = o * src, s1 = (o + 1) * src;
+        uint16_t* w = t->weight + o * t->max_taps;
+        int sum = 0, largest = 0;
+        int i, k;
+
+        t->start[o] = s0 / dst;
+        t->count[o] = (s1 - 1) / dst - t->start[o] + 1;
+        for (k = 0; k < t->count[o]; ++k) {
+            i = t->start[o] + k;
+            int lo = i * dst > s0 ? i * dst : s0;
+            int hi = (i + 1) * dst < s1 ? (i + 1) * dst : s1;
+            w[k] = ((hi - lo) * WEIGHT_ONE + src / 2) / src;
+            sum += w[k];
+            if (w[k] > w[largest]) largest = k;
+        }
+        // Rounding error goes to the largest weight.
+        w[largest] += WEIGHT_ONE - sum;
+    }
+    return 0;
+}
+
+static void free_taps(ScaleTaps* t) {
+    free(t->start);
+    free(t->count);
+    free(t->weight);
+}
+
+// Scale one source row across into 8.8 fixed point.
+static void scale_row(const GRScaler* s, const unsigned char* src) {
+    const ScaleTaps* t = &s->h;
+    int o, k;
+
+    for (o = 0; o < s->dst_w; ++o) {
+        const unsigned char* p = src + t->start[o] * 4;
+        const uint16_t* w = t->weight + o * t->max_taps;
+        uint16_t* d = s->hrow + o * 4;
+#if defined(GR_SCALE_NEON)
+        uint32x4_t sum = vdupq_n_u32(0);
+        for (k = 0; k < t->count[o]; ++k, p += 4) {
+            uint8x8_t px = vreinterpret_u8_u32(vld1_dup_u32((const uint32_t*)p));
+            sum = vmlal_n_u16(sum, vget_low_u16(vmovl_u8(px)), w[k]);
+        }
+        vst1_u16(d, vrshrn_n_u32(sum, 4));
+#elif defined(GR_SCALE_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+        uint32_t lanes[4];
+        for (k = 0; k < t->count[o]; ++k, p += 4) {
+            uint32_t v;
+            memcpy(&v, p, sizeof(v));
+            __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)v), zero),
+                                            zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(px, _mm_set1_epi32(w[k])));
+        }
+        sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(8)), 4);
+        _mm_storeu_si128((__m128i*)lanes, sum);
+        d[0] = lanes[0];
+        d[1] = lanes[1];
+        d[2] = lanes[2];
+        d[3] = lanes[3];
+#else
+        uint32_t sum[4] = { 0, 0, 0, 0 };
+        int c;
+        for (k = 0; k < t->count[o]; ++k, p += 4)
+            for (c = 0; c < 4; ++c)
+                sum[c] += w[k] * p[c];
+        for (c = 0; c < 4; ++c)
+            d[c] = (sum[c] + 8) >> 4;
+#endif
+    }
+}
+
+// acc[i] += row[i] * w for n values.
+static void accumulate(uint32_t* acc, const uint16_t* row, uint16_t w, int n) {
+    int i = 0;
+
+#if defined(GR_SCALE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t r = vld1q_u16(row + i);
+        vst1q_u32(acc + i, vmlal_n_u16(vld1q_u32(acc + i), vget_low_u16(r), w));
+        vst1q_u32(acc + i + 4, vmlal_n_u16(vld1q_u32(acc + i + 4), vget_high_u16(r), w));
+    }
+#elif defined(GR_SCALE_SSE2)
+    const __m128i w16 = _mm_set1_epi16((short)w);
+    for (; i + 8 <= n; i += 8) {
+        __m128i r = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i lo = _mm_mullo_epi16(r, w16), hi = _mm_mulhi_epu16(r, w16);
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(acc + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(acc + i + 4));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_add_epi32(a0, _mm_unpacklo_epi16(lo, hi)));
+        _mm_storeu_si128((__m128i*)(acc + i + 4), _mm_add_epi32(a1, _mm_unpackhi_epi16(lo, hi)));
+    }
+#endif
+    for (; i < n; ++i)
+        acc[i] += (uint32_t)row[i] * w;
+}
+
+// Round a finished destination row to bytes.
+static void finish_row(unsigned char* out, const uint32_t* acc, int n) {
+    int i;
+
+    for (i = 0; i < n; ++i)
+        out[i] = (acc[i] + (1 << (WEIGHT_BITS + 7))) >> (WEIGHT_BITS + 8);
+}
+
+void gr_scaler_destroy(GRScaler* s) {
+    if (s == NULL) return;
+    free_taps(&s->h);
+    free_taps(&s->v);
+    free(s->hrow);
+    free(s->acc[0]);
+    free(s->acc[1]);
+    free(s->out);
+    free(s);
+}
+
+GRScaler* gr_scaler_create(int src_w, int src_h, int dst_w, int dst_h) {
+    GRScaler* s;
+
+    if (dst_w <= 0 || dst_h <= 0 || dst_w > src_w || dst_h > src_h) return NULL;
+    s = calloc(1, sizeof(*s));
+    if (s == NULL) return NULL;
+    s->src_w = src_w;
+    s->src_h = src_h;
+    s->dst_w = dst_w;
+    s->dst_h = dst_h;
+    s->hrow = malloc(dst_w * 4 * sizeof(uint16_t));
+    s->acc[0] = calloc(dst_w * 4, sizeof(uint32_t));
+    s->acc[1] = calloc(dst_w * 4, sizeof(uint32_t));
+    s->out = malloc(dst_w * 4);
+    if (build_taps(&s->h, src_w, dst_w) < 0 || build_taps(&s->v, src_h, dst_h) < 0 ||
+        !s->hrow || !s->acc[0] || !s->acc[1] || !s->out) {
+        gr_scaler_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+const unsigned char* gr_scaler_push(GRScaler* s, const unsigned char* rgba) {
+    const ScaleTaps* t = &s->v;
+    int y = s->src_y++;
+    int o = s->dst_y;
+    int n = s->dst_w * 4;
+    uint32_t* done;
+
+    if (o >= s->dst_h) return NULL;
+    scale_row(s, rgba);
+
+    // Shrinking, a source row falls in at most two destination rows.
+    accumulate(s->acc[0], s->hrow, t->weight[o * t->max_taps + y - t->start[o]], n);
+    if (o + 1 < s->dst_h && y >= t->start[o + 1])
+        accumulate(s->acc[1], s->hrow, t->weight[(o + 1) * t->max_taps + y - t->start[o + 1]], n);
+    if (y < t->start[o] + t->count[o] - 1) return NULL;
+
+    finish_row(s->out, s->acc[0], n);
+    done = s->acc[0];
+    s->acc[0] = s->acc[1];
+    s->acc[1] = done;
+    memset(s->acc[1], 0, n * sizeof(uint32_t));
+    s->dst_y++;
+    return s->out;
+}
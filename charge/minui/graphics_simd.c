@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Row kernels behind gr_fill(), gr_clear(), text_blend() and
+ * gr_blit_blend().
+ *
+ * The C versions are the reference: every vector version produces
+ * exactly the same bytes.  Blending keeps the reference's truncating
+ * divide by 255, done as (t + (t >> 8)) >> 8 with t = x + 1, which is
+ * exact for every x up to 255 * 255 and fits in 16-bit lanes.  The
+ * fourth byte of each pixel is never changed, as in the reference.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GR_SPAN_NEON 1
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#define GR_SPAN_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) && (defined(__clang__) || defined(__GNUC__))
+#define GR_SPAN_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#include "graphics.h"
+#include "../common.h"
+
+// The vector kernels handle 4-byte pixels only.
+#if GR_PIXEL_BYTES != 4
+#undef GR_SPAN_NEON
+#undef GR_SPAN_SSE2
+#undef GR_SPAN_AVX2
+#endif
+
+#define COLOR_R(c) ((c) & 0xff)
+#define COLOR_G(c) (((c) >> 8) & 0xff)
+#define COLOR_B(c) (((c) >> 16) & 0xff)
+#define COLOR_A(c) ((c) >> 24)
+
+// Premultiplied s over d, saturating like the vector kernels.  Only
+// formats narrower than 8 bits per channel can round s above a.
+static inline int over_channel(int s, int d, int a) {
+    int o = s + d * (255 - a) / 255;
+    return o > 255 ? 255 : o;
+}
+
+/*
+ * Reference kernels, one set per destination format.  A format is a
+ * pixel type, LOAD to read a pixel into 8-bit r, g, b and STORE to build
+ * a pixel from r, g, b and the pixel it replaces.  GR_SPAN_CONVERT
+ * makes the converter of a pixel layout, FROM_RGBX turning one R, G, B,
+ * X pixel from a decoded image into it.
+ */
+#define GR_SPAN_KERNELS(fmt, pixel_t, LOAD, STORE)                              \
+static void span_fill_##fmt(unsigned char* dst, int n, uint32_t color) {        \
+    pixel_t* px = (pixel_t*)dst;                                                \
+    int i;                                                                      \
+    for (i = 0; i < n; ++i)                                                     \
+        px[i] = STORE(px[i], COLOR_R(color), COLOR_G(color), COLOR_B(color));   \
+}                                                                               \
+                                                                                \
+static inline pixel_t blend_##fmt(pixel_t p, uint32_t color, int a) {           \
+    int r, g, b;                                                                \
+    LOAD(p, r, g, b);                                                           \
+    r = (r * (255-a) + (int)COLOR_R(color) * a) / 255;                          \
+    g = (g * (255-a) + (int)COLOR_G(color) * a) / 255;                          \
+    b = (b * (255-a) + (int)COLOR_B(color) * a) / 255;                          \
+    return STORE(p, r, g, b);                                                   \
+}                                                                               \
+                                                                                \
+static void span_blend_##fmt(unsigned char* dst, int n, uint32_t color) {       \
+    pixel_t* px = (pixel_t*)dst;                                                \
+    int a = COLOR_A(color);                                                     \
+    int i;                                                                      \
+    for (i = 0; i < n; ++i)                                                     \
+        px[i] = blend_##fmt(px[i], color, a);                                   \
+}                                                                               \
+                                                                                \
+static void span_text_##fmt(const unsigned char* sx, unsigned char* dst, int n, \
+                            uint32_t color) {                                   \
+    pixel_t* px = (pixel_t*)dst;                                                \
+    int ga = COLOR_A(color);                                                    \
+    int i;                                                                      \
+    for (i = 0; i < n; ++i) {                                                   \
+        int a = sx[i];                                                          \
+        if (ga < 255) a = (a * ga) / 255;                                       \
+        if (a == 255)                                                           \
+            px[i] = STORE(px[i], COLOR_R(color), COLOR_G(color), COLOR_B(color)); \
+        else if (a > 0)                                                         \
+            px[i] = blend_##fmt(px[i], color, a);                               \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static void span_over_##fmt(const unsigned char* src, const unsigned char* alpha, \
+                            unsigned char* dst, int n) {                        \
+    const pixel_t* sp = (const pixel_t*)src;                                    \
+    pixel_t* px = (pixel_t*)dst;                                                \
+    int i;                                                                      \
+    for (i = 0; i < n; ++i) {                                                   \
+        int a = alpha[i], r, g, b, sr, sg, sb;                                  \
+        if (a == 0)                                                             \
+            continue;                                                           \
+        LOAD(sp[i], sr, sg, sb);                                                \
+        if (a < 255) {                                                          \
+            LOAD(px[i], r, g, b);                                               \
+            sr = over_channel(sr, r, a);                                        \
+            sg = over_channel(sg, g, a);                                        \
+            sb = over_channel(sb, b, a);                                        \
+        }                                                                       \
+        px[i] = STORE(px[i], sr, sg, sb);                                       \
+    }                                                                           \
+}
+
+#define GR_SPAN_CONVERT(fmt, pixel_t, FROM_RGBX)                                \
+static void span_convert_##fmt(const unsigned char* rgbx, unsigned char* dst,  \
+                               int n) {                                         \
+    pixel_t* px = (pixel_t*)dst;                                                \
+    int i;                                                                      \
+    for (i = 0; i < n; ++i, rgbx += 4)                                          \
+        px[i] = FROM_RGBX(rgbx);                                                \
+}
+
+// R, G, B, X bytes.  BGRA uses these kernels on a swapped color.
+#define RGBX_LOAD(p, r, g, b) \
+    ((r) = (p) & 0xff, (g) = ((p) >> 8) & 0xff, (b) = ((p) >> 16) & 0xff)
+#define RGBX_STORE(p, r, g, b) \
+    (((p) & 0xff000000u) | (uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16))
+#define RGBX_FROM_RGBX(s) \
+    ((uint32_t)(s)[0] | ((uint32_t)(s)[1] << 8) | ((uint32_t)(s)[2] << 16) | ((uint32_t)(s)[3] << 24))
+#define BGRA_FROM_RGBX(s) \
+    ((uint32_t)(s)[2] | ((uint32_t)(s)[1] << 8) | ((uint32_t)(s)[0] << 16) | ((uint32_t)(s)[3] << 24))
+
+#if GR_PIXEL_BYTES == 4
+GR_SPAN_KERNELS(rgbx, uint32_t, RGBX_LOAD, RGBX_STORE)
+#if defined(RECOVERY_BGRA)
+GR_SPAN_CONVERT(bgra, uint32_t, BGRA_FROM_RGBX)
+#else
+GR_SPAN_CONVERT(rgbx, uint32_t, RGBX_FROM_RGBX)
+#endif
+#endif
+
+#if defined(RECOVERY_RGB565)
+// 16-bit 5:6:5, channels widened by repeating their top bits.
+#define RGB565_LOAD(p, r, g, b)                            \
+    ((r) = (((p) >> 11) << 3) | ((p) >> 13),               \
+     (g) = ((((p) >> 5) & 0x3f) << 2) | (((p) >> 9) & 3),  \
+     (b) = (((p) & 0x1f) << 3) | (((p) >> 2) & 7))
+#define RGB565_PACK(r, g, b) \
+    (uint16_t)((((r) >> 3) << 11) | (((g) >> 2) << 5) | ((b) >> 3))
+#define RGB565_STORE(p, r, g, b) RGB565_PACK(r, g, b)
+#define RGB565_FROM_RGBX(s) RGB565_PACK((s)[0], (s)[1], (s)[2])
+
+GR_SPAN_KERNELS(rgb565, uint16_t, RGB565_LOAD, RGB565_STORE)
+GR_SPAN_CONVERT(rgb565, uint16_t, RGB565_FROM_RGBX)
+#endif
+
+#ifdef GR_SPAN_NEON
+static inline uint8x8_t div255_neon(uint16x8_t x) {
+    uint16x8_t t = vaddq_u16(x, vdupq_n_u16(1));
+    return vshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+}
+
+// dst * (255 - a) + c * a, divided by 255.
+static inline uint8x8_t blend_neon(uint8x8_t dst, uint8x8_t c, uint8x8_t a) {
+    uint16x8_t x = vmull_u8(dst, vsub_u8(vdup_n_u8(255), a));
+    return div255_neon(vmlal_u8(x, c, a));
+}
+
+static void span_fill_neon(unsigned char* px, int n, uint32_t color) {
+    uint8x8_t r = vdup_n_u8(COLOR_R(color));
+    uint8x8_t g = vdup_n_u8(COLOR_G(color));
+    uint8x8_t b = vdup_n_u8(COLOR_B(color));
+    for (; n >= 8; n -= 8, px += 32) {
+        uint8x8x4_t p = vld4_u8(px);
+        p.val[0] = r;
+        p.val[1] = g;
+        p.val[2] = b;
+        vst4_u8(px, p);
+    }
+    span_fill_rgbx(px, n, color);
+}
+
+static void span_blend_neon(unsigned char* px, int n, uint32_t color) {
+    uint8x8_t r = vdup_n_u8(COLOR_R(color));
+    uint8x8_t g = vdup_n_u8(COLOR_G(color));
+    uint8x8_t b = vdup_n_u8(COLOR_B(color));
+    uint8x8_t a = vdup_n_u8(COLOR_A(color));
+    for (; n >= 8; n -= 8, px += 32) {
+        uint8x8x4_t p = vld4_u8(px);
+        p.val[0] = blend_neon(p.val[0], r, a);
+        p.val[1] = blend_neon(p.val[1], g, a);
+        p.val[2] = blend_neon(p.val[2], b, a);
+        vst4_u8(px, p);
+    }
+    span_blend_rgbx(px, n, color);
+}
+
+static void span_text_neon(const unsigned char* sx, unsigned char* px, int n, uint32_t color) {
+    uint8x8_t r = vdup_n_u8(COLOR_R(color));
+    uint8x8_t g = vdup_n_u8(COLOR_G(color));
+    uint8x8_t b = vdup_n_u8(COLOR_B(color));
+    uint8x8_t ga = vdup_n_u8(COLOR_A(color));
+    int scale = COLOR_A(color) < 255;
+    for (; n >= 8; n -= 8, sx += 8, px += 32) {
+        uint8x8_t a = vld1_u8(sx);
+        uint8x8x4_t p;
+        if (scale)
+            a = div255_neon(vmull_u8(a, ga));
+        // Skip the load and store for runs of fully transparent glyph
+        // pixels, which is most of a glyph cell.
+        if (vget_lane_u64(vreinterpret_u64_u8(a), 0) == 0)
+            continue;
+        p = vld4_u8(px);
+        p.val[0] = blend_neon(p.val[0], r, a);
+        p.val[1] = blend_neon(p.val[1], g, a);
+        p.val[2] = blend_neon(p.val[2], b, a);
+        vst4_u8(px, p);
+    }
+    span_text_rgbx(sx, px, n, color);
+}
+
+static void span_over_neon(const unsigned char* src, const unsigned char* alpha,
+                           unsigned char* px, int n) {
+    for (; n >= 8; n -= 8, src += 32, alpha += 8, px += 32) {
+        uint8x8_t a = vld1_u8(alpha);
+        uint8x8_t ia;
+        uint8x8x4_t s, p;
+        if (vget_lane_u64(vreinterpret_u64_u8(a), 0) == 0)
+            continue;
+        ia = vmvn_u8(a);
+        s = vld4_u8(src);
+        p = vld4_u8(px);
+        p.val[0] = vqadd_u8(s.val[0], div255_neon(vmull_u8(p.val[0], ia)));
+        p.val[1] = vqadd_u8(s.val[1], div255_neon(vmull_u8(p.val[1], ia)));
+        p.val[2] = vqadd_u8(s.val[2], div255_neon(vmull_u8(p.val[2], ia)));
+        vst4_u8(px, p);
+    }
+    span_over_rgbx(src, alpha, px, n);
+}
+#endif  // GR_SPAN_NEON
+
+#ifdef GR_SPAN_SSE2
+static inline __m128i div255_sse2(__m128i x) {
+    __m128i t = _mm_add_epi16(x, _mm_set1_epi16(1));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// Blend four pixels.  a holds the weight of each byte (0 for the fourth
+// byte of a pixel, which then comes back unchanged) and ca holds c * a
+// for the low and high pixel pairs as 16-bit lanes.
+static inline __m128i blend_sse2(__m128i dst, __m128i a, __m128i ca_lo, __m128i ca_hi) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    __m128i lo = _mm_unpacklo_epi8(dst, zero);
+    __m128i hi = _mm_unpackhi_epi8(dst, zero);
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, _mm_sub_epi16(full, a_lo)), ca_lo);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, _mm_sub_epi16(full, a_hi)), ca_hi);
+    return _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+}
+
+static void span_fill_sse2(unsigned char* px, int n, uint32_t color) {
+    const __m128i keep = _mm_set1_epi32((int)0xff000000);
+    const __m128i c = _mm_set1_epi32((int)(color & 0x00ffffff));
+    for (; n >= 4; n -= 4, px += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i*)px);
+        _mm_storeu_si128((__m128i*)px, _mm_or_si128(_mm_and_si128(p, keep), c));
+    }
+    span_fill_rgbx(px, n, color);
+}
+
+static void span_blend_sse2(unsigned char* px, int n, uint32_t color) {
+    uint32_t a = COLOR_A(color);
+    const __m128i wa = _mm_set1_epi32((int)(a * 0x010101));
+    // c * a per channel, 0 in the fourth lane
+    const __m128i ca = _mm_set_epi16(0, COLOR_B(color) * a, COLOR_G(color) * a, COLOR_R(color) * a,
+                                     0, COLOR_B(color) * a, COLOR_G(color) * a, COLOR_R(color) * a);
+    for (; n >= 4; n -= 4, px += 16) {
+        __m128i p = _mm_loadu_si128((const __m128i*)px);
+        _mm_storeu_si128((__m128i*)px, blend_sse2(p, wa, ca, ca));
+    }
+    span_blend_rgbx(px, n, color);
+}
+
+static void span_text_sse2(const unsigned char* sx, unsigned char* px, int n, uint32_t color) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c16 = _mm_set_epi16(0, COLOR_B(color), COLOR_G(color), COLOR_R(color),
+                                      0, COLOR_B(color), COLOR_G(color), COLOR_R(color));
+    const __m128i ga = _mm_set1_epi16(COLOR_A(color));
+    int scale = COLOR_A(color) < 255;
+    for (; n >= 4; n -= 4, sx += 4, px += 16) {
+        uint32_t cov;
+        __m128i a, p;
+        memcpy(&cov, sx, sizeof(cov));
+        if (cov == 0)
+            continue;
+        a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cov), zero);
+        if (scale)
+            a = div255_sse2(_mm_mullo_epi16(a, ga));
+        // one weight per pixel, replicated to its three color bytes
+        a = _mm_unpacklo_epi16(a, zero);
+        a = _mm_or_si128(a, _mm_or_si128(_mm_slli_epi32(a, 8), _mm_slli_epi32(a, 16)));
+        p = _mm_loadu_si128((const __m128i*)px);
+        _mm_storeu_si128((__m128i*)px,
+                         blend_sse2(p, a,
+                                    _mm_mullo_epi16(c16, _mm_unpacklo_epi8(a, zero)),
+                                    _mm_mullo_epi16(c16, _mm_unpackhi_epi8(a, zero))));
+    }
+    span_text_rgbx(sx, px, n, color);
+}
+
+static void span_over_sse2(const unsigned char* src, const unsigned char* alpha,
+                           unsigned char* px, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    for (; n >= 4; n -= 4, src += 16, alpha += 4, px += 16) {
+        uint32_t cov;
+        __m128i a, p, s;
+        memcpy(&cov, alpha, sizeof(cov));
+        if (cov == 0)
+            continue;
+        // one weight per pixel, replicated to its three color bytes
+        a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cov), zero);
+        a = _mm_unpacklo_epi16(a, zero);
+        a = _mm_or_si128(a, _mm_or_si128(_mm_slli_epi32(a, 8), _mm_slli_epi32(a, 16)));
+        s = _mm_and_si128(_mm_loadu_si128((const __m128i*)src), rgb);
+        p = _mm_loadu_si128((const __m128i*)px);
+        _mm_storeu_si128((__m128i*)px, _mm_adds_epu8(s, blend_sse2(p, a, zero, zero)));
+    }
+    span_over_rgbx(src, alpha, px, n);
+}
+#endif  // GR_SPAN_SSE2
+
+#ifdef GR_SPAN_AVX2
+#define GR_AVX2 __attribute__((target("avx2")))
+
+GR_AVX2 static inline __m256i div255_avx2(__m256i x) {
+    __m256i t = _mm256_add_epi16(x, _mm256_set1_epi16(1));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Eight pixels, same layout as blend_sse2() within each 128-bit lane.
+GR_AVX2 static inline __m256i blend_avx2(__m256i dst, __m256i a, __m256i ca_lo, __m256i ca_hi) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    __m256i lo = _mm256_unpacklo_epi8(dst, zero);
+    __m256i hi = _mm256_unpackhi_epi8(dst, zero);
+    __m256i a_lo = _mm256_unpacklo_epi8(a, zero);
+    __m256i a_hi = _mm256_unpackhi_epi8(a, zero);
+    lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, _mm256_sub_epi16(full, a_lo)), ca_lo);
+    hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, _mm256_sub_epi16(full, a_hi)), ca_hi);
+    return _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi));
+}
+
+GR_AVX2 static void span_fill_avx2(unsigned char* px, int n, uint32_t color) {
+    const __m256i keep = _mm256_set1_epi32((int)0xff000000);
+    const __m256i c = _mm256_set1_epi32((int)(color & 0x00ffffff));
+    for (; n >= 8; n -= 8, px += 32) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)px);
+        _mm256_storeu_si256((__m256i*)px, _mm256_or_si256(_mm256_and_si256(p, keep), c));
+    }
+    span_fill_sse2(px, n, color);
+}
+
+GR_AVX2 static void span_blend_avx2(unsigned char* px, int n, uint32_t color) {
+    uint32_t a = COLOR_A(color);
+    short r = COLOR_R(color) * a, g = COLOR_G(color) * a, b = COLOR_B(color) * a;
+    const __m256i wa = _mm256_set1_epi32((int)(a * 0x010101));
+    const __m256i ca = _mm256_set_epi16(0, b, g, r, 0, b, g, r, 0, b, g, r, 0, b, g, r);
+    for (; n >= 8; n -= 8, px += 32) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)px);
+        _mm256_storeu_si256((__m256i*)px, blend_avx2(p, wa, ca, ca));
+    }
+    span_blend_sse2(px, n, color);
+}
+
+GR_AVX2 static void span_text_avx2(const unsigned char* sx, unsigned char* px, int n, uint32_t color) {
+    const __m256i zero = _mm256_setzero_si256();
+    short r = COLOR_R(color), g = COLOR_G(color), b = COLOR_B(color);
+    const __m256i c16 = _mm256_set_epi16(0, b, g, r, 0, b, g, r, 0, b, g, r, 0, b, g, r);
+    const __m256i ga = _mm256_set1_epi32(COLOR_A(color));
+    int scale = COLOR_A(color) < 255;
+    for (; n >= 8; n -= 8, sx += 8, px += 32) {
+        uint64_t cov;
+        __m256i a, p;
+        memcpy(&cov, sx, sizeof(cov));
+        if (cov == 0)
+            continue;
+        // one 32-bit lane per pixel
+        a = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128((long long)cov));
+        if (scale)
+            a = div255_avx2(_mm256_mullo_epi16(a, ga));
+        a = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_epi32(a, 8), _mm256_slli_epi32(a, 16)));
+        p = _mm256_loadu_si256((const __m256i*)px);
+        _mm256_storeu_si256((__m256i*)px,
+                            blend_avx2(p, a,
+                                       _mm256_mullo_epi16(c16, _mm256_unpacklo_epi8(a, zero)),
+                                       _mm256_mullo_epi16(c16, _mm256_unpackhi_epi8(a, zero))));
+    }
+    span_text_sse2(sx, px, n, color);
+}
+
+GR_AVX2 static void span_over_avx2(const unsigned char* src, const unsigned char* alpha,
+                                   unsigned char* px, int n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    for (; n >= 8; n -= 8, src += 32, alpha += 8, px += 32) {
+        uint64_t cov;
+        __m256i a, p, s;
+        memcpy(&cov, alpha, sizeof(cov));
+        if (cov == 0)
+            continue;
+        a = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128((long long)cov));
+        a = _mm256_or_si256(a, _mm256_or_si256(_mm256_slli_epi32(a, 8), _mm256_slli_epi32(a, 16)));
+        s = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)src), rgb);
+        p = _mm256_loadu_si256((const __m256i*)px);
+        _mm256_storeu_si256((__m256i*)px, _mm256_adds_epu8(s, blend_avx2(p, a, zero, zero)));
+    }
+    span_over_sse2(src, alpha, px, n);
+}
+#endif  // GR_SPAN_AVX2
+
+#if defined(RECOVERY_RGB565)
+#define GR_SPAN_C {          \
+    "rgb565",                \
+    span_fill_rgb565,        \
+    span_blend_rgb565,       \
+    span_text_rgb565,        \
+    span_convert_rgb565,     \
+    span_over_rgb565,        \
+}
+#elif defined(RECOVERY_BGRA)
+#define GR_SPAN_C {          \
+    "c",                     \
+    span_fill_rgbx,          \
+    span_blend_rgbx,         \
+    span_text_rgbx,          \
+    span_convert_bgra,       \
+    span_over_rgbx,          \
+}
+#else
+#define GR_SPAN_C {          \
+    "c",                     \
+    span_fill_rgbx,          \
+    span_blend_rgbx,         \
+    span_text_rgbx,          \
+    span_convert_rgbx,       \
+    span_over_rgbx,          \
+}
+#endif
+
+const gr_span_ops gr_span_c = GR_SPAN_C;
+gr_span_ops gr_span = GR_SPAN_C;
+
+void gr_span_init(void) {
+#if GR_PIXEL_BYTES == 4
+#ifdef GR_SPAN_NEON
+#if !defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+    {
+        gr_span.name = "neon";
+        gr_span.fill = span_fill_neon;
+        gr_span.blend = span_blend_neon;
+        gr_span.text = span_text_neon;
+        gr_span.over = span_over_neon;
+    }
+#endif
+#ifdef GR_SPAN_SSE2
+    gr_span.name = "sse2";
+    gr_span.fill = span_fill_sse2;
+    gr_span.blend = span_blend_sse2;
+    gr_span.text = span_text_sse2;
+    gr_span.over = span_over_sse2;
+#endif
+#ifdef GR_SPAN_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        gr_span.name = "avx2";
+        gr_span.fill = span_fill_avx2;
+        gr_span.blend = span_blend_avx2;
+        gr_span.text = span_text_avx2;
+        gr_span.over = span_over_avx2;
+    }
+#endif
+#endif  // GR_PIXEL_BYTES == 4
+    LOGD("minui: %s span kernels\n", gr_span.name);
+}
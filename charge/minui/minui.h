@@ -20,6 +20,7 @@
 #include <sys/types.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,10 +32,23 @@ typedef struct {
     int row_bytes;
     int pixel_bytes;
     unsigned char* data;
+    // Transparency of a display surface, NULL if it is opaque.  See
+    // gr_blit_blend().
+    struct GRSurfaceAlpha* alpha;
 } GRSurface;
 
 typedef GRSurface* gr_surface;
 
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} GRRect;
+
+// Most damage rectangles passed to gr_flip_damage().
+#define GR_DAMAGE_MAX 16
+
 int gr_init(void);
 void gr_exit(void);
 
@@ -43,7 +57,18 @@ int gr_fb_height(void);
 
 void gr_sync(void);
 void gr_flip(void);
+// gr_flip() with a hint of which rectangles changed since the previous
+// frame, so the backend only has to present those.  NULL means all.
+void gr_flip_damage(const GRRect* rects, int count);
+// How many frames ago the current drawing surface was last drawn: 1 if
+// it still holds the previous frame, 2 for the one before, and so on.
+// 0 means its contents are undefined and everything must be redrawn.
+int gr_fb_buffer_age(void);
 void gr_fb_blank(bool blank);
+// Display event fd for an external event loop (-1 if the backend has
+// none), and the handler to call when it becomes readable.
+int gr_fb_event_fd(void);
+void gr_fb_handle_event(void);
 
 void gr_clear();  // clear entire surface to current color
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -54,6 +79,23 @@ int gr_measure(const char *s);
 void gr_font_size(int *x, int *y);
 
 void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
+// Like gr_blit(), but composites the source over what is already drawn
+// using its alpha channel.  Same as gr_blit() for opaque surfaces.
+void gr_blit_blend(gr_surface source, int sx, int sy, int w, int h, int dx, int dy);
+// An anti-aliased progress ring: a full track in one color and, over it,
+// an arc clockwise from 12 o'clock in another.  radius is to the middle
+// of the stroke and colors are 0xRRGGBB.  The ring is rendered into a
+// display surface, so drawing it is a gr_blit_blend(), and moving the
+// end of the arc repaints only the pixels in between.
+typedef struct GRRing GRRing;
+GRRing* gr_ring_create(int radius, int thickness, uint32_t track_rgb, uint32_t arc_rgb);
+// Set the arc to value / max of the full turn.
+void gr_ring_set(GRRing* ring, int value, int max);
+// The rendered ring, 2 * (radius + thickness / 2) + 2 pixels square and
+// centered.  Owned by the ring.
+gr_surface gr_ring_surface(GRRing* ring);
+void gr_ring_destroy(GRRing* ring);
+
 unsigned int gr_get_width(gr_surface surface);
 unsigned int gr_get_height(gr_surface surface);
 
@@ -68,12 +110,25 @@ int ev_init(void);
 void ev_exit(void);
 int ev_get(struct input_event *ev, int wait_ms);
 
+// Single event loop support.  ev_add_fd() registers any fd with an
+// epoll set, ev_add_input_fds() registers the devices opened by
+// ev_init().  ev_wait() waits for events and ev_dispatch() runs the
+// callbacks of the fds that became ready.
+int ev_add_fd(int fd, ev_callback cb, void *data);
+int ev_add_input_fds(ev_callback cb, void *data);
+
 /* timeout has the same semantics as for poll
  *    0 : don't block
  *  < 0 : block forever
  *  > 0 : block for 'timeout' milliseconds
  */
 int ev_wait(int timeout);
+void ev_dispatch(void);
+
+// Read one key event from an input fd reported by ev_dispatch().  An
+// RTC alarm is reported as KEY_BRL_DOT8, like ev_get() does.  Returns 0
+// if 'ev' holds a key event.
+int ev_get_input(int fd, uint32_t epevents, struct input_event *ev);
 
 
 // Resources
@@ -82,15 +137,39 @@ int ev_wait(int timeout);
 // negative.
 //
 // A "display" surface is one that is intended to be drawn to the
-// screen with gr_blit().  An "alpha" surface is a grayscale image
+// screen with gr_blit(), or gr_blit_blend() if the PNG has an alpha
+// channel; its colors are then premultiplied by alpha.  An "alpha" surface is a grayscale image
 // interpreted as an alpha mask used to render text in the current
 // color (with gr_text() or gr_texticon()).
 //
-// All these functions load PNG images from "/res/images/${name}.png".
+// All these functions load PNG images from
+// "/vendor/etc/res/images/${name}.png".  Single display surfaces are
+// read from "${name}.qoi" instead when there is one (see mkqoi.c), and
+// come straight from the prebuilt bundle (see res_bundle.h) when it has
+// the image at the same scale and rotation.
+
+// Load the PNG images from dir instead, for tools run on the host.
+void res_set_image_dir(const char* dir);
+
+// Take surfaces from the bundle at path instead, or from none if path
+// is NULL, for tests.  Surfaces from the previous bundle must have
+// been freed.  Returns -1 if path is not a bundle for this build.
+int res_set_bundle(const char* path);
 
 // Load a single display surface from a PNG image.
 int res_create_display_surface(const char* name, gr_surface* pSurface);
 
+// Like res_create_display_surface(), with the image turned by rotation
+// (FB_ROTATE_* from linux/fb.h) once at load time.
+int res_create_rotated_display_surface(const char* name, int rotation,
+                                       gr_surface* pSurface);
+
+// Like res_create_rotated_display_surface(), with the image first shrunk
+// to scale_num / scale_den of its size by area averaging, so one set of
+// large images serves every panel.  Never enlarges.
+int res_create_scaled_display_surface(const char* name, int scale_num, int scale_den,
+                                      int rotation, gr_surface* pSurface);
+
 // Load an array of display surfaces from a single PNG image.  The PNG
 // should have a 'Frames' text chunk whose value is the number of
 // frames this image represents.  The pixel data itself is interlaced
@@ -114,6 +193,73 @@ int res_create_localized_alpha_surface(const char* name, const char* locale,
 // functions.
 void res_free_surface(gr_surface surface);
 
+// Shared display surfaces.  res_acquire_display_surface() is
+// res_create_scaled_display_surface() through a cache keyed by name,
+// scale and rotation: loading the same image again returns the same
+// surface, without decoding it, and adds a reference.  Missing images
+// are remembered as well.  Drop each reference with
+// res_release_surface(), never res_free_surface().
+int res_acquire_display_surface(const char* name, int scale_num, int scale_den,
+                                int rotation, gr_surface* pSurface);
+void res_release_surface(gr_surface surface);
+
+// One image for res_acquire_display_surfaces().
+typedef struct {
+    const char* name;
+    int scale_num, scale_den;
+    int rotation;
+    gr_surface* surface;    // receives the surface, NULL on error
+    int result;             // set to what res_acquire_display_surface() returns
+} ResRequest;
+
+// res_acquire_display_surface() for count images at once.  The images
+// not cached yet are decoded concurrently, on up to one thread per
+// online core, and every surface is stored when all are done.  Returns
+// 0, or the first negative result.
+int res_acquire_display_surfaces(ResRequest* requests, int count);
+
+// Surfaces nobody holds stay cached until the cache is over its budget
+// of decoded bytes, then the least recently used go first.  0, the
+// default, is no budget.  Surfaces still held are never freed.
+void res_cache_set_budget(size_t bytes);
+
+// Free every cached surface nobody holds.
+void res_cache_trim(void);
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t bytes;       // decoded size of everything cached
+    int entries;
+} ResCacheStats;
+
+void res_cache_get_stats(ResCacheStats* stats);
+
+// An animation played from "${name}.anim" (see res_anim.h) one frame at
+// a time.  Frames are scaled and turned like those of
+// res_create_scaled_display_surface(), but only the current frame and
+// the one after it are kept as surfaces; the rest are decoded from the
+// file as the animation gets to them.  Returns 0, -1 if there is no
+// such file, or another negative value on error.
+typedef struct ResAnimation ResAnimation;
+int res_open_animation(const char* name, int scale_num, int scale_den, int rotation,
+                       ResAnimation** pAnim);
+int res_animation_frames(ResAnimation* anim);
+int res_animation_index(ResAnimation* anim);
+// The current frame, owned by the animation and valid until the next
+// res_animation_next().  A new frame never has the address of the one
+// it replaces.
+gr_surface res_animation_surface(ResAnimation* anim);
+// How long the current frame is meant to show, in milliseconds.
+int res_animation_duration(ResAnimation* anim);
+// After the last frame, go on from frame first (0 by default).
+void res_animation_set_loop(ResAnimation* anim, int first);
+// Move to the next frame.  Returns 0, else negative and the current
+// frame stays.
+int res_animation_next(ResAnimation* anim);
+void res_free_animation(ResAnimation* anim);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build the display surface bundle (see res_bundle.h) from PNG images,
+ * on the host at build time:
+ *
+ *   mkbundle -o charge_images.bundle [-p WxH] [-m WxH] [-r] image.png...
+ *
+ * The surfaces are made by the same resources.c code the charger loads
+ * images with, so they are exactly what it would have decoded.  With -p
+ * they are shrunk the way ui.c shrinks them for a panel of that size:
+ * by the scale that fits the master size (-m, 1440x2560 by default) to
+ * the panel in either orientation.  -r stores every image a second
+ * time, turned clockwise, for panels set up with
+ * ro.vendor.minui.hwrotation.
+ */
+
+#include <linux/fb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minui.h"
+#include "graphics.h"
+#include "res_bundle.h"
+
+void log_write(int level, const char* fmt, ...) {
+}
+
+static int parse_size(const char* s, int* w, int* h) {
+    return sscanf(s, "%dx%d", w, h) == 2 && *w > 0 && *h > 0 ? 0 : -1;
+}
+
+// Same as res_scale() in ui.c.
+static void fit_scale(int pw, int ph, int mw, int mh, int* num, int* den) {
+    int s = pw < ph ? pw : ph;
+    int l = pw < ph ? ph : pw;
+    int ms = mw < mh ? mw : mh;
+    int ml = mw < mh ? mh : mw;
+
+    if ((long)s * ml <= (long)l * ms) {
+        *num = s;
+        *den = ms;
+    } else {
+        *num = l;
+        *den = ml;
+    }
+    if (*num > *den) *num = *den;
+}
+
+static uint64_t align(uint64_t offset) {
+    return (offset + RES_BUNDLE_ALIGN - 1) & ~(uint64_t)(RES_BUNDLE_ALIGN - 1);
+}
+
+// Write size bytes at *pos, then zeros up to the next block.
+static int put_block(FILE* f, const void* p, size_t size, uint64_t* pos) {
+    static const unsigned char zeros[RES_BUNDLE_ALIGN];
+    uint64_t end = align(*pos + size);
+
+    if (fwrite(p, 1, size, f) != size) return -1;
+    if (fwrite(zeros, 1, end - *pos - size, f) != end - *pos - size) return -1;
+    *pos = end;
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mkbundle -o OUT [-p WxH] [-m WxH] [-r] IMAGE.png...\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* out = NULL;
+    int panel_w = 0, panel_h = 0, master_w = 1440, master_h = 2560;
+    int rotated = 0;
+    int num = 1, den = 1;
+    int count, i, k, c;
+    ResBundleHeader header;
+    ResBundleEntry* entries;
+    gr_surface* surfaces;
+    uint64_t pos;
+    FILE* f;
+
+    while ((c = getopt(argc, argv, "o:p:m:r")) != -1) {
+        switch (c) {
+            case 'o': out = optarg; break;
+            case 'p': if (parse_size(optarg, &panel_w, &panel_h) < 0) usage(); break;
+            case 'm': if (parse_size(optarg, &master_w, &master_h) < 0) usage(); break;
+            case 'r': rotated = 1; break;
+            default: usage();
+        }
+    }
+    if (out == NULL || optind == argc) usage();
+    if (panel_w) fit_scale(panel_w, panel_h, master_w, master_h, &num, &den);
+
+    gr_span_init();
+    count = (argc - optind) * (rotated ? 2 : 1);
+    entries = calloc(count, sizeof(ResBundleEntry));
+    surfaces = calloc(count, sizeof(gr_surface));
+    if (entries == NULL || surfaces == NULL) {
+        fprintf(stderr, "mkbundle: out of memory\n");
+        return 1;
+    }
+
+    // Load everything and lay the file out.
+    pos = align(sizeof(header) + count * sizeof(ResBundleEntry));
+    for (i = 0, k = 0; optind + i < argc; ++i) {
+        char* path = strdup(argv[optind + i]);
+        char* slash = strrchr(path, '/');
+        char* name = slash ? slash + 1 : path;
+        size_t len = strlen(name);
+        int r;
+
+        if (len < 5 || strcmp(name + len - 4, ".png") != 0 || len - 4 >= sizeof(entries->name)) {
+            fprintf(stderr, "mkbundle: %s: expected a .png name of at most %zu characters\n",
+                    argv[optind + i], sizeof(entries->name) - 1);
+            return 1;
+        }
+        name[len - 4] = '\0';
+        if (slash) *slash = '\0';
+        res_set_image_dir(slash ? path : ".");
+
+        for (r = 0; r <= rotated; ++r, ++k) {
+            ResBundleEntry* e = &entries[k];
+            gr_surface s;
+            int result = res_create_scaled_display_surface(name, num, den,
+                                                           r ? FB_ROTATE_CW : FB_ROTATE_UR,
+                                                           &surfaces[k]);
+            if (result < 0) {
+                fprintf(stderr, "mkbundle: %s: cannot load (%d)\n", argv[optind + i], result);
+                return 1;
+            }
+            s = surfaces[k];
+            strcpy(e->name, name);
+            e->scale_num = num < den ? num : 1;
+            e->scale_den = num < den ? den : 1;
+            e->rotation = r ? FB_ROTATE_CW : FB_ROTATE_UR;
+            e->width = s->width;
+            e->height = s->height;
+            e->row_bytes = s->row_bytes;
+            e->data = pos;
+            pos = align(pos + (uint64_t)s->height * s->row_bytes);
+            if (s->alpha) {
+                e->coverage = pos;
+                pos = align(pos + (uint64_t)s->width * s->height);
+                e->row_runs = pos;
+                pos = align(pos + (s->height + 1) * sizeof(int32_t));
+                e->runs = pos;
+                pos = align(pos + s->alpha->row_runs[s->height] * sizeof(GRAlphaRun));
+            }
+        }
+    }
+
+    f = fopen(out, "wb");
+    if (f == NULL) {
+        perror(out);
+        return 1;
+    }
+    header.magic = RES_BUNDLE_MAGIC;
+    header.version = RES_BUNDLE_VERSION;
+    header.format = RES_BUNDLE_FORMAT;
+    header.count = count;
+    pos = 0;
+    if (fwrite(&header, 1, sizeof(header), f) != sizeof(header)) goto fail;
+    pos = sizeof(header);
+    if (put_block(f, entries, count * sizeof(ResBundleEntry), &pos) < 0) goto fail;
+    for (k = 0; k < count; ++k) {
+        gr_surface s = surfaces[k];
+
+        if (put_block(f, s->data, (size_t)s->height * s->row_bytes, &pos) < 0) goto fail;
+        if (s->alpha == NULL) continue;
+        if (put_block(f, s->alpha->coverage, (size_t)s->width * s->height, &pos) < 0 ||
+            put_block(f, s->alpha->row_runs, (s->height + 1) * sizeof(int32_t), &pos) < 0 ||
+            put_block(f, s->alpha->runs, s->alpha->row_runs[s->height] * sizeof(GRAlphaRun),
+                      &pos) < 0) {
+            goto fail;
+        }
+    }
+    if (fclose(f) != 0) {
+        perror(out);
+        return 1;
+    }
+    printf("%s: %d surfaces at %d/%d, %llu bytes\n", out, count, num < den ? num : 1,
+           num < den ? den : 1, (unsigned long long)pos);
+    return 0;
+
+  fail:
+    perror(out);
+    fclose(f);
+    unlink(out);
+    return 1;
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Convert a PNG image to QOI for resources.c:
+ *
+ *   mkqoi image.png image.qoi
+ *
+ * Gray and paletted images become RGB; like minui, the tRNS chunk of a
+ * paletted image is ignored, so both files load to the same pixels.
+ *
+ * With -a, make an animation (see res_anim.h) of PNG frames of the same
+ * size instead:
+ *
+ *   mkqoi -a [-d MS] [-k N] anim.anim frame.png[:MS]...
+ *
+ * Each frame shows for the MS after its name, else for the -d default
+ * (125 ms).  Every Nth frame is a key frame, 0 (the default) for the
+ * first one only.
+ */
+
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "res_anim.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_HASH(p) (((p)[0] * 3 + (p)[1] * 5 + (p)[2] * 7 + (p)[3] * 11) & 63)
+
+static void put32(FILE* f, uint32_t v) {
+    fputc(v >> 24, f);
+    fputc(v >> 16, f);
+    fputc(v >> 8, f);
+    fputc(v, f);
+}
+
+// Read the image as rows of 'channels' (3 or 4) bytes per pixel, or
+// always 4 with rgba.
+static unsigned char* read_png(const char* path, png_uint_32* width, png_uint_32* height,
+                               int* channels, int rgba) {
+    png_structp png;
+    png_infop info;
+    unsigned char* pixels = NULL;
+    png_bytep* rows = NULL;
+    png_uint_32 y;
+    int color_type, bit_depth;
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL) {
+        perror(path);
+        return NULL;
+    }
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+        fprintf(stderr, "%s: cannot decode\n", path);
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(fp);
+        return NULL;
+    }
+    png_init_io(png, fp);
+    png_read_info(png, info);
+    png_get_IHDR(png, info, width, height, &bit_depth, &color_type, NULL, NULL, NULL);
+    if (bit_depth == 16) png_set_strip_16(png);
+    if (color_type == PNG_COLOR_TYPE_PALETTE) png_set_palette_to_rgb(png);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        if (bit_depth < 8) png_set_expand_gray_1_2_4_to_8(png);
+        png_set_gray_to_rgb(png);
+    }
+    if (rgba && !(color_type & PNG_COLOR_MASK_ALPHA))
+        png_set_add_alpha(png, 0xff, PNG_FILLER_AFTER);
+    png_read_update_info(png, info);
+    *channels = png_get_channels(png, info);
+
+    pixels = malloc((size_t)*width * *height * *channels);
+    rows = malloc(*height * sizeof(png_bytep));
+    if (pixels == NULL || rows == NULL) png_error(png, "out of memory");
+    for (y = 0; y < *height; ++y)
+        rows[y] = pixels + (size_t)y * *width * *channels;
+    png_read_image(png, rows);
+
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    fclose(fp);
+    return pixels;
+}
+
+static void write_qoi(FILE* f, const unsigned char* pixels, png_uint_32 width,
+                      png_uint_32 height, int channels) {
+    static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    unsigned char index[64][4];
+    unsigned char px[4] = { 0, 0, 0, 255 }, prev[4] = { 0, 0, 0, 255 };
+    size_t i, n = (size_t)width * height;
+    int run = 0;
+
+    memset(index, 0, sizeof(index));
+    fwrite("qoif", 1, 4, f);
+    put32(f, width);
+    put32(f, height);
+    fputc(channels, f);
+    fputc(0, f);    // sRGB with linear alpha
+
+    for (i = 0; i < n; ++i) {
+        memcpy(px, pixels + i * channels, channels);
+        if (memcmp(px, prev, 4) == 0) {
+            if (++run == 62 || i == n - 1) {
+                fputc(QOI_OP_RUN | (run - 1), f);
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            fputc(QOI_OP_RUN | (run - 1), f);
+            run = 0;
+        }
+
+        int h = QOI_HASH(px);
+        if (memcmp(index[h], px, 4) == 0) {
+            fputc(QOI_OP_INDEX | h, f);
+        } else if (px[3] == prev[3]) {
+            int dr = (signed char)(px[0] - prev[0]);
+            int dg = (signed char)(px[1] - prev[1]);
+            int db = (signed char)(px[2] - prev[2]);
+            int dr_dg = dr - dg, db_dg = db - dg;
+
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                fputc(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2), f);
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                       db_dg >= -8 && db_dg <= 7) {
+                fputc(QOI_OP_LUMA | (dg + 32), f);
+                fputc((dr_dg + 8) << 4 | (db_dg + 8), f);
+            } else {
+                fputc(QOI_OP_RGB, f);
+                fwrite(px, 1, 3, f);
+            }
+        } else {
+            fputc(QOI_OP_RGBA, f);
+            fwrite(px, 1, 4, f);
+        }
+        memcpy(index[h], px, 4);
+        memcpy(prev, px, 4);
+    }
+    fwrite(end, 1, sizeof(end), f);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mkqoi IMAGE.png IMAGE.qoi\n"
+                    "       mkqoi -a [-d MS] [-k N] OUT.anim FRAME.png[:MS]...\n");
+    exit(2);
+}
+
+// The rectangle where a and b, RGBA images of width * height, differ.
+static void changed_rect(const unsigned char* a, const unsigned char* b, png_uint_32 width,
+                         png_uint_32 height, ResAnimFrame* f) {
+    png_uint_32 x, y, x0 = width, y0 = height, x1 = 0, y1 = 0;
+
+    for (y = 0; y < height; ++y) {
+        for (x = 0; x < width; ++x) {
+            size_t i = ((size_t)y * width + x) * 4;
+            if (memcmp(a + i, b + i, 4) == 0) continue;
+            if (x < x0) x0 = x;
+            if (x >= x1) x1 = x + 1;
+            if (y < y0) y0 = y;
+            y1 = y + 1;
+        }
+    }
+    if (x0 >= x1) x0 = x1 = y0 = y1 = 0;
+    f->x = x0;
+    f->y = y0;
+    f->w = x1 - x0;
+    f->h = y1 - y0;
+}
+
+static int make_animation(const char* out, int duration, int key_every, int count,
+                          char** frames) {
+    ResAnimHeader header;
+    ResAnimFrame* table = calloc(count, sizeof(ResAnimFrame));
+    unsigned char *prev = NULL, *delta = NULL;
+    png_uint_32 width = 0, height = 0;
+    long pos;
+    int i;
+    FILE* f = fopen(out, "wb");
+
+    if (f == NULL) {
+        perror(out);
+        return 1;
+    }
+    if (table == NULL) goto fail;
+    header.magic = RES_ANIM_MAGIC;
+    header.version = RES_ANIM_VERSION;
+    header.count = count;
+    pos = sizeof(header) + count * sizeof(ResAnimFrame);
+    if (fseek(f, pos, SEEK_SET) != 0) goto fail;
+
+    for (i = 0; i < count; ++i) {
+        ResAnimFrame* frame = &table[i];
+        char* path = frames[i];
+        char* ms = strrchr(path, ':');
+        png_uint_32 w, h, y;
+        unsigned char* pixels;
+        size_t n, k;
+        int channels;
+
+        frame->duration_ms = duration;
+        if (ms) {
+            *ms++ = '\0';
+            frame->duration_ms = atoi(ms);
+        }
+        pixels = read_png(path, &w, &h, &channels, 1);
+        if (pixels == NULL) goto fail;
+        if (i == 0) {
+            width = header.width = w;
+            height = header.height = h;
+            if (w > 65535 || h > 65535) {
+                fprintf(stderr, "%s: too large\n", path);
+                goto fail;
+            }
+            prev = calloc((size_t)w * h, 4);
+            delta = malloc((size_t)w * h * 4);
+            if (prev == NULL || delta == NULL) goto fail;
+        } else if (w != width || h != height) {
+            fprintf(stderr, "%s: %ux%u, not %ux%u like the first frame\n", path, w, h,
+                    width, height);
+            goto fail;
+        }
+
+        // A key frame starts over from transparent black, so it covers
+        // only what is visible; the player keeps just the union of the
+        // rectangles.
+        if (i == 0 || (key_every > 0 && i % key_every == 0)) {
+            frame->flags = RES_ANIM_KEY;
+            memset(prev, 0, (size_t)width * height * 4);
+        }
+        changed_rect(prev, pixels, width, height, frame);
+
+        n = 0;
+        for (y = frame->y; y < (png_uint_32)frame->y + frame->h; ++y) {
+            size_t row = ((size_t)y * width + frame->x) * 4;
+            for (k = 0; k < (size_t)frame->w * 4; ++k)
+                delta[n++] = pixels[row + k] ^ prev[row + k];
+        }
+        frame->offset = pos;
+        if (n > 0) {
+            write_qoi(f, delta, frame->w, frame->h, 4);
+            pos = ftell(f);
+        }
+        frame->size = pos - frame->offset;
+        memcpy(prev, pixels, (size_t)width * height * 4);
+        free(pixels);
+    }
+
+    rewind(f);
+    if (fwrite(&header, 1, sizeof(header), f) != sizeof(header) ||
+        fwrite(table, sizeof(ResAnimFrame), count, f) != (size_t)count) {
+        goto fail;
+    }
+    if (ferror(f) | fclose(f)) {
+        f = NULL;
+        goto fail;
+    }
+    printf("%s: %d frames of %ux%u, %ld bytes\n", out, count, width, height, pos);
+    free(table);
+    free(prev);
+    free(delta);
+    return 0;
+
+  fail:
+    if (f) fclose(f);
+    fprintf(stderr, "mkqoi: cannot write %s\n", out);
+    remove(out);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    png_uint_32 width, height;
+    unsigned char* pixels;
+    int channels;
+    int animation = 0, duration = 125, key_every = 0;
+    int c;
+    FILE* f;
+
+    while ((c = getopt(argc, argv, "ad:k:")) != -1) {
+        switch (c) {
+            case 'a': animation = 1; break;
+            case 'd': duration = atoi(optarg); break;
+            case 'k': key_every = atoi(optarg); break;
+            default: usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (animation) {
+        if (argc < 2) usage();
+        return make_animation(argv[0], duration, key_every, argc - 1, argv + 1);
+    }
+    if (argc != 2) usage();
+
+    pixels = read_png(argv[0], &width, &height, &channels, 0);
+    if (pixels == NULL) return 1;
+    if (channels != 3 && channels != 4) {
+        fprintf(stderr, "%s: %d channels not supported\n", argv[0], channels);
+        return 1;
+    }
+
+    f = fopen(argv[1], "wb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    write_qoi(f, pixels, width, height, channels);
+    if (ferror(f) | fclose(f)) {
+        perror(argv[1]);
+        remove(argv[1]);
+        return 1;
+    }
+    free(pixels);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINUI_RES_ANIM_H_
+#define MINUI_RES_ANIM_H_
+
+#include <stdint.h>
+
+// Animations ("${name}.anim"), made from PNG frames by mkqoi -a and
+// played by res_open_animation().  The file is a header, a table of
+// frames and the data of each frame, in the byte order of the device.
+//
+// The data of a frame is a 4-channel QOI image (see resources.c) of the
+// rectangle that changed since the frame before: the R, G, B, A bytes
+// of the frame XORed with those of the previous one, so what did not
+// change is a run of zeros.  A key frame is XORed with a transparent
+// black image instead, and starts decoding over; frame 0 is always one.
+// Outside the rectangles of all frames the animation is transparent.
+
+#define RES_ANIM_MAGIC 0x41475243  // "CRGA"
+#define RES_ANIM_VERSION 1
+#define RES_ANIM_KEY 0x1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t count;         // frames in the table right after
+} ResAnimHeader;
+
+typedef struct {
+    uint32_t offset;        // of the QOI image, size bytes
+    uint32_t size;          // 0 if nothing changed
+    uint16_t x, y, w, h;    // the rectangle it covers
+    uint16_t duration_ms;   // how long the frame shows
+    uint16_t flags;         // RES_ANIM_*
+} ResAnimFrame;
+
+#endif  // MINUI_RES_ANIM_H_
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MINUI_RES_BUNDLE_H_
+#define MINUI_RES_BUNDLE_H_
+
+#include <stdint.h>
+
+#include "graphics.h"
+
+// Display surfaces prepared at build time by mkbundle, in one file that
+// resources.c maps and draws from directly.  The file is a header, an
+// index of entries and the data of each, every block starting on a
+// RES_BUNDLE_ALIGN boundary.  Offsets are from the start of the file
+// and everything is in the byte order of the device.
+
+#define RES_BUNDLE_PATH "/vendor/etc/res/charge_images.bundle"
+#define RES_BUNDLE_MAGIC 0x42475243  // "CRGB"
+#define RES_BUNDLE_VERSION 1
+#define RES_BUNDLE_ALIGN 64
+
+// Pixel format of the surfaces, see GR_PIXEL_BYTES.  A bundle is only
+// used by a build with the same format.
+#if defined(RECOVERY_RGB565)
+#define RES_BUNDLE_FORMAT 2
+#elif defined(RECOVERY_BGRA)
+#define RES_BUNDLE_FORMAT 1
+#else
+#define RES_BUNDLE_FORMAT 0
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t count;         // entries in the index right after
+} ResBundleHeader;
+
+// One display surface, as res_create_scaled_display_surface() would
+// have made it from the named image.
+typedef struct {
+    char name[48];
+    int32_t scale_num, scale_den;   // 1, 1 for full size
+    int32_t rotation;
+    uint32_t width, height;
+    uint32_t row_bytes;
+    uint64_t data;          // height * row_bytes bytes of pixels
+    // GRSurfaceAlpha of the surface; coverage is 0 for an opaque one.
+    uint64_t coverage;      // width * height alpha values
+    uint64_t row_runs;      // height + 1 int32_t
+    uint64_t runs;          // row_runs[height] GRAlphaRun
+} ResBundleEntry;
+
+#endif  // MINUI_RES_BUNDLE_H_
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -23,6 +25,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <linux/fb.h>
@@ -31,17 +34,27 @@
 #include <png.h>
 
 #include "minui.h"
+#include "graphics.h"
+#include "res_anim.h"
+#include "res_bundle.h"
 
 extern char* locale;
 
 #define SURFACE_DATA_ALIGNMENT 8
 
+static const char* image_dir = "/vendor/etc/res/images";
+
+void res_set_image_dir(const char* dir) {
+    image_dir = dir;
+}
+
 static gr_surface malloc_surface(size_t data_size) {
     unsigned char* temp = malloc(sizeof(GRSurface) + data_size + SURFACE_DATA_ALIGNMENT);
     if (temp == NULL) return NULL;
     gr_surface surface = (gr_surface) temp;
     surface->data = temp + sizeof(GRSurface) +
         (SURFACE_DATA_ALIGNMENT - (sizeof(GRSurface) % SURFACE_DATA_ALIGNMENT));
+    surface->alpha = NULL;
     return surface;
 }
 
@@ -51,7 +64,7 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
     unsigned char header[8];
     int result = 0;
 
-    snprintf(resPath, sizeof(resPath)-1, "/vendor/etc/res/images/%s.png", name);
+    snprintf(resPath, sizeof(resPath)-1, "%s/%s.png", image_dir, name);
     resPath[sizeof(resPath)-1] = '\0';
     FILE* fp = fopen(resPath, "rb");
     if (fp == NULL) {
@@ -131,109 +144,669 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
     return result;
 }
 
+// Finish with an image opened by open_png(), closing its file.
+static void close_png(png_structp* png_ptr, png_infop* info_ptr) {
+    FILE* fp = *png_ptr ? png_get_io_ptr(*png_ptr) : NULL;
+
+    png_destroy_read_struct(png_ptr, info_ptr, NULL);
+    if (fp != NULL) fclose(fp);
+}
+
+// QOI images ("${name}.qoi", see https://qoiformat.org), made from the
+// PNGs by mkqoi.  Flat sprites decode several times faster than with
+// zlib and PNG filtering, at about the same size.  The file is read
+// whole and decoded a row at a time.
+
+#define QOI_HEADER_SIZE 14
+#define QOI_END_SIZE 8
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_OP_MASK 0xc0
+#define QOI_HASH(p) (((p)[0] * 3 + (p)[1] * 5 + (p)[2] * 7 + (p)[3] * 11) & 63)
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t pos;
+    unsigned char px[4];
+    unsigned char index[64][4];
+    int run;            // pixels still to repeat px
+} QoiDecoder;
+
+static uint32_t qoi_read32(const unsigned char* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Check the header of the QOI image of d->size bytes at d->data and
+// get ready to decode its pixels.  Returns as open_png().
+static int qoi_start(QoiDecoder* d, png_uint_32* width, png_uint_32* height,
+                     png_byte* channels) {
+    if (d->size < QOI_HEADER_SIZE + QOI_END_SIZE || memcmp(d->data, "qoif", 4) != 0) return -3;
+    *width = qoi_read32(d->data + 4);
+    *height = qoi_read32(d->data + 8);
+    *channels = d->data[12];
+    if (*width == 0 || *height == 0 || *width > 16384 || *height > 16384 ||
+        (*channels != 3 && *channels != 4)) {
+        fprintf(stderr, "minui doesn't support QOI %ux%u channels %d\n",
+                *width, *height, *channels);
+        return -7;
+    }
+    d->pos = QOI_HEADER_SIZE;
+    d->size -= QOI_END_SIZE;
+    memset(d->index, 0, sizeof(d->index));
+    memset(d->px, 0, 3);
+    d->px[3] = 255;
+    d->run = 0;
+    return 0;
+}
+
+// Returns -1 if there is no QOI image of that name, so the caller can
+// look for a PNG, else as open_png().
+static int open_qoi(const char* name, QoiDecoder** qoi, png_uint_32* width,
+                    png_uint_32* height, png_byte* channels) {
+    char resPath[256];
+    QoiDecoder* d;
+    struct stat st;
+    int fd, result;
+
+    snprintf(resPath, sizeof(resPath)-1, "%s/%s.qoi", image_dir, name);
+    resPath[sizeof(resPath)-1] = '\0';
+    fd = open(resPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    d = calloc(1, sizeof(*d));
+    if (d == NULL || fstat(fd, &st) < 0 || (d->data = malloc(st.st_size)) == NULL) {
+        free(d);
+        close(fd);
+        return -8;
+    }
+    d->size = st.st_size;
+    if (read(fd, d->data, d->size) != (ssize_t)d->size) d->size = 0;
+    close(fd);
+
+    result = qoi_start(d, width, height, channels);
+    if (result < 0) {
+        free(d->data);
+        free(d);
+        return result;
+    }
+    *qoi = d;
+    return 0;
+}
+
+// Decode the next width pixels as 'channels' bytes each.  Returns -1
+// if the data runs out first.
+static int qoi_read_row(QoiDecoder* d, unsigned char* row, int width, int channels) {
+    const unsigned char* in = d->data;
+    unsigned char* px = d->px;
+    int x = 0;
+
+    while (x < width) {
+        int b, n;
+
+        if (d->run == 0) {
+            if (d->pos >= d->size) return -1;
+            b = in[d->pos++];
+            if (b == QOI_OP_RGB || b == QOI_OP_RGBA) {
+                n = b == QOI_OP_RGB ? 3 : 4;
+                if (d->pos + n > d->size) return -1;
+                memcpy(px, in + d->pos, n);
+                d->pos += n;
+            } else if ((b & QOI_OP_MASK) == QOI_OP_INDEX) {
+                memcpy(px, d->index[b], 4);
+            } else if ((b & QOI_OP_MASK) == QOI_OP_DIFF) {
+                px[0] += ((b >> 4) & 3) - 2;
+                px[1] += ((b >> 2) & 3) - 2;
+                px[2] += (b & 3) - 2;
+            } else if ((b & QOI_OP_MASK) == QOI_OP_LUMA) {
+                int dg, rb;
+                if (d->pos >= d->size) return -1;
+                dg = (b & 0x3f) - 32;
+                rb = in[d->pos++];
+                px[0] += dg - 8 + (rb >> 4);
+                px[1] += dg;
+                px[2] += dg - 8 + (rb & 0x0f);
+            } else {
+                d->run = (b & 0x3f) + 1;
+            }
+            memcpy(d->index[QOI_HASH(px)], px, 4);
+            if (d->run == 0) d->run = 1;
+        }
+
+        // Runs of one color, the black background above all, are
+        // written without going back to the byte stream.
+        n = width - x < d->run ? width - x : d->run;
+        d->run -= n;
+        if (channels == 4) {
+            uint32_t v;
+            memcpy(&v, px, 4);
+            for (; n > 0; --n, ++x)
+                memcpy(row + x * 4, &v, 4);
+        } else {
+            for (; n > 0; --n, ++x) {
+                row[x * 3] = px[0];
+                row[x * 3 + 1] = px[1];
+                row[x * 3 + 2] = px[2];
+            }
+        }
+    }
+    return 0;
+}
+
+static void close_qoi(QoiDecoder* qoi) {
+    if (qoi) free(qoi->data);
+    free(qoi);
+}
+
+// The rows of an image file, QOI if there is one, else PNG, or of a
+// frame of an animation.
+typedef struct {
+    png_structp png_ptr;
+    png_infop info_ptr;
+    QoiDecoder* qoi;
+    ResAnimation* anim;
+    png_uint_32 y;                  // next row of anim
+    png_uint_32 width, height;
+    png_byte channels;
+} ResImage;
+
+static int anim_read_row(ResAnimation* a, png_uint_32 y, unsigned char* row);
+
+static int open_image(const char* name, ResImage* image) {
+    int result;
+
+    memset(image, 0, sizeof(*image));
+    result = open_qoi(name, &image->qoi, &image->width, &image->height, &image->channels);
+    if (result != -1) return result;
+    return open_png(name, &image->png_ptr, &image->info_ptr, &image->width, &image->height,
+                    &image->channels);
+}
+
+// Read the next row, width * channels bytes.
+static int read_image_row(ResImage* image, unsigned char* row) {
+    if (image->anim) return anim_read_row(image->anim, image->y++, row);
+    if (image->qoi) return qoi_read_row(image->qoi, row, image->width, image->channels);
+    png_read_row(image->png_ptr, row, NULL);
+    return 0;
+}
+
+static void close_image(ResImage* image) {
+    close_qoi(image->qoi);
+    close_png(&image->png_ptr, &image->info_ptr);
+}
+
 // "display" surfaces are transformed into the framebuffer's required
-// pixel format (currently only RGBX is supported) at load time, so
+// pixel format (GR_PIXEL_BYTES, see graphics.h) at load time, so
 // gr_blit() can be nothing more than a memcpy() for each row.  The
-// next two functions are the only ones that know anything about the
-// framebuffer pixel format; they need to be modified if the
-// framebuffer format changes (but nothing else should).
+// next two functions are the only ones here that know anything about
+// the framebuffer pixel format.
 
 // Allocate and return a gr_surface sufficient for storing an image of
 // the indicated size in the framebuffer pixel format.
 static gr_surface init_display_surface(png_uint_32 width, png_uint_32 height) {
     gr_surface surface;
 
-    surface = malloc_surface(width * height * 4);
+    surface = malloc_surface(width * height * GR_PIXEL_BYTES);
     if (surface == NULL) return NULL;
 
     surface->width = width;
     surface->height = height;
-    surface->row_bytes = width * 4;
-    surface->pixel_bytes = 4;
+    surface->row_bytes = width * GR_PIXEL_BYTES;
+    surface->pixel_bytes = GR_PIXEL_BYTES;
 
     return surface;
 }
 
-// Copy 'input_row' to 'output_row', transforming it to the
-// framebuffer pixel format.  The input format depends on the value of
-// 'channels':
+// Expand 'row' to 32-bit RGBX in place.  The input format depends on
+// the value of 'channels':
 //
 //   1 - input is 8-bit grayscale
 //   3 - input is 24-bit RGB
 //   4 - input is 32-bit RGBA/RGBX
 //
-// 'width' is the number of pixels in the row.
-static void transform_rgb_to_draw(unsigned char* input_row,
-                                  unsigned char* output_row,
-                                  int channels, int width) {
+// 'width' is the number of pixels in the row.  'row' must have room
+// for width * 4 bytes; it is expanded last pixel first so nothing is
+// overwritten before it is read.
+static void expand_to_rgbx(unsigned char* row, int channels, int width) {
     int x;
-    unsigned char* ip = input_row;
-    unsigned char* op = output_row;
+    unsigned char* ip = row + width * channels;
+    unsigned char* op = row + width * 4;
 
     switch (channels) {
         case 1:
             // expand gray level to RGBX
             for (x = 0; x < width; ++x) {
-                *op++ = *ip;
-                *op++ = *ip;
-                *op++ = *ip;
-                *op++ = 0xff;
-                ip++;
+                --ip;
+                *--op = 0xff;
+                *--op = *ip;
+                *--op = *ip;
+                *--op = *ip;
             }
             break;
 
         case 3:
-            // expand RGBA to RGBX
+            // expand RGB to RGBX
             for (x = 0; x < width; ++x) {
-                *op++ = *ip++;
-                *op++ = *ip++;
-                *op++ = *ip++;
-                *op++ = 0xff;
+                *--op = 0xff;
+                *--op = *--ip;
+                *--op = *--ip;
+                *--op = *--ip;
             }
             break;
+    }
+}
 
-        case 4:
-            // copy RGBA to RGBX
-            memcpy(output_row, input_row, width*4);
-            break;
+// Copy 'input_row' to 'output_row', transforming it to the
+// framebuffer pixel format.  See expand_to_rgbx() for the input.
+static void transform_rgb_to_draw(unsigned char* input_row,
+                                  unsigned char* output_row,
+                                  int channels, int width) {
+    expand_to_rgbx(input_row, channels, width);
+    gr_span.convert(input_row, output_row, width);
+}
+
+// Premultiply the colors of an R, G, B, A row by its alpha, in place,
+// and save the alpha values to 'coverage' unless it is NULL.
+static void premultiply_row(unsigned char* rgba, unsigned char* coverage, int width) {
+    int x;
+
+    for (x = 0; x < width; ++x, rgba += 4) {
+        int a = rgba[3];
+        if (coverage) coverage[x] = a;
+        if (a < 255) {
+            rgba[0] = (rgba[0] * a + 127) / 255;
+            rgba[1] = (rgba[1] * a + 127) / 255;
+            rgba[2] = (rgba[2] * a + 127) / 255;
+        }
     }
 }
 
-int res_create_display_surface(const char* name, gr_surface* pSurface) {
+// Split a row of alpha values into runs of opaque and of partly
+// transparent pixels, leaving out transparent ones.  Stores them to
+// 'runs' unless it is NULL and returns how many there are.
+static int alpha_runs(const unsigned char* coverage, int width, GRAlphaRun* runs) {
+    int count = 0;
+    int x = 0;
+
+    while (x < width) {
+        int start = x;
+        int opaque = coverage[x] == 255;
+
+        if (coverage[x] == 0) {
+            ++x;
+            continue;
+        }
+        while (x < width && coverage[x] != 0 && (coverage[x] == 255) == opaque)
+            ++x;
+        if (runs) {
+            runs[count].x = start;
+            runs[count].n = x - start;
+            runs[count].opaque = opaque;
+        }
+        ++count;
+    }
+    return count;
+}
+
+GRSurfaceAlpha* gr_surface_alpha_create(const unsigned char* coverage, int stride,
+                                        int width, int height) {
+    GRSurfaceAlpha* alpha;
+    int count = 0;
+    int translucent = 0;
+    int x, y;
+
+    for (y = 0; y < height; ++y) {
+        const unsigned char* row = coverage + y * stride;
+        for (x = 0; x < width && !translucent; ++x)
+            translucent = row[x] != 255;
+        count += alpha_runs(row, width, NULL);
+    }
+    if (!translucent) return NULL;
+
+    alpha = malloc(sizeof(*alpha) + (height + 1) * sizeof(int) +
+                   count * sizeof(GRAlphaRun) + width * height);
+    if (alpha == NULL) return NULL;
+    alpha->row_runs = (int*)(alpha + 1);
+    alpha->runs = (GRAlphaRun*)(alpha->row_runs + height + 1);
+    alpha->coverage = (unsigned char*)(alpha->runs + count);
+
+    count = 0;
+    for (y = 0; y < height; ++y) {
+        const unsigned char* row = coverage + y * stride;
+        memcpy(alpha->coverage + y * width, row, width);
+        alpha->row_runs[y] = count;
+        count += alpha_runs(row, width, alpha->runs + count);
+    }
+    alpha->row_runs[height] = count;
+    return alpha;
+}
+
+// The GRSurfaceAlpha of a width x height surface turned by rotation.
+static GRSurfaceAlpha* rotate_surface_alpha(const GRSurfaceAlpha* alpha, int width,
+                                            int height, int rotation) {
+    GRSurfaceAlpha* result;
+    int quarter = rotation == FB_ROTATE_CW || rotation == FB_ROTATE_CCW;
+    int out_width = quarter ? height : width;
+    unsigned char* coverage = malloc(width * height);
+    int x, y;
+
+    if (coverage == NULL) return NULL;
+    for (y = 0; y < height; ++y) {
+        const unsigned char* row = alpha->coverage + y * width;
+        for (x = 0; x < width; ++x) {
+            int ox = x, oy = y;
+            switch (rotation) {
+                case FB_ROTATE_CW:  ox = height - 1 - y; oy = x;             break;
+                case FB_ROTATE_CCW: ox = y;              oy = width - 1 - x; break;
+                case FB_ROTATE_UD:  ox = width - 1 - x;  oy = height - 1 - y; break;
+            }
+            coverage[oy * out_width + ox] = row[x];
+        }
+    }
+    result = gr_surface_alpha_create(coverage, out_width, out_width,
+                                  quarter ? width : height);
+    free(coverage);
+    return result;
+}
+
+// Make a display surface of the rows of image, shrunk to scale_num /
+// scale_den of its size, or at full size if that is not smaller.
+static int decode_display_surface(ResImage* image, int scale_num, int scale_den,
+                                  gr_surface* pSurface) {
     gr_surface surface = NULL;
+    GRScaler* scaler = NULL;
     int result = 0;
-    png_structp png_ptr = NULL;
-    png_infop info_ptr = NULL;
-    png_uint_32 width, height;
-    png_byte channels;
+    png_uint_32 width = image->width, height = image->height;
+    png_byte channels = image->channels;
 
     *pSurface = NULL;
 
-    result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
-    if (result < 0) return result;
+    int out_width = width, out_height = height;
+    if (scale_num < scale_den) {
+        out_width = (width * scale_num + scale_den / 2) / scale_den;
+        out_height = (height * scale_num + scale_den / 2) / scale_den;
+        if (out_width < 1) out_width = 1;
+        if (out_height < 1) out_height = 1;
+    }
+    if (out_width < (int)width || out_height < (int)height) {
+        scaler = gr_scaler_create(width, height, out_width, out_height);
+        if (scaler == NULL) {
+            result = -8;
+            goto exit;
+        }
+    }
 
-    surface = init_display_surface(width, height);
+    surface = init_display_surface(out_width, out_height);
     if (surface == NULL) {
         result = -8;
         goto exit;
     }
 
+    // Without memory for the alpha values the image is drawn opaque.
+    unsigned char* coverage = channels == 4 ? malloc(out_width * out_height) : NULL;
     unsigned char* p_row = malloc(width * 4);
     unsigned int y;
+    int out_y = 0, x;
     for (y = 0; y < height; ++y) {
-        png_read_row(png_ptr, p_row, NULL);
-        transform_rgb_to_draw(p_row, surface->data + y * surface->row_bytes, channels, width);
+        if (read_image_row(image, p_row) < 0) {
+            result = -6;
+            break;
+        }
+        expand_to_rgbx(p_row, channels, width);
+        if (channels == 4) premultiply_row(p_row, NULL, width);
+
+        const unsigned char* row = scaler ? gr_scaler_push(scaler, p_row) : p_row;
+        if (row == NULL) continue;
+        if (coverage) {
+            for (x = 0; x < out_width; ++x)
+                coverage[out_y * out_width + x] = row[x * 4 + 3];
+        }
+        gr_span.convert(row, surface->data + out_y * surface->row_bytes, out_width);
+        ++out_y;
     }
     free(p_row);
+    if (result < 0) {
+        free(coverage);
+        goto exit;
+    }
+    if (coverage) {
+        surface->alpha = gr_surface_alpha_create(coverage, out_width, out_width, out_height);
+        free(coverage);
+    }
 
     *pSurface = surface;
 
   exit:
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    gr_scaler_destroy(scaler);
     if (result < 0 && surface != NULL) free(surface);
     return result;
 }
 
+static int load_display_surface(const char* name, int scale_num, int scale_den,
+                                gr_surface* pSurface) {
+    ResImage image;
+    int result = open_image(name, &image);
+
+    *pSurface = NULL;
+    if (result < 0) return result;
+    result = decode_display_surface(&image, scale_num, scale_den, pSurface);
+    close_image(&image);
+    return result;
+}
+
+// Scales that do not shrink all load the image at full size.
+static void normalize_scale(int* scale_num, int* scale_den) {
+    if (*scale_num >= *scale_den || *scale_num <= 0) *scale_num = *scale_den = 1;
+}
+
+// The bundle, mapped once and never unmapped: surfaces taken from it
+// point into the mapping, and pages are read in as they are drawn.
+static pthread_once_t bundle_once = PTHREAD_ONCE_INIT;
+static const unsigned char* bundle;
+static size_t bundle_size;
+static const ResBundleEntry* bundle_index;
+static uint32_t bundle_count;
+
+// Map the bundle at path, if it is one for this build.
+static int bundle_map(const char* path) {
+    const ResBundleHeader* header;
+    struct stat st;
+    void* map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ResBundleHeader)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    header = map;
+    if (header->magic != RES_BUNDLE_MAGIC || header->version != RES_BUNDLE_VERSION ||
+        header->format != RES_BUNDLE_FORMAT ||
+        header->count > (st.st_size - sizeof(*header)) / sizeof(ResBundleEntry)) {
+        printf("%s: not a bundle for this build\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    bundle = map;
+    bundle_size = st.st_size;
+    bundle_index = (const ResBundleEntry*)(header + 1);
+    bundle_count = header->count;
+    return 0;
+}
+
+static void bundle_open(void) {
+    bundle_map(RES_BUNDLE_PATH);
+}
+
+int res_set_bundle(const char* path) {
+    // Past this, bundle_open() will not map the default one over it.
+    pthread_once(&bundle_once, bundle_open);
+    if (bundle) munmap((void*)bundle, bundle_size);
+    bundle = NULL;
+    bundle_size = 0;
+    bundle_index = NULL;
+    bundle_count = 0;
+    return path ? bundle_map(path) : 0;
+}
+
+// Whether size bytes at offset are inside the bundle and aligned.
+static int bundle_has(uint64_t offset, uint64_t size) {
+    return offset % RES_BUNDLE_ALIGN == 0 && offset <= bundle_size &&
+           size <= bundle_size - offset;
+}
+
+// Whether everything gr_blit() and gr_blit_blend() will trust in e is
+// inside the bundle and consistent, so a stale or damaged bundle falls
+// back to decoding the image.
+static int bundle_entry_valid(const ResBundleEntry* e) {
+    const int32_t* row_runs;
+    const GRAlphaRun* runs;
+    uint32_t y;
+    int32_t k;
+
+    if (e->width == 0 || e->height == 0 || e->width > 65535 || e->height > 65535 ||
+        e->row_bytes != (uint64_t)e->width * GR_PIXEL_BYTES ||
+        !bundle_has(e->data, (uint64_t)e->height * e->row_bytes)) {
+        return 0;
+    }
+    if (e->coverage == 0) return 1;
+
+    if (!bundle_has(e->coverage, (uint64_t)e->width * e->height) ||
+        !bundle_has(e->row_runs, (uint64_t)(e->height + 1) * sizeof(int32_t))) {
+        return 0;
+    }
+    row_runs = (const int32_t*)(bundle + e->row_runs);
+    if (row_runs[0] < 0 || row_runs[e->height] < 0 ||
+        !bundle_has(e->runs, (uint64_t)row_runs[e->height] * sizeof(GRAlphaRun))) {
+        return 0;
+    }
+    runs = (const GRAlphaRun*)(bundle + e->runs);
+    for (y = 0; y < e->height; ++y) {
+        if (row_runs[y + 1] < row_runs[y] || row_runs[y + 1] > row_runs[e->height]) return 0;
+        for (k = row_runs[y]; k < row_runs[y + 1]; ++k) {
+            if ((uint32_t)runs[k].x + runs[k].n > e->width) return 0;
+        }
+    }
+    return 1;
+}
+
+// Make a surface of the bundle entry for the image, if there is one.
+// Only the GRSurface and GRSurfaceAlpha headers are allocated; the
+// pixels and alpha stay in the mapping.
+static int bundle_surface(const char* name, int scale_num, int scale_den, int rotation,
+                          gr_surface* pSurface) {
+    const ResBundleEntry* e = NULL;
+    gr_surface surface;
+    uint32_t i;
+
+    pthread_once(&bundle_once, bundle_open);
+    for (i = 0; i < bundle_count; ++i) {
+        e = &bundle_index[i];
+        if (e->rotation == rotation &&
+            (long)e->scale_num * scale_den == (long)scale_num * e->scale_den &&
+            strncmp(e->name, name, sizeof(e->name)) == 0)
+            break;
+    }
+    if (i == bundle_count || !bundle_entry_valid(e)) return -1;
+
+    surface = malloc_surface(0);
+    if (surface == NULL) return -8;
+    surface->width = e->width;
+    surface->height = e->height;
+    surface->row_bytes = e->row_bytes;
+    surface->pixel_bytes = GR_PIXEL_BYTES;
+    surface->data = (unsigned char*)bundle + e->data;
+    if (e->coverage) {
+        // Without memory for it the image is drawn opaque.
+        surface->alpha = malloc(sizeof(GRSurfaceAlpha));
+        if (surface->alpha) {
+            surface->alpha->coverage = (unsigned char*)bundle + e->coverage;
+            surface->alpha->row_runs = (int*)(bundle + e->row_runs);
+            surface->alpha->runs = (GRAlphaRun*)(bundle + e->runs);
+        }
+    }
+    *pSurface = surface;
+    return 0;
+}
+
+// Turn upright by rotation, which takes it over: it is freed, or turned
+// in place and returned.
+static int rotate_display_surface(gr_surface upright, int rotation, gr_surface* pSurface) {
+    gr_surface surface;
+
+    *pSurface = NULL;
+    switch (rotation) {
+        case FB_ROTATE_CW:
+        case FB_ROTATE_CCW:
+            surface = init_display_surface(upright->height, upright->width);
+            if (surface == NULL) {
+                res_free_surface(upright);
+                return -8;
+            }
+            if (upright->alpha) {
+                surface->alpha = rotate_surface_alpha(upright->alpha, upright->width,
+                                                      upright->height, rotation);
+            }
+            if (rotation == FB_ROTATE_CW) {
+                gr_rotate_cw(upright->data, upright->row_bytes, surface->data,
+                             surface->row_bytes, upright->width, upright->height);
+            } else {
+                gr_rotate_ccw(upright->data, upright->row_bytes, surface->data,
+                              surface->row_bytes, upright->width, upright->height);
+            }
+            res_free_surface(upright);
+            break;
+        case FB_ROTATE_UD:
+            gr_rotate_180_inplace(upright->data, upright->row_bytes,
+                                  upright->width, upright->height);
+            if (upright->alpha) {
+                GRSurfaceAlpha* alpha = rotate_surface_alpha(upright->alpha, upright->width,
+                                                             upright->height, rotation);
+                free(upright->alpha);
+                upright->alpha = alpha;
+            }
+            surface = upright;
+            break;
+        default:
+            surface = upright;
+            break;
+    }
+
+    *pSurface = surface;
+    return 0;
+}
+
+int res_create_display_surface(const char* name, gr_surface* pSurface) {
+    return res_create_scaled_display_surface(name, 1, 1, FB_ROTATE_UR, pSurface);
+}
+
+int res_create_rotated_display_surface(const char* name, int rotation,
+                                       gr_surface* pSurface) {
+    return res_create_scaled_display_surface(name, 1, 1, rotation, pSurface);
+}
+
+int res_create_scaled_display_surface(const char* name, int scale_num, int scale_den,
+                                      int rotation, gr_surface* pSurface) {
+    gr_surface upright = NULL;
+    int result;
+
+    *pSurface = NULL;
+    normalize_scale(&scale_num, &scale_den);
+    if (bundle_surface(name, scale_num, scale_den, rotation, pSurface) == 0) return 0;
+
+    result = load_display_surface(name, scale_num, scale_den, &upright);
+    if (result < 0) return result;
+    return rotate_display_surface(upright, rotation, pSurface);
+}
+
 int res_create_multi_display_surface(const char* name, int* frames, gr_surface** pSurface) {
     gr_surface* surface = NULL;
     int result = 0;
@@ -281,21 +854,31 @@ int res_create_multi_display_surface(const char* name, int* frames, gr_surface**
         }
     }
 
+    unsigned char* coverage = channels == 4 ? malloc(width * height) : NULL;
     unsigned char* p_row = malloc(width * 4);
     unsigned int y;
     for (y = 0; y < height; ++y) {
         png_read_row(png_ptr, p_row, NULL);
+        if (coverage) premultiply_row(p_row, coverage + y * width, width);
         int frame = y % *frames;
         unsigned char* out_row = surface[frame]->data +
             (y / *frames) * surface[frame]->row_bytes;
         transform_rgb_to_draw(p_row, out_row, channels, width);
     }
     free(p_row);
+    if (coverage) {
+        // Frame i is made of rows i, i + frames, i + 2 * frames, ...
+        for (i = 0; i < *frames; ++i) {
+            surface[i]->alpha = gr_surface_alpha_create(coverage + i * width, width * *frames,
+                                                     width, height / *frames);
+        }
+        free(coverage);
+    }
 
     *pSurface = (gr_surface*) surface;
 
 exit:
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    close_png(&png_ptr, &info_ptr);
 
     if (result < 0) {
         if (surface) {
@@ -308,6 +891,295 @@ exit:
     return result;
 }
 
+// Streaming animations.  The frame being decoded is kept as R, G, B, A
+// in 'canvas', but only within the union of the rectangles of the frames
+// that are not key frames (the box): everywhere else the image is that
+// of the last key frame, whose data is kept to decode again for each
+// surface.  Each frame is XORed into the canvas and then goes through
+// the same scaling, conversion and rotation as any other display
+// surface.  Only the frame shown and the one after it, decoded ahead,
+// exist as surfaces.  Frame data is read from the file as it is needed.
+
+struct ResAnimation {
+    int fd;
+    ResAnimHeader header;
+    ResAnimFrame* frames;
+    int scale_num, scale_den;
+    int rotation;
+    uint32_t box_x, box_y, box_w, box_h;
+    unsigned char* canvas;  // box_w * box_h * 4
+    int decoded;            // frame in canvas, -1 if none
+    QoiDecoder qoi;         // its data is the buffer frames are read to
+    size_t data_size;       // allocated for qoi.data
+    int key;                // key frame the canvas starts from, -1 if none
+    QoiDecoder key_qoi;     // with the data of that key frame
+    size_t key_size;        // allocated for key_qoi.data
+    unsigned char* row;
+    int loop_start;
+    int current;
+    gr_surface surface;
+    int ahead;              // frame in ahead_surface
+    gr_surface ahead_surface;
+};
+
+// Start decoding frame f from the size bytes at qoi->data.
+static int anim_start(const ResAnimFrame* f, QoiDecoder* qoi) {
+    png_uint_32 width, height;
+    png_byte channels;
+    int result;
+
+    qoi->size = f->size;
+    result = qoi_start(qoi, &width, &height, &channels);
+    if (result < 0) return result;
+    if (width != f->w || height != f->h || channels != 4) return -7;
+    return 0;
+}
+
+// XOR frame i into the canvas.
+static int anim_apply(ResAnimation* a, int i) {
+    const ResAnimFrame* f = &a->frames[i];
+    int key = f->flags & RES_ANIM_KEY;
+    QoiDecoder* qoi = key ? &a->key_qoi : &a->qoi;
+    size_t* allocated = key ? &a->key_size : &a->data_size;
+    uint32_t x0, x1, y;
+    int x, result;
+
+    a->decoded = -1;
+    if (key) {
+        memset(a->canvas, 0, a->box_w * a->box_h * 4);
+        a->key = -1;
+    }
+    if (f->size == 0) goto done;
+    if (f->size > *allocated) {
+        unsigned char* data = realloc(qoi->data, f->size);
+        if (data == NULL) return -8;
+        qoi->data = data;
+        *allocated = f->size;
+    }
+    if (pread(a->fd, qoi->data, f->size, f->offset) != (ssize_t)f->size) return -2;
+    result = anim_start(f, qoi);
+    if (result < 0) return result;
+
+    // Key frames may reach out of the box.
+    x0 = f->x > a->box_x ? f->x : a->box_x;
+    x1 = f->x + f->w < a->box_x + a->box_w ? f->x + f->w : a->box_x + a->box_w;
+    for (y = f->y; y < (uint32_t)f->y + f->h; ++y) {
+        unsigned char *dst, *src;
+        if (qoi_read_row(qoi, a->row, f->w, 4) < 0) return -6;
+        if (y < a->box_y || y - a->box_y >= a->box_h || x0 >= x1) continue;
+        dst = a->canvas + ((y - a->box_y) * a->box_w + x0 - a->box_x) * 4;
+        src = a->row + (x0 - f->x) * 4;
+        for (x = 0; x < (int)(x1 - x0) * 4; ++x)
+            dst[x] ^= src[x];
+    }
+  done:
+    if (key) a->key = i;
+    a->decoded = i;
+    return 0;
+}
+
+// Row y of the frame in the canvas: the key frame, decoded again, with
+// the box on top.
+static int anim_read_row(ResAnimation* a, png_uint_32 y, unsigned char* row) {
+    const ResAnimFrame* k = &a->frames[a->key];
+
+    memset(row, 0, a->header.width * 4);
+    if (k->size != 0 && y >= k->y && y - k->y < k->h &&
+        qoi_read_row(&a->key_qoi, row + k->x * 4, k->w, 4) < 0) {
+        return -6;
+    }
+    if (y >= a->box_y && y - a->box_y < a->box_h) {
+        memcpy(row + a->box_x * 4, a->canvas + (y - a->box_y) * a->box_w * 4,
+               a->box_w * 4);
+    }
+    return 0;
+}
+
+// Make a display surface of frame i.
+static int anim_render(ResAnimation* a, int i, gr_surface* pSurface) {
+    ResImage image;
+    gr_surface upright;
+    int first = i, k, result;
+
+    *pSurface = NULL;
+    // Decode on from the frame in the canvas if it comes before i,
+    // else from the key frame at or before i.
+    if (a->decoded != i) {
+        while (!(a->frames[first].flags & RES_ANIM_KEY) && first != a->decoded + 1)
+            --first;
+        for (k = first; k <= i; ++k) {
+            result = anim_apply(a, k);
+            if (result < 0) return result;
+        }
+    }
+
+    if (a->frames[a->key].size != 0) {
+        result = anim_start(&a->frames[a->key], &a->key_qoi);
+        if (result < 0) return result;
+    }
+    memset(&image, 0, sizeof(image));
+    image.anim = a;
+    image.width = a->header.width;
+    image.height = a->header.height;
+    image.channels = 4;
+    result = decode_display_surface(&image, a->scale_num, a->scale_den, &upright);
+    if (result < 0) return result;
+    return rotate_display_surface(upright, a->rotation, pSurface);
+}
+
+static int anim_following(const ResAnimation* a, int i) {
+    return i + 1 < (int)a->header.count ? i + 1 : a->loop_start;
+}
+
+// Decode the frame after the current one, unless that is done already.
+static void anim_decode_ahead(ResAnimation* a) {
+    int i = anim_following(a, a->current);
+
+    if (a->ahead_surface && a->ahead == i) return;
+    res_free_surface(a->ahead_surface);
+    a->ahead_surface = NULL;
+    if (anim_render(a, i, &a->ahead_surface) == 0) a->ahead = i;
+}
+
+int res_open_animation(const char* name, int scale_num, int scale_den, int rotation,
+                       ResAnimation** pAnim) {
+    char resPath[256];
+    ResAnimation* a;
+    size_t table;
+    uint32_t i, x1 = 0, y1 = 0;
+    int result;
+
+    *pAnim = NULL;
+    snprintf(resPath, sizeof(resPath)-1, "%s/%s.anim", image_dir, name);
+    resPath[sizeof(resPath)-1] = '\0';
+    a = calloc(1, sizeof(*a));
+    if (a == NULL) return -8;
+    a->fd = open(resPath, O_RDONLY | O_CLOEXEC);
+    if (a->fd < 0) {
+        free(a);
+        return -1;
+    }
+    a->decoded = -1;
+    a->key = -1;
+    a->ahead = -1;
+    normalize_scale(&scale_num, &scale_den);
+    a->scale_num = scale_num;
+    a->scale_den = scale_den;
+    a->rotation = rotation;
+
+    result = -3;
+    if (pread(a->fd, &a->header, sizeof(a->header), 0) != sizeof(a->header) ||
+        a->header.magic != RES_ANIM_MAGIC || a->header.version != RES_ANIM_VERSION ||
+        a->header.count == 0 || a->header.count > 65536 ||
+        a->header.width == 0 || a->header.width > 16384 ||
+        a->header.height == 0 || a->header.height > 16384) {
+        goto fail;
+    }
+    table = a->header.count * sizeof(ResAnimFrame);
+    a->frames = malloc(table);
+    a->row = malloc(a->header.width * 4);
+    if (a->frames == NULL || a->row == NULL) {
+        result = -8;
+        goto fail;
+    }
+    if (pread(a->fd, a->frames, table, sizeof(a->header)) != (ssize_t)table ||
+        !(a->frames[0].flags & RES_ANIM_KEY)) {
+        goto fail;
+    }
+    a->box_x = a->header.width;
+    a->box_y = a->header.height;
+    for (i = 0; i < a->header.count; ++i) {
+        const ResAnimFrame* f = &a->frames[i];
+        if ((uint32_t)f->x + f->w > a->header.width || (uint32_t)f->y + f->h > a->header.height ||
+            (f->size != 0 && (f->w == 0 || f->h == 0))) {
+            goto fail;
+        }
+        if (f->size == 0 || (f->flags & RES_ANIM_KEY)) continue;
+        if (f->x < a->box_x) a->box_x = f->x;
+        if (f->y < a->box_y) a->box_y = f->y;
+        if ((uint32_t)f->x + f->w > x1) x1 = f->x + f->w;
+        if ((uint32_t)f->y + f->h > y1) y1 = f->y + f->h;
+    }
+    // Only key frames: keep a pixel anyway.
+    if (a->box_x >= x1) {
+        a->box_x = a->box_y = 0;
+        x1 = y1 = 1;
+    }
+    a->box_w = x1 - a->box_x;
+    a->box_h = y1 - a->box_y;
+    a->canvas = malloc(a->box_w * a->box_h * 4);
+    if (a->canvas == NULL) {
+        result = -8;
+        goto fail;
+    }
+
+    result = anim_render(a, 0, &a->surface);
+    if (result < 0) goto fail;
+    anim_decode_ahead(a);
+    *pAnim = a;
+    return 0;
+
+  fail:
+    res_free_animation(a);
+    return result;
+}
+
+int res_animation_frames(ResAnimation* anim) {
+    return anim->header.count;
+}
+
+int res_animation_index(ResAnimation* anim) {
+    return anim->current;
+}
+
+gr_surface res_animation_surface(ResAnimation* anim) {
+    return anim->surface;
+}
+
+int res_animation_duration(ResAnimation* anim) {
+    return anim->frames[anim->current].duration_ms;
+}
+
+void res_animation_set_loop(ResAnimation* anim, int first) {
+    if (first < 0) first = 0;
+    if (first >= (int)anim->header.count) first = anim->header.count - 1;
+    anim->loop_start = first;
+}
+
+int res_animation_next(ResAnimation* anim) {
+    int i = anim_following(anim, anim->current);
+    gr_surface surface;
+    int result;
+
+    if (anim->ahead_surface && anim->ahead == i) {
+        surface = anim->ahead_surface;
+        anim->ahead_surface = NULL;
+    } else {
+        result = anim_render(anim, i, &surface);
+        if (result < 0) return result;
+    }
+    // The new surface is made before the old one is freed, so the two
+    // never share an address.
+    res_free_surface(anim->surface);
+    anim->surface = surface;
+    anim->current = i;
+    anim_decode_ahead(anim);
+    return 0;
+}
+
+void res_free_animation(ResAnimation* anim) {
+    if (anim == NULL) return;
+    if (anim->fd >= 0) close(anim->fd);
+    res_free_surface(anim->surface);
+    res_free_surface(anim->ahead_surface);
+    free(anim->frames);
+    free(anim->canvas);
+    free(anim->qoi.data);
+    free(anim->key_qoi.data);
+    free(anim->row);
+    free(anim);
+}
+
 int res_create_alpha_surface(const char* name, gr_surface* pSurface) {
     gr_surface surface = NULL;
     int result = 0;
@@ -346,7 +1218,7 @@ int res_create_alpha_surface(const char* name, gr_surface* pSurface) {
     *pSurface = surface;
 
   exit:
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    close_png(&png_ptr, &info_ptr);
     if (result < 0 && surface != NULL) free(surface);
     return result;
 }
@@ -438,11 +1310,325 @@ int res_create_localized_alpha_surface(const char* name,
 
 exit:
     if(row != NULL) free(row);
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    close_png(&png_ptr, &info_ptr);
     if (result < 0 && surface != NULL) free(surface);
     return result;
 }
 
 void res_free_surface(gr_surface surface) {
+    if (surface) free(surface->alpha);
     free(surface);
 }
+
+// Shared display surfaces.  Entries are kept in a list from most to
+// least recently used; there are a few dozen images at most, so a walk
+// of the list is as quick as any index would be.  An image that failed
+// to load is remembered too, with its error, so it is not looked for
+// again on every frame.
+
+typedef struct ResEntry {
+    struct ResEntry* prev;
+    struct ResEntry* next;
+    char* name;
+    int scale_num, scale_den;
+    int rotation;
+    int result;         // of loading it; surface is NULL if negative
+    gr_surface surface;
+    size_t bytes;
+    int refs;
+} ResEntry;
+
+// Decoding is CPU bound; past this, threads only add memory.
+#define RES_MAX_DECODE_THREADS 8
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static ResEntry* cache_head;
+static ResEntry* cache_tail;
+static size_t cache_budget;
+static ResCacheStats cache_stats;
+
+static size_t surface_bytes(gr_surface surface) {
+    size_t bytes;
+
+    if (surface == NULL) return 0;
+    bytes = sizeof(GRSurface) + surface->height * surface->row_bytes;
+    if (surface->alpha) {
+        bytes += sizeof(GRSurfaceAlpha) + (surface->height + 1) * sizeof(int) +
+                 surface->alpha->row_runs[surface->height] * sizeof(GRAlphaRun) +
+                 surface->width * surface->height;
+    }
+    return bytes;
+}
+
+static void cache_unlink(ResEntry* e) {
+    if (e->prev) e->prev->next = e->next; else cache_head = e->next;
+    if (e->next) e->next->prev = e->prev; else cache_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void cache_push_front(ResEntry* e) {
+    e->prev = NULL;
+    e->next = cache_head;
+    if (cache_head) cache_head->prev = e; else cache_tail = e;
+    cache_head = e;
+}
+
+static void cache_drop(ResEntry* e) {
+    cache_unlink(e);
+    cache_stats.bytes -= e->bytes;
+    cache_stats.entries--;
+    res_free_surface(e->surface);
+    free(e->name);
+    free(e);
+}
+
+// Free the least recently used entries nobody holds until the cache is
+// within its budget.
+static void cache_evict(void) {
+    ResEntry* e = cache_tail;
+
+    while (cache_budget && cache_stats.bytes > cache_budget && e) {
+        ResEntry* prev = e->prev;
+        if (e->refs == 0) {
+            cache_drop(e);
+            cache_stats.evictions++;
+        }
+        e = prev;
+    }
+}
+
+static ResEntry* cache_find(const char* name, int scale_num, int scale_den, int rotation) {
+    ResEntry* e;
+
+    for (e = cache_head; e; e = e->next) {
+        if (e->rotation == rotation &&
+            (long)e->scale_num * scale_den == (long)scale_num * e->scale_den &&
+            strcmp(e->name, name) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// Take a reference to e, now the most recently used.
+static gr_surface cache_use(ResEntry* e) {
+    cache_unlink(e);
+    cache_push_front(e);
+    if (e->surface) e->refs++;
+    return e->surface;
+}
+
+// Add a freshly loaded image.  Returns NULL, having freed the surface,
+// if there is no memory for the entry.
+static ResEntry* cache_insert(const char* name, int scale_num, int scale_den,
+                              int rotation, int result, gr_surface surface) {
+    ResEntry* e = calloc(1, sizeof(*e));
+
+    if (e) e->name = strdup(name);
+    if (e == NULL || e->name == NULL) {
+        free(e);
+        res_free_surface(surface);
+        return NULL;
+    }
+    e->scale_num = scale_num;
+    e->scale_den = scale_den;
+    e->rotation = rotation;
+    e->result = result;
+    e->surface = surface;
+    e->bytes = surface_bytes(surface);
+    cache_stats.bytes += e->bytes;
+    cache_stats.entries++;
+    cache_push_front(e);
+    return e;
+}
+
+int res_acquire_display_surface(const char* name, int scale_num, int scale_den,
+                                int rotation, gr_surface* pSurface) {
+    ResRequest request = { name, scale_num, scale_den, rotation, pSurface, 0 };
+
+    return res_acquire_display_surfaces(&request, 1);
+}
+
+// Images of one res_acquire_display_surfaces() call that are not cached.
+// Each is decoded once, however many requests name it.
+typedef struct {
+    ResRequest* request;    // the first request for it
+    gr_surface surface;
+    int result;
+    ResEntry* entry;        // where it ended up in the cache
+} ResDecode;
+
+typedef struct {
+    ResDecode* decodes;
+    int count;
+    atomic_int next;
+} ResDecodeQueue;
+
+static void* decode_worker(void* arg) {
+    ResDecodeQueue* q = arg;
+    int i;
+
+    while ((i = atomic_fetch_add(&q->next, 1)) < q->count) {
+        ResDecode* d = &q->decodes[i];
+        d->result = res_create_scaled_display_surface(d->request->name,
+                                                      d->request->scale_num,
+                                                      d->request->scale_den,
+                                                      d->request->rotation, &d->surface);
+    }
+    return NULL;
+}
+
+// Decode the queue on the calling thread and up to one more thread per
+// other online core.  A thread that cannot be started just leaves more
+// work for the rest.
+static void decode_parallel(ResDecodeQueue* q) {
+    pthread_t threads[RES_MAX_DECODE_THREADS];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int started = 0;
+    int i;
+
+    if (cores > RES_MAX_DECODE_THREADS) cores = RES_MAX_DECODE_THREADS;
+    if (cores > q->count) cores = q->count;
+    for (i = 1; i < cores; ++i) {
+        if (pthread_create(&threads[started], NULL, decode_worker, q) == 0) ++started;
+    }
+    decode_worker(q);
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+int res_acquire_display_surfaces(ResRequest* requests, int count) {
+    ResDecodeQueue q;
+    int* decode_of = malloc(count * sizeof(int));   // -1 if cached
+    int result = 0;
+    int i, j;
+
+    q.decodes = malloc(count * sizeof(ResDecode));
+    q.count = 0;
+    atomic_init(&q.next, 0);
+    if (decode_of == NULL || q.decodes == NULL) {
+        free(decode_of);
+        free(q.decodes);
+        for (i = 0; i < count; ++i) {
+            *requests[i].surface = NULL;
+            requests[i].result = -8;
+        }
+        return -8;
+    }
+
+    // Hits take their reference at once; each distinct miss is queued.
+    pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < count; ++i) {
+        ResRequest* r = &requests[i];
+        ResEntry* e;
+
+        normalize_scale(&r->scale_num, &r->scale_den);
+        e = cache_find(r->name, r->scale_num, r->scale_den, r->rotation);
+        decode_of[i] = -1;
+        if (e) {
+            cache_stats.hits++;
+            *r->surface = cache_use(e);
+            r->result = e->result;
+            continue;
+        }
+        for (j = 0; j < q.count; ++j) {
+            ResRequest* o = q.decodes[j].request;
+            if (o->rotation == r->rotation &&
+                (long)o->scale_num * r->scale_den == (long)r->scale_num * o->scale_den &&
+                strcmp(o->name, r->name) == 0)
+                break;
+        }
+        if (j == q.count) {
+            q.decodes[j].request = r;
+            q.decodes[j].surface = NULL;
+            q.count++;
+        }
+        decode_of[i] = j;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    // Decode without the lock, so drawing threads using the cache are
+    // not held up.
+    if (q.count > 0) decode_parallel(&q);
+
+    // Publish everything together.  Another caller may have loaded the
+    // same image meanwhile; theirs wins.
+    pthread_mutex_lock(&cache_lock);
+    for (j = 0; j < q.count; ++j) {
+        ResDecode* d = &q.decodes[j];
+        ResRequest* r = d->request;
+
+        d->entry = cache_find(r->name, r->scale_num, r->scale_den, r->rotation);
+        if (d->entry) {
+            res_free_surface(d->surface);
+        } else {
+            d->entry = cache_insert(r->name, r->scale_num, r->scale_den, r->rotation,
+                                    d->result, d->surface);
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        ResRequest* r = &requests[i];
+        ResDecode* d;
+
+        if (decode_of[i] < 0) continue;
+        d = &q.decodes[decode_of[i]];
+        if (d->entry == NULL) {
+            *r->surface = NULL;
+            r->result = -8;
+            continue;
+        }
+        // The first request for an image is its miss, the rest are hits.
+        if (d->request == r) cache_stats.misses++; else cache_stats.hits++;
+        *r->surface = cache_use(d->entry);
+        r->result = d->entry->result;
+    }
+    for (i = 0; i < count; ++i) {
+        if (requests[i].result < 0 && result == 0) result = requests[i].result;
+    }
+    cache_evict();
+    pthread_mutex_unlock(&cache_lock);
+
+    free(decode_of);
+    free(q.decodes);
+    return result;
+}
+
+void res_release_surface(gr_surface surface) {
+    ResEntry* e;
+
+    if (surface == NULL) return;
+    pthread_mutex_lock(&cache_lock);
+    for (e = cache_head; e; e = e->next) {
+        if (e->surface == surface) {
+            if (e->refs > 0) e->refs--;
+            break;
+        }
+    }
+    cache_evict();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void res_cache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&cache_lock);
+    cache_budget = bytes;
+    cache_evict();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void res_cache_trim(void) {
+    ResEntry* e;
+
+    pthread_mutex_lock(&cache_lock);
+    e = cache_head;
+    while (e) {
+        ResEntry* next = e->next;
+        if (e->refs == 0) cache_drop(e);
+        e = next;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void res_cache_get_stats(ResCacheStats* stats) {
+    pthread_mutex_lock(&cache_lock);
+    *stats = cache_stats;
+    pthread_mutex_unlock(&cache_lock);
+}
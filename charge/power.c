@@ -57,6 +57,7 @@ int set_screen_state(int on) {
     if (screen_on_flag != on) {
 	gr_fb_blank(!on);
 	screen_on_flag = on;
+	battery_sampler_screen(on);
     }
     
     if (!on) 
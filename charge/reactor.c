@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2007 The Android Open Source Project
+ *
+ * Licensed under the Apache License,  Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,  software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,  either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Single-threaded event loop for the charge app.  The input devices,
+ * the power_supply uevent socket, the display flip events and three
+ * timerfds (animation frame, battery sampling, input deadline) are all
+ * waited on from one epoll set, so an idle charger with the screen off
+ * only wakes up when the kernel or a timer has something to say.
+ */
+
+#include <errno.h>
+#include <linux/input.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/reboot.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "battery.h"
+#include "frame_clock.h"
+#include "minui/minui.h"
+
+// charge_thread draws before input_thread turns the backlight on.
+#define BACKLIGHT_DELAY_MS 500
+
+extern int screen_on_flag;
+
+enum input_state {
+	INPUT_IDLE,		// screen off, no deadline
+	INPUT_POWERKEY_HELD,	// deadline: long press, reboot to charger
+	INPUT_BACKLIGHT_DELAY,	// deadline: turn the backlight on
+	INPUT_SCREEN_ON,	// deadline: idle timeout, screen off
+};
+
+static struct frame_clock frame_clock = { .fd = -1 };
+static int sample_fd = -1;
+static int input_fd = -1;
+static int sample_armed_ms;
+static enum input_state input_state = INPUT_SCREEN_ON;
+
+static int timer_arm(int fd, int ms, int period_ms) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	its.it_interval.tv_sec = period_ms / 1000;
+	its.it_interval.tv_nsec = (period_ms % 1000) * 1000000L;
+	return timerfd_settime(fd, 0, &its, NULL);
+}
+
+static void timer_disarm(int fd) {
+	timer_arm(fd, 0, 0);
+}
+
+// Drain the expiration count, returns 0 for a spurious wakeup.
+static uint64_t timer_read(int fd) {
+	uint64_t expirations = 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return 0;
+	return expirations;
+}
+
+static void reboot_to(const char *reason) {
+	is_exit = 1;
+	syscall(__NR_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2,
+		LINUX_REBOOT_CMD_RESTART2, reason);
+	LOGD(" %s: %d,  reboot %s failed\n",  __func__,  __LINE__, reason);
+}
+
+static void input_deadline(enum input_state state, int ms) {
+	input_state = state;
+	if (state == INPUT_IDLE)
+		timer_disarm(input_fd);
+	else
+		timer_arm(input_fd, ms, 0);
+}
+
+static void power_check(void) {
+	if (charge_plugged_out()) {
+		LOGE("charger not present,  power off device\n");
+		thread_st = POWER_THREAD_EXIT_PLUGOUT;
+		is_exit = 1;
+		reboot(RB_POWER_OFF);
+	} else {
+		thread_st = POWER_THREAD_OK;
+	}
+}
+
+// With the screen on the frame timer draws, otherwise refresh the LED
+// and health state here.
+static void battery_changed(void) {
+	struct battery_snapshot snap;
+
+	power_check();
+	if (!is_exit && screen_on_flag != 1)
+		charge_ui_update(&snap);
+}
+
+static int frame_cb(int fd, uint32_t epevents, void *data) {
+	struct battery_snapshot snap;
+
+	if (frame_clock_consume(&frame_clock) == 0)
+		return 0;
+	if (charge_ui_update(&snap) < 0)
+		thread_st = CHARGE_THREAD_EXIT_ERROR;
+	else
+		thread_st = CHARGE_THREAD_OK;
+	return 0;
+}
+
+static int sample_cb(int fd, uint32_t epevents, void *data) {
+	if (timer_read(fd) == 0)
+		return 0;
+	battery_snapshot_update();
+	battery_changed();
+	sample_armed_ms = 0;
+	return 0;
+}
+
+static int uevent_cb(int fd, uint32_t epevents, void *data) {
+	if (battery_uevent_handle() > 0)
+		battery_changed();
+	return 0;
+}
+
+static int fb_cb(int fd, uint32_t epevents, void *data) {
+	gr_fb_handle_event();
+	return 0;
+}
+
+static int input_timer_cb(int fd, uint32_t epevents, void *data) {
+	if (timer_read(fd) == 0)
+		return 0;
+
+	switch (input_state) {
+	case INPUT_POWERKEY_HELD:
+		thread_st = INPUT_THREAD_POWERKEY_TIMEOUT;
+		reboot_to("charger");
+		break;
+	case INPUT_BACKLIGHT_DELAY:
+		backlight_on();
+		input_deadline(INPUT_SCREEN_ON, BACKLIGHT_ON_MS);
+		break;
+	case INPUT_SCREEN_ON:
+		thread_st = INPUT_THREAD_TIMEOUT;
+		backlight_off();
+		set_screen_state(0);
+		input_deadline(INPUT_IDLE, 0);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int input_cb(int fd, uint32_t epevents, void *data) {
+	struct input_event ev;
+
+	if (ev_get_input(fd, epevents, &ev) < 0)
+		return -1;
+	LOGD(" %s: %d,  ev.type:%d,  ev.code:%d,  ev.value:%d  state:%d\n",  __func__,  \
+				__LINE__,  ev.type,  ev.code,  ev.value,  input_state);
+
+	if (ev.code == KEY_POWER) {
+		if (ev.value != 0 && input_state != INPUT_POWERKEY_HELD) {
+			thread_st = INPUT_THREAD_POWERKEY_DOWN;
+			set_screen_state(1);
+			input_deadline(INPUT_POWERKEY_HELD, POWER_KEY_TIMEOUT_MS);
+		} else if (ev.value == 0 && input_state == INPUT_POWERKEY_HELD) {
+			thread_st = INPUT_THREAD_POWERKEY_UP;
+			input_deadline(INPUT_BACKLIGHT_DELAY, BACKLIGHT_DELAY_MS);
+		}
+	} else if (ev.code == KEY_BRL_DOT8) { /* alarm event happen */
+		thread_st = INPUT_THREAD_ALARM;
+		if (alarm_flag_check()) {
+			set_screen_state(1);
+			reboot_to("alarm");
+		} else {
+			backlight_off();
+			set_screen_state(0);
+			input_deadline(INPUT_IDLE, 0);
+		}
+	}
+	return 0;
+}
+
+// The frame clock only runs while the screen is on.
+static void frame_timer_sync(void) {
+	int on = screen_on_flag == 1;
+
+	if (on == frame_clock.running)
+		return;
+	if (on)
+		frame_clock_start(&frame_clock);
+	else
+		frame_clock_stop(&frame_clock);
+}
+
+// Re-arm the sampling timer whenever the sampler picks a new interval,
+// e.g. after a change or a screen state switch.
+static void sample_timer_sync(void) {
+	int ms = battery_sample_interval();
+
+	if (ms == sample_armed_ms)
+		return;
+	timer_arm(sample_fd, ms, 0);
+	sample_armed_ms = ms;
+}
+
+static void reactor_close(void) {
+	frame_clock_exit(&frame_clock);
+	if (sample_fd >= 0)
+		close(sample_fd);
+	if (input_fd >= 0)
+		close(input_fd);
+	sample_fd = input_fd = -1;
+}
+
+int charge_reactor_run(void) {
+	int fd;
+
+	frame_clock_init(&frame_clock, frame_clock_fps());
+	sample_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	input_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (frame_clock.fd < 0 || sample_fd < 0 || input_fd < 0) {
+		LOGE("timerfd_create failed errno=%d(%s)\n", errno, strerror(errno));
+		reactor_close();
+		return -1;
+	}
+	if (ev_add_fd(frame_clock.fd, frame_cb, NULL) < 0 ||
+	    ev_add_fd(sample_fd, sample_cb, NULL) < 0 ||
+	    ev_add_fd(input_fd, input_timer_cb, NULL) < 0 ||
+	    ev_add_input_fds(input_cb, NULL) < 0) {
+		LOGE("%s: epoll setup failed\n", __func__);
+		reactor_close();
+		return -1;
+	}
+	fd = battery_uevent_init();
+	if (fd >= 0)
+		ev_add_fd(fd, uevent_cb, NULL);
+	fd = gr_fb_event_fd();
+	if (fd >= 0)
+		ev_add_fd(fd, fb_cb, NULL);
+
+	input_deadline(INPUT_SCREEN_ON, BACKLIGHT_ON_MS);
+	power_check();
+
+	while (!is_exit) {
+		frame_timer_sync();
+		sample_timer_sync();
+		if (ev_wait(-1) == 0)
+			ev_dispatch();
+	}
+	LOGD("%s: %lu frames,  %lu missed\n",  __func__,  frame_clock.frames,  frame_clock.missed);
+	reactor_close();
+	return 0;
+}
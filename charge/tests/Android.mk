@@ -11,6 +11,11 @@ LOCAL_SRC_FILES := \
 	../log.c \
 	../ui.c \
 	../rtc.c \
+	../frame_clock.c \
+	../minui/graphics_rotate.c \
+	../minui/graphics_scale.c \
+	../minui/graphics_simd.c \
+	../minui/resources.c \
 	test.cpp
 
 LOCAL_C_INCLUDES += external/libpng \
@@ -42,6 +47,49 @@ LOCAL_SHARED_LIBRARIES += libhardware_legacy libbase libc libcutils
 LOCAL_PROPRIETARY_MODULE := true
 include $(BUILD_NATIVE_TEST)
 
+# The drawing primitives on the real minui, into a framebuffer in memory.
+# mock.c stands in for them above, so they get a binary of their own.
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := \
+	../log.c \
+	../minui/graphics.c \
+	../minui/graphics_drm.c \
+	../minui/graphics_fbdev.c \
+	../minui/graphics_simd.c \
+	../minui/graphics_rotate.c \
+	../minui/graphics_scale.c \
+	../minui/graphics_ring.c \
+	../minui/resources.c \
+	minui_test.cpp
+
+LOCAL_C_INCLUDES += external/libpng \
+		external/zlib
+
+LOCAL_MODULE := charge_minui_test
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS := -Wall -Wno-unused-parameter
+LOCAL_CLANG := true
+
+# Same pixel format as libliteui, see ../minui/Android.mk.
+ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),BGRA_8888)
+  LOCAL_CFLAGS += -DRECOVERY_BGRA
+endif
+ifeq ($(subst ",,$(TARGET_RECOVERY_PIXEL_FORMAT)),RGB_565)
+  LOCAL_CFLAGS += -DRECOVERY_RGB565
+endif
+LOCAL_CFLAGS += -DDRM_BUFFER_COUNT=3 -DOVERSCAN_PERCENT=0
+
+LOCAL_SANITIZE := address
+LOCAL_CFLAGS += -DUTIT_TEST
+LOCAL_COMPATIBILITY_SUITE := units
+
+LOCAL_STATIC_LIBRARIES := libdrm libpng libz libgtest
+LOCAL_SHARED_LIBRARIES += libc libcutils
+
+LOCAL_PROPRIETARY_MODULE := true
+include $(BUILD_NATIVE_TEST)
+
 endif   # TARGET_ARCH == arm
 endif    # !TARGET_SIMULATOR
 
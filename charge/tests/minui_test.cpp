@@ -0,0 +1,419 @@
+#include <gtest/gtest.h>
+#include <linux/fb.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drmMode.h>
+#include "../minui/graphics.h"
+
+// power.c, which gr_flip() waits on, is not linked here.
+extern "C" {
+int adf_blank_done = 1;
+int flip_enter;
+}
+
+namespace {
+static uint32_t test_random(void) {
+	static uint32_t x = 2463534242u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// The panel the tests draw on, FB_W x FB_H pixels in memory, with room
+// for two pages.
+#define FB_W 48
+#define FB_H 16
+#define FB_ROW_BYTES (FB_W * GR_PIXEL_BYTES)
+#define FB_FRAME (FB_H * FB_ROW_BYTES)
+
+static unsigned char fb_mem[2 * FB_FRAME];
+
+static minui_backend* fb_backend(int pages) {
+	return open_fbdev_memory(fb_mem, pages * FB_FRAME, FB_W, FB_H, FB_ROW_BYTES);
+}
+
+// gr_init() on pages of fb_mem, drawing turned by rotation.
+static int fb_open(int rotation, int pages) {
+	return gr_init_backend(fb_backend(pages), rotation);
+}
+
+static GRSurface* test_surface(int width, int height) {
+	GRSurface* s = (GRSurface*)calloc(1, sizeof(GRSurface));
+	s->width = width;
+	s->height = height;
+	s->pixel_bytes = GR_PIXEL_BYTES;
+	s->row_bytes = width * GR_PIXEL_BYTES;
+	s->data = (unsigned char*)malloc(height * s->row_bytes);
+	return s;
+}
+
+static void free_surface(GRSurface* s) {
+	free(s->alpha);
+	free(s->data);
+	free(s);
+}
+
+#define BLEND_W 40
+#define BLEND_H 8
+
+// Premultiplied source whose first row is transparent, second opaque
+// and the rest random runs of transparent, opaque and partial alpha.
+static GRSurface* blend_surface(void) {
+	GRSurface* s = test_surface(BLEND_W, BLEND_H);
+	unsigned char coverage[BLEND_W * BLEND_H];
+
+	for (int y = 0; y < BLEND_H; y++) {
+		unsigned char* cov = coverage + y * BLEND_W;
+		for (int x = 0; x < BLEND_W;) {
+			int n = 1 + test_random() % 9;
+			uint32_t r = test_random();
+			unsigned char a = y == 0 || r % 3 == 0 ? 0 :
+					  y == 1 || r % 3 == 1 ? 255 : 1 + (r >> 8) % 254;
+			for (; n > 0 && x < BLEND_W; n--, x++)
+				cov[x] = a;
+		}
+		for (int x = 0; x < BLEND_W; x++) {
+			unsigned char* px = s->data + y * s->row_bytes + x * GR_PIXEL_BYTES;
+			for (int i = 0; i < GR_PIXEL_BYTES; i++)
+				px[i] = GR_PIXEL_BYTES == 4 && i < 3 ? test_random() % (cov[x] + 1) :
+					test_random();
+		}
+	}
+	s->alpha = gr_surface_alpha_create(coverage, BLEND_W, BLEND_W, BLEND_H);
+	return s;
+}
+
+// gr_blit_blend() one pixel at a time: transparent pixels are kept,
+// opaque ones copied and the rest composited by the C kernel.
+static void blend_reference(unsigned char* fb, int row_bytes, const GRSurface* s,
+			    int sx, int sy, int w, int h, int dx, int dy) {
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const unsigned char* a = s->alpha->coverage + (sy + y) * s->width + sx + x;
+			const unsigned char* src = s->data + (sy + y) * s->row_bytes +
+						   (sx + x) * GR_PIXEL_BYTES;
+			unsigned char* dst = fb + (dy + y) * row_bytes + (dx + x) * GR_PIXEL_BYTES;
+			if (*a == 255)
+				memcpy(dst, src, GR_PIXEL_BYTES);
+			else if (*a)
+				gr_span_c.over(src, a, dst, 1);
+		}
+	}
+}
+
+TEST(blit_blend, reference) {
+	static const int cases[][6] = {
+		// sx, sy, w, h, dx, dy
+		{ 0, 0, BLEND_W, BLEND_H, 0, 0 },
+		{ 3, 1, 29, 7, 5, 3 },
+		{ 13, 2, 1, 6, 20, 0 },
+		{ 9, 0, 31, BLEND_H, FB_W - 31, FB_H - BLEND_H },
+		{ 1, 3, 38, 5, 1, 1 },
+	};
+	unsigned char expected[FB_FRAME];
+	GRSurface* background = test_surface(FB_W, FB_H);
+	GRSurface* s = blend_surface();
+
+	ASSERT_EQ(0, fb_open(FB_ROTATE_UR, 1));
+	ASSERT_TRUE(s->alpha != NULL);
+	for (int i = 0; i < FB_FRAME; i++)
+		background->data[i] = test_random();
+
+	for (int round = 0; round < 100; round++) {
+		int sx, sy, w, h, dx, dy;
+		if (round < (int)(sizeof(cases) / sizeof(cases[0]))) {
+			sx = cases[round][0]; sy = cases[round][1];
+			w = cases[round][2]; h = cases[round][3];
+			dx = cases[round][4]; dy = cases[round][5];
+		} else {
+			// Clip edges anywhere, mostly inside a run.
+			sx = test_random() % BLEND_W;
+			w = 1 + test_random() % (BLEND_W - sx);
+			sy = test_random() % BLEND_H;
+			h = 1 + test_random() % (BLEND_H - sy);
+			dx = test_random() % (FB_W - w + 1);
+			dy = test_random() % (FB_H - h + 1);
+		}
+		gr_blit(background, 0, 0, FB_W, FB_H, 0, 0);
+		gr_blit_blend(s, sx, sy, w, h, dx, dy);
+		gr_flip();
+
+		memcpy(expected, background->data, sizeof(expected));
+		blend_reference(expected, FB_ROW_BYTES, s, sx, sy, w, h, dx, dy);
+		ASSERT_EQ(0, memcmp(expected, fb_mem, sizeof(expected)))
+			<< "sx " << sx << " sy " << sy << " w " << w << " h " << h
+			<< " at " << dx << "," << dy;
+	}
+
+	gr_exit();
+	free_surface(s);
+	free_surface(background);
+}
+
+// A frame filled with color, then rects of it (clipped) with color2,
+// as the C kernels draw them on a cleared frame.
+static void fill_reference(unsigned char* fb, uint32_t color, const GRRect* rects, int count,
+			   uint32_t color2) {
+	memset(fb, 0, FB_FRAME);
+	for (int y = 0; y < FB_H; y++)
+		gr_span_c.fill(fb + y * FB_ROW_BYTES, FB_W, color);
+	for (int i = 0; i < count; i++) {
+		int x0 = rects[i].x < 0 ? 0 : rects[i].x;
+		int y0 = rects[i].y < 0 ? 0 : rects[i].y;
+		int x1 = rects[i].x + rects[i].w > FB_W ? FB_W : rects[i].x + rects[i].w;
+		int y1 = rects[i].y + rects[i].h > FB_H ? FB_H : rects[i].y + rects[i].h;
+		for (int y = y0; y < y1; y++)
+			gr_span_c.fill(fb + y * FB_ROW_BYTES + x0 * GR_PIXEL_BYTES, x1 - x0, color2);
+	}
+}
+
+static const GRRect age_rects[] = {
+	{ 2, 3, 5, 4 },
+	{ -3, 10, 8, 20 },
+	{ FB_W - 4, 0, 10, 2 },
+};
+
+// A single-buffered fb draws in memory and copies the damage to the
+// framebuffer, so the buffer it draws in is always one frame old.
+TEST(buffer_age, single) {
+	unsigned char expected[FB_FRAME];
+	minui_backend* backend = fb_backend(1);
+
+	ASSERT_TRUE(backend->init(backend) != NULL);
+	EXPECT_EQ(0, backend->buffer_age(backend));
+	backend->exit(backend);
+
+	ASSERT_EQ(0, fb_open(FB_ROTATE_UR, 1));
+	EXPECT_EQ(1, gr_fb_buffer_age());
+	gr_color(10, 20, 30, 255);
+	gr_fill(0, 0, FB_W, FB_H);
+	gr_flip();
+	EXPECT_EQ(1, gr_fb_buffer_age());
+	fill_reference(expected, GR_COLOR(10, 20, 30, 255), NULL, 0, 0);
+	EXPECT_EQ(0, memcmp(expected, fb_mem, FB_FRAME));
+
+	// Only the damage reaches the framebuffer, clipped to it.
+	gr_color(200, 100, 50, 255);
+	gr_fill(0, 0, FB_W, FB_H);
+	gr_flip_damage(age_rects, 3);
+	EXPECT_EQ(1, gr_fb_buffer_age());
+	fill_reference(expected, GR_COLOR(10, 20, 30, 255), age_rects, 3,
+		       GR_COLOR(200, 100, 50, 255));
+	EXPECT_EQ(0, memcmp(expected, fb_mem, FB_FRAME));
+	gr_exit();
+}
+
+// A double-buffered fb flips whole pages, each drawn two frames ago
+// once both have been shown.
+TEST(buffer_age, double) {
+	unsigned char expected[FB_FRAME];
+	minui_backend* backend = fb_backend(2);
+
+	ASSERT_TRUE(backend->init(backend) != NULL);
+	EXPECT_EQ(0, backend->buffer_age(backend));
+	backend->flip(backend);
+	EXPECT_EQ(0, backend->buffer_age(backend));
+	backend->flip(backend);
+	EXPECT_EQ(2, backend->buffer_age(backend));
+	backend->flip_damage(backend, age_rects, 1);
+	EXPECT_EQ(2, backend->buffer_age(backend));
+	backend->exit(backend);
+
+	// gr_init() flipped twice, so page 1 is drawn next.
+	ASSERT_EQ(0, fb_open(FB_ROTATE_UR, 2));
+	EXPECT_EQ(2, gr_fb_buffer_age());
+	gr_color(200, 100, 50, 255);
+	gr_fill(0, 0, FB_W, FB_H);
+	gr_flip_damage(age_rects, 1);
+	EXPECT_EQ(2, gr_fb_buffer_age());
+	fill_reference(expected, GR_COLOR(200, 100, 50, 255), NULL, 0, 0);
+	EXPECT_EQ(0, memcmp(expected, fb_mem + FB_FRAME, FB_FRAME));
+	gr_exit();
+}
+
+// An opaque RGBA image as resources.c loads it, and the bytes each
+// pixel format puts on the panel for it.  In 4-byte formats the fourth
+// byte is padding, not compared.
+#define FORMAT_W 5
+static const unsigned char format_rgba[FORMAT_W * 4] = {
+	255, 0, 0, 255,  0, 255, 0, 255,  0, 0, 255, 255,  0x12, 0x34, 0x56, 255,
+	255, 255, 255, 255,
+};
+#if defined(RECOVERY_RGB565)
+static const unsigned char format_panel[FORMAT_W][GR_PIXEL_BYTES] = {
+	{ 0x00, 0xf8 }, { 0xe0, 0x07 }, { 0x1f, 0x00 }, { 0xaa, 0x11 }, { 0xff, 0xff },
+};
+#elif defined(RECOVERY_BGRA)
+static const unsigned char format_panel[FORMAT_W][GR_PIXEL_BYTES] = {
+	{ 0, 0, 255 }, { 0, 255, 0 }, { 255, 0, 0 }, { 0x56, 0x34, 0x12 }, { 255, 255, 255 },
+};
+#else
+static const unsigned char format_panel[FORMAT_W][GR_PIXEL_BYTES] = {
+	{ 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }, { 0x12, 0x34, 0x56 }, { 255, 255, 255 },
+};
+#endif
+
+static int write_format_png(const char* path) {
+	FILE* fp = fopen(path, "wb");
+	png_structp png;
+	png_infop info;
+
+	if (!fp)
+		return -1;
+	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png ? png_create_info_struct(png) : NULL;
+	if (!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(fp);
+		return -1;
+	}
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, FORMAT_W, 1, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+		     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	png_write_row(png, (png_bytep)format_rgba);
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return fclose(fp);
+}
+
+// The image, loaded, blitted and flipped to the fbdev, reaches it in
+// the pixel format minui was built for.
+TEST(pixel_format, fbdev) {
+	char dir[256], path[300];
+	const char* tmp = getenv("TMPDIR");
+	gr_surface s;
+
+	snprintf(dir, sizeof(dir), "%s/charge_format_XXXXXX", tmp ? tmp : "/data/local/tmp");
+	ASSERT_TRUE(mkdtemp(dir) != NULL);
+	snprintf(path, sizeof(path), "%s/format.png", dir);
+	ASSERT_EQ(0, write_format_png(path));
+	res_set_image_dir(dir);
+	ASSERT_EQ(0, res_create_display_surface("format", &s));
+	unlink(path);
+	rmdir(dir);
+	ASSERT_EQ(FORMAT_W, s->width);
+	ASSERT_EQ(GR_PIXEL_BYTES, s->pixel_bytes);
+
+	ASSERT_EQ(0, fb_open(FB_ROTATE_UR, 1));
+	gr_blit(s, 0, 0, FORMAT_W, 1, 3, 2);
+	gr_flip();
+	for (int x = 0; x < FORMAT_W; x++) {
+		const unsigned char* px = fb_mem + 2 * FB_ROW_BYTES + (3 + x) * GR_PIXEL_BYTES;
+		int n = GR_PIXEL_BYTES == 4 ? 3 : GR_PIXEL_BYTES;
+		EXPECT_EQ(0, memcmp(format_panel[x], px, n)) << "pixel " << x;
+	}
+	gr_exit();
+	res_free_surface(s);
+}
+
+// Where logical pixel (x, y) of a panel drawn turned by rotation is.
+static const unsigned char* panel_pixel(int rotation, int x, int y) {
+	int px = rotation == FB_ROTATE_CW ? FB_W - 1 - y :
+		 rotation == FB_ROTATE_CCW ? y :
+		 rotation == FB_ROTATE_UD ? FB_W - 1 - x : x;
+	int py = rotation == FB_ROTATE_CW ? x :
+		 rotation == FB_ROTATE_CCW ? FB_H - 1 - x :
+		 rotation == FB_ROTATE_UD ? FB_H - 1 - y : y;
+	return fb_mem + py * FB_ROW_BYTES + px * GR_PIXEL_BYTES;
+}
+
+// Fills, blits and alpha blits drawn turned land where the logical
+// frame, turned, puts them.
+TEST(rotation, mapped) {
+	static const int rotations[] = { FB_ROTATE_UR, FB_ROTATE_CW, FB_ROTATE_UD, FB_ROTATE_CCW };
+	unsigned char logical[FB_FRAME];
+	GRSurface* patch = test_surface(6, 5);
+	GRSurface* s = blend_surface();
+
+	for (int i = 0; i < 6 * 5 * GR_PIXEL_BYTES; i++)
+		patch->data[i] = test_random();
+
+	for (unsigned int r = 0; r < sizeof(rotations) / sizeof(rotations[0]); r++) {
+		int rotation = rotations[r];
+		int sideways = rotation == FB_ROTATE_CW || rotation == FB_ROTATE_CCW;
+		int lw = sideways ? FB_H : FB_W, lh = sideways ? FB_W : FB_H;
+		int row_bytes = lw * GR_PIXEL_BYTES;
+		GRSurface* background = test_surface(lw, lh);
+
+		ASSERT_EQ(0, fb_open(rotation, 1));
+		ASSERT_EQ(lw, gr_fb_width());
+		ASSERT_EQ(lh, gr_fb_height());
+		for (int i = 0; i < FB_FRAME; i++)
+			background->data[i] = test_random();
+		memcpy(logical, background->data, FB_FRAME);
+		gr_blit(background, 0, 0, lw, lh, 0, 0);
+
+		gr_color(10, 200, 30, 255);
+		gr_fill(3, 2, 9, 7);
+		for (int y = 2; y < 7; y++)
+			gr_span_c.fill(logical + y * row_bytes + 3 * GR_PIXEL_BYTES, 6,
+				       GR_COLOR(10, 200, 30, 255));
+
+		gr_blit(patch, 1, 1, 4, 3, 5, 6);
+		for (int y = 0; y < 3; y++)
+			memcpy(logical + (6 + y) * row_bytes + 5 * GR_PIXEL_BYTES,
+			       patch->data + (1 + y) * patch->row_bytes + GR_PIXEL_BYTES,
+			       4 * GR_PIXEL_BYTES);
+
+		gr_blit_blend(s, 2, 1, 12, 6, lw - 13, lh - 7);
+		blend_reference(logical, row_bytes, s, 2, 1, 12, 6, lw - 13, lh - 7);
+		gr_flip();
+
+		for (int y = 0; y < lh; y++)
+			for (int x = 0; x < lw; x++)
+				ASSERT_EQ(0, memcmp(logical + y * row_bytes + x * GR_PIXEL_BYTES,
+						    panel_pixel(rotation, x, y), GR_PIXEL_BYTES))
+					<< "rotation " << rotation << " at " << x << "," << y;
+		gr_exit();
+		free_surface(background);
+	}
+	free_surface(s);
+	free_surface(patch);
+}
+
+// The rotation property of a plane offering the given DRM_MODE_ROTATE_*
+// bit numbers, as drmModeGetProperty() would return it.
+static drmModePropertyRes* rotation_property(const int* bits, int count) {
+	static struct drm_mode_property_enum enums[8];
+	static drmModePropertyRes prop;
+
+	memset(&prop, 0, sizeof(prop));
+	for (int i = 0; i < count; i++) {
+		enums[i].value = bits[i];
+		snprintf(enums[i].name, sizeof(enums[i].name), "rotate-%d", 90 * bits[i]);
+	}
+	prop.flags = DRM_MODE_PROP_BITMASK;
+	prop.count_enums = count;
+	prop.enums = enums;
+	return &prop;
+}
+
+// DRM turns counter-clockwise, so clockwise is 270 there and
+// counter-clockwise 90, both with width and height swapped.
+TEST(drm_rotation, mapping) {
+	static const int all[] = { 0, 1, 2, 3, 4, 5 };
+	static const int flip_only[] = { 0, 2 };
+	drmModePropertyRes* prop = rotation_property(all, 6);
+	bool swap;
+
+	EXPECT_EQ((uint64_t)DRM_MODE_ROTATE_270, drm_rotation_bit(prop, FB_ROTATE_CW, &swap));
+	EXPECT_TRUE(swap);
+	EXPECT_EQ((uint64_t)DRM_MODE_ROTATE_90, drm_rotation_bit(prop, FB_ROTATE_CCW, &swap));
+	EXPECT_TRUE(swap);
+	EXPECT_EQ((uint64_t)DRM_MODE_ROTATE_180, drm_rotation_bit(prop, FB_ROTATE_UD, &swap));
+	EXPECT_FALSE(swap);
+	EXPECT_EQ(0U, drm_rotation_bit(prop, FB_ROTATE_UR, &swap));
+
+	// A plane that only turns upside down, and one without the property.
+	prop = rotation_property(flip_only, 2);
+	EXPECT_EQ(0U, drm_rotation_bit(prop, FB_ROTATE_CW, &swap));
+	EXPECT_EQ(0U, drm_rotation_bit(prop, FB_ROTATE_CCW, &swap));
+	EXPECT_EQ((uint64_t)DRM_MODE_ROTATE_180, drm_rotation_bit(prop, FB_ROTATE_UD, &swap));
+	EXPECT_EQ(0U, drm_rotation_bit(NULL, FB_ROTATE_UD, &swap));
+}
+}  // namespace
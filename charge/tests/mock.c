@@ -9,9 +9,57 @@
 #include <linux/input.h>
 #include <time.h>
 #include "../common.h"
-#include "../minui/minui.h"
+#include "../minui/graphics.h"
 #include "mock.h"
 
+// The fake display of mock_display_open(), NULL while there is none.
+#define MOCK_BUFFERS_MAX 3
+static unsigned char* mock_buffers[MOCK_BUFFERS_MAX];
+static unsigned char* mock_shown;
+static int mock_count, mock_ages, mock_back;
+// Frame number each buffer was last presented as, 0 if never.
+static unsigned long mock_frame, mock_drawn[MOCK_BUFFERS_MAX];
+static uint32_t mock_color;
+static unsigned char mock_alpha;
+
+static unsigned char* mock_pixel(int x, int y) {
+	return mock_buffers[mock_back] + (y * fb_width + x) * GR_PIXEL_BYTES;
+}
+
+static int mock_outside(int x, int y) {
+	return x < 0 || x >= fb_width || y < 0 || y >= fb_height;
+}
+
+void mock_display_open(int buffers, int ages) {
+	size_t size = fb_width * fb_height * GR_PIXEL_BYTES;
+	int i;
+
+	mock_display_close();
+	for (i = 0; i < buffers; i++)
+		mock_buffers[i] = (unsigned char*)calloc(1, size);
+	mock_shown = (unsigned char*)calloc(1, size);
+	mock_count = buffers;
+	mock_ages = ages;
+	mock_back = 0;
+	mock_frame = 0;
+	memset(mock_drawn, 0, sizeof(mock_drawn));
+}
+
+const unsigned char* mock_display_shown(void) {
+	return mock_shown;
+}
+
+void mock_display_close(void) {
+	int i;
+
+	for (i = 0; i < MOCK_BUFFERS_MAX; i++) {
+		free(mock_buffers[i]);
+		mock_buffers[i] = NULL;
+	}
+	free(mock_shown);
+	mock_shown = NULL;
+}
+
 void gr_fb_blank(bool blank) {
 	return;
 }
@@ -25,15 +73,56 @@ int gr_fb_height(void) {
 }
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
-	return;
+	mock_color = GR_COLOR(r, g, b, a);
+	mock_alpha = a;
 }
 
 void gr_fill(int x1, int y1, int x2, int y2) {
-	return;
+	int y;
+
+	if (!mock_shown || mock_outside(x1, y1) || mock_outside(x2 - 1, y2 - 1))
+		return;
+	for (y = y1; y < y2; y++) {
+		if (mock_alpha == 255)
+			gr_span_c.fill(mock_pixel(x1, y), x2 - x1, mock_color);
+		else if (mock_alpha)
+			gr_span_c.blend(mock_pixel(x1, y), x2 - x1, mock_color);
+	}
 }
 
 void gr_blit(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
-	return;
+	int y;
+
+	if (!mock_shown || !source || mock_outside(dx, dy) || mock_outside(dx + w - 1, dy + h - 1))
+		return;
+	for (y = 0; y < h; y++)
+		memcpy(mock_pixel(dx, dy + y),
+		       source->data + (sy + y) * source->row_bytes + sx * GR_PIXEL_BYTES,
+		       w * GR_PIXEL_BYTES);
+}
+
+// One pixel at a time, as a reference for the run-based blits.
+void gr_blit_blend(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
+	int x, y;
+
+	if (source && !source->alpha) {
+		gr_blit(source, sx, sy, w, h, dx, dy);
+		return;
+	}
+	if (!mock_shown || !source || mock_outside(dx, dy) || mock_outside(dx + w - 1, dy + h - 1))
+		return;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			const unsigned char* a = source->alpha->coverage +
+						 (sy + y) * source->width + sx + x;
+			const unsigned char* src = source->data + (sy + y) * source->row_bytes +
+						   (sx + x) * GR_PIXEL_BYTES;
+			if (*a == 255)
+				memcpy(mock_pixel(dx + x, dy + y), src, GR_PIXEL_BYTES);
+			else if (*a)
+				gr_span_c.over(src, a, mock_pixel(dx + x, dy + y), 1);
+		}
+	}
 }
 
 void gr_sync(void) {
@@ -41,15 +130,61 @@ void gr_sync(void) {
 }
 
 void gr_flip() {
-	return;
+	gr_flip_damage(NULL, 0);
+}
+
+// One buffer is copied to the display, damage only; more are flipped
+// in turn, whole.  Without ages the next buffer is scribbled over, as
+// its contents are unknown.
+void gr_flip_damage(const GRRect* rects, int count) {
+	int i, y;
+
+	if (!mock_shown)
+		return;
+	if (mock_count > 1 || !rects) {
+		memcpy(mock_shown, mock_buffers[mock_back], fb_width * fb_height * GR_PIXEL_BYTES);
+	} else {
+		for (i = 0; i < count; i++) {
+			for (y = rects[i].y; y < rects[i].y + rects[i].h; y++) {
+				size_t offset = (y * fb_width + rects[i].x) * GR_PIXEL_BYTES;
+				memcpy(mock_shown + offset, mock_buffers[mock_back] + offset,
+				       rects[i].w * GR_PIXEL_BYTES);
+			}
+		}
+	}
+	mock_drawn[mock_back] = ++mock_frame;
+	mock_back = (mock_back + 1) % mock_count;
+	if (!mock_ages)
+		memset(mock_buffers[mock_back], 0x5a, fb_width * fb_height * GR_PIXEL_BYTES);
+}
+
+int gr_fb_buffer_age(void) {
+	unsigned long drawn;
+
+	if (!mock_shown || !mock_ages)
+		return 0;
+	drawn = mock_drawn[mock_back];
+	return drawn ? (int)(mock_frame - drawn + 1) : 0;
 }
 
 int gr_init(void) {
 	return 1;
 }
 
-int res_create_display_surface(const char* name, gr_surface* pSurface) {
-	return 1;
+GRRing* gr_ring_create(int radius, int thickness, uint32_t track_rgb, uint32_t arc_rgb) {
+	return NULL;
+}
+
+void gr_ring_set(GRRing* ring, int value, int max) {
+	return;
+}
+
+gr_surface gr_ring_surface(GRRing* ring) {
+	return NULL;
+}
+
+void gr_ring_destroy(GRRing* ring) {
+	return;
 }
 
 int ev_get(struct input_event *ev, int wait_ms) {
@@ -67,11 +202,11 @@ int ev_init(void) {
 }
 
 unsigned int gr_get_width(GRSurface* surface){
-	return gr_width;
+	return surface ? surface->width : gr_width;
 }
 
 unsigned int gr_get_height(GRSurface* surface) {
-	return gr_height;
+	return surface ? surface->height : gr_height;
 }
 
 int ev_set(int value){
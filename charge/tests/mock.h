@@ -1,4 +1,5 @@
 #include <linux/input.h>
+#include "../minui/minui.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -15,6 +16,18 @@ int gr_height;
 int gr_width;
 int rotate;
 
+// Make the gr_* stubs draw into a fake display of 'buffers' (1 to 3)
+// fb_width x fb_height framebuffers, which gr_fb_buffer_age() reports
+// the ages of unless ages is 0.  The display shows what was flipped.
+void mock_display_open(int buffers, int ages);
+const unsigned char* mock_display_shown(void);
+void mock_display_close(void);
+
+// ui.c entry points for the tests, UTIT_TEST only.
+void ui_test_place(int id, gr_surface surface, int x, int y);
+void ui_test_present(void);
+void ui_test_invalidate(void);
+
 
 #ifdef __cplusplus
 }
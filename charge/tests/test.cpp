@@ -1,8 +1,21 @@
 #include <gtest/gtest.h>
 //#include <log/log.h>
+#include <dirent.h>
+#include <limits.h>
+#include <linux/fb.h>
+#include <png.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "../common.h"
 #include "mock.h"
+#include "../frame_clock.h"
+#include "../minui/graphics.h"
+#include "../minui/res_anim.h"
+#include "../minui/res_bundle.h"
 
 //power.c
 namespace {
@@ -36,25 +49,25 @@ TEST(ui_init, ut){
 	gr_width = 100;
 	ui_set_background();
 	set_gr_value(640,360);
-	EXPECT_EQ(1 ,ui_init());
+	EXPECT_EQ(0, ui_init());
 
 	set_gr_value(800,400);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 
 	set_gr_value(854,480);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 
 	set_gr_value(1280,720);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 
 	set_gr_value(1920,1020);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 
 	set_gr_value(2560,1440);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 
 	set_gr_value(3000,3000);
-	EXPECT_EQ(1,ui_init());
+	EXPECT_EQ(0,ui_init());
 }
 
 TEST(charge_thread, ut){
@@ -141,6 +154,1137 @@ TEST(battery, ut){
 	printf("battery_status = %d\n",battery_status());
 }
 
+TEST(battery_uevent, ut){
+	printf("POF-UTIT------------------battery_uevent_test\n");
+	EXPECT_EQ(0,battery_status_init());
+	EXPECT_LE(0,battery_uevent_init());
+	EXPECT_LE(0,battery_uevent_wait(0));
+	EXPECT_LE(0,battery_capacity());
+}
+
+TEST(battery_snapshot, ut){
+	struct battery_snapshot snap;
+	printf("POF-UTIT------------------battery_snapshot_test\n");
+	EXPECT_EQ(0,battery_status_init());
+	EXPECT_EQ(0,battery_snapshot_update());
+	EXPECT_EQ(0,battery_snapshot_get(&snap));
+	EXPECT_LT(0,snap.timestamp_ms);
+	EXPECT_EQ(battery_capacity(),snap.level);
+}
+
+TEST(battery_sampler, ut){
+	struct battery_sampler_stats stats;
+	printf("POF-UTIT------------------battery_sampler_test\n");
+	battery_sampler_screen(0);
+	battery_status_update();
+	battery_sampler_stats(&stats);
+	EXPECT_LE(BATTERY_SAMPLE_MIN_MS,stats.interval_ms);
+	EXPECT_GE(BATTERY_SAMPLE_MAX_MS,stats.interval_ms);
+	EXPECT_LT(0UL,stats.samples);
+	battery_sampler_screen(1);
+	EXPECT_EQ(BATTERY_SAMPLE_MIN_MS,battery_sample_interval());
+}
+
+TEST(frame_clock, ut){
+	struct frame_clock fc;
+	printf("POF-UTIT------------------frame_clock_test\n");
+	EXPECT_EQ(0,frame_clock_init(&fc,50));
+	EXPECT_EQ(20000000LL,fc.period_ns);
+	EXPECT_EQ(-1,frame_clock_wait(&fc));
+	EXPECT_EQ(0,frame_clock_start(&fc));
+	EXPECT_LE(1,frame_clock_wait(&fc));
+	usleep(70000);
+	EXPECT_LE(3,frame_clock_wait(&fc));
+	EXPECT_EQ(2UL,fc.frames);
+	EXPECT_LE(2UL,fc.missed);
+	frame_clock_stop(&fc);
+	EXPECT_EQ(-1,frame_clock_wait(&fc));
+	frame_clock_exit(&fc);
+}
+
+static long long elapsed_ns(const struct timespec *t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000000LL + (t1.tv_nsec - t0->tv_nsec);
+}
+
+// The per-flip rotation gr_flip() used before the tiled kernels:
+// a frame-sized malloc, a byte-wise column walk and a copy back.
+// Indexing bytes as pixels it only moves a quarter of the frame, so
+// its time is a lower bound for a correct column walk.
+static void rotate_90_legacy(unsigned char *data, unsigned int width, unsigned int height) {
+	unsigned long mem_size = (unsigned long)width * 4 * height;
+	unsigned char *dst_p = (unsigned char *)malloc(mem_size);
+	unsigned int i, j;
+
+	if (!dst_p)
+		return;
+	for (i = 0; i < height; i++)
+		for (j = 0; j < width; j++)
+			dst_p[i * width + j] = data[(width - j - 1) * height + i];
+	memcpy(data, dst_p, mem_size);
+	free(dst_p);
+}
+
+static void rotate_180_legacy(unsigned char *data, unsigned int width, unsigned int height) {
+	unsigned long mem_size = (unsigned long)width * 4 * height;
+	unsigned char *dst_p = (unsigned char *)malloc(mem_size);
+	unsigned int i, j;
+
+	if (!dst_p)
+		return;
+	for (j = 0; j < height; ++j)
+		for (i = 0; i < width * 4; i += 4)
+			memcpy(dst_p + mem_size - (j + 1) * width * 4 + (width * 4 - 4 - i),
+			       data + j * width * 4 + i, 4);
+	memcpy(data, dst_p, mem_size);
+	free(dst_p);
+}
+
+static const int rotate_sizes[][2] = {
+	{360, 640}, {480, 800}, {720, 1280}, {1080, 1920}, {1440, 2560},
+};
+
+TEST(rotate, ut){
+	printf("POF-UTIT------------------rotate_test\n");
+
+	for (unsigned int k = 0; k < sizeof(rotate_sizes) / sizeof(rotate_sizes[0]); k++) {
+		int w = rotate_sizes[k][0], h = rotate_sizes[k][1];
+		size_t size = (size_t)w * h * 4;
+		uint32_t *frame = (uint32_t *)malloc(size);
+		uint32_t *scratch = (uint32_t *)malloc(size);
+		ASSERT_TRUE(frame && scratch);
+
+		// An upright h x w frame rotated clockwise, then back.
+		for (int i = 0; i < w * h; i++)
+			scratch[i] = i;
+		gr_rotate_cw((unsigned char *)scratch, h * 4, (unsigned char *)frame, w * 4, h, w);
+		EXPECT_EQ((uint32_t)(w - 1) * h, frame[0]);
+		EXPECT_EQ(0U, frame[w - 1]);
+		gr_rotate_ccw((unsigned char *)frame, w * 4, (unsigned char *)scratch, h * 4, w, h);
+		int bad = 0;
+		for (int i = 0; i < w * h; i++)
+			bad += scratch[i] != (uint32_t)i;
+		EXPECT_EQ(0, bad);
+		gr_rotate_180_inplace((unsigned char *)scratch, h * 4, h, w);
+		EXPECT_EQ((uint32_t)(w * h - 1), scratch[0]);
+
+		free(frame);
+		free(scratch);
+	}
+}
+
+// Timing only, run with --gtest_also_run_disabled_tests.
+TEST(rotate, DISABLED_benchmark){
+	const int runs = 5;
+	struct timespec t0;
+	printf("POF-UTIT------------------rotate_benchmark\n");
+
+	for (unsigned int k = 0; k < sizeof(rotate_sizes) / sizeof(rotate_sizes[0]); k++) {
+		int w = rotate_sizes[k][0], h = rotate_sizes[k][1];
+		size_t size = (size_t)w * h * 4;
+		uint32_t *frame = (uint32_t *)malloc(size);
+		uint32_t *scratch = (uint32_t *)malloc(size);
+		long long legacy90 = 0, tiled90 = 0, legacy180 = 0, inplace180 = 0;
+		ASSERT_TRUE(frame && scratch);
+
+		for (int i = 0; i < w * h; i++)
+			frame[i] = i;
+		for (int r = 0; r < runs; r++) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			rotate_90_legacy((unsigned char *)frame, w, h);
+			legacy90 += elapsed_ns(&t0);
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			memcpy(scratch, frame, size);
+			gr_rotate_cw((unsigned char *)scratch, h * 4, (unsigned char *)frame, w * 4, h, w);
+			tiled90 += elapsed_ns(&t0);
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			rotate_180_legacy((unsigned char *)frame, w, h);
+			legacy180 += elapsed_ns(&t0);
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			gr_rotate_180_inplace((unsigned char *)frame, w * 4, w, h);
+			inplace180 += elapsed_ns(&t0);
+		}
+		printf("%dx%d: 90 legacy %lld us tiled %lld us, 180 legacy %lld us in place %lld us\n",
+		       w, h, legacy90 / runs / 1000, tiled90 / runs / 1000,
+		       legacy180 / runs / 1000, inplace180 / runs / 1000);
+
+		free(frame);
+		free(scratch);
+	}
+}
+
+// Deterministic test data, so a failure is reproducible.
+static uint32_t test_random(void) {
+	static uint32_t x = 2463534242u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// Mostly 0 and 255, the values the kernels special-case.
+static unsigned char test_alpha(void) {
+	uint32_t r = test_random();
+	switch (r % 4) {
+	case 0:
+		return 0;
+	case 1:
+		return 255;
+	default:
+		return r >> 8;
+	}
+}
+
+#define SPAN_MAX 67
+#define SPAN_SLACK 8
+
+TEST(span, reference){
+	unsigned char dst[(SPAN_MAX + 2 * SPAN_SLACK) * 4];
+	unsigned char out[sizeof(dst)], ref[sizeof(dst)];
+	unsigned char src[(SPAN_MAX + SPAN_SLACK) * 4], alpha[SPAN_MAX + SPAN_SLACK];
+	const char *kernels[] = { "fill", "blend", "text", "convert", "over" };
+	printf("POF-UTIT-------------------span_test\n");
+
+	// Every kernel gr_span_init() picks must give the bytes of the C
+	// reference, for any length and alignment, and leave the pixels
+	// around the span alone.
+	gr_span_init();
+	printf("%s kernels against %s\n", gr_span.name, gr_span_c.name);
+	for (int round = 0; round < 20; round++) {
+		for (int n = 0; n <= SPAN_MAX; n++) {
+			int off = test_random() % SPAN_SLACK, soff = test_random() % SPAN_SLACK;
+			uint32_t color = test_random();
+
+			if (round % 4 == 0)
+				color |= 0xff000000u;
+			else if (round % 4 == 1)
+				color &= 0x00ffffffu;
+			for (unsigned int i = 0; i < sizeof(dst); i++)
+				dst[i] = test_random();
+			// Premultiplied: no channel above its alpha.
+			for (unsigned int i = 0; i < sizeof(alpha); i++) {
+				alpha[i] = test_alpha();
+				for (int c = 0; c < 4; c++)
+					src[i * 4 + c] = test_random() % (alpha[i] + 1);
+			}
+
+			for (int k = 0; k < 5; k++) {
+				const gr_span_ops *ops[2] = { &gr_span, &gr_span_c };
+				unsigned char *rows[2] = { out, ref };
+				for (int j = 0; j < 2; j++) {
+					unsigned char *px = rows[j] + off * GR_PIXEL_BYTES;
+					memcpy(rows[j], dst, sizeof(dst));
+					switch (k) {
+					case 0: ops[j]->fill(px, n, color); break;
+					case 1: ops[j]->blend(px, n, color); break;
+					case 2: ops[j]->text(alpha + soff, px, n, color); break;
+					case 3: ops[j]->convert(src + soff * 4, px, n); break;
+					case 4: ops[j]->over(src + soff * 4, alpha + soff, px, n); break;
+					}
+				}
+				EXPECT_EQ(0, memcmp(out, ref, sizeof(dst)))
+					<< kernels[k] << " n " << n << " offset " << off;
+			}
+		}
+	}
+}
+
+// Images for the resources.c tests, written to a directory of their own,
+// empty until it is made.
+static char image_dir_path[256];
+
+static const char *image_dir(void) {
+	if (!image_dir_path[0]) {
+		const char *tmp = getenv("TMPDIR");
+		snprintf(image_dir_path, sizeof(image_dir_path), "%s/charge_test_XXXXXX",
+			 tmp ? tmp : "/data/local/tmp");
+		if (!mkdtemp(image_dir_path)) {
+			image_dir_path[0] = '\0';
+			return NULL;
+		}
+		res_set_image_dir(image_dir_path);
+	}
+	return image_dir_path;
+}
+
+// Removes image_dir() and the files the tests left in it after the run.
+class ImageDirEnvironment : public ::testing::Environment {
+public:
+	void TearDown() override {
+		char path[PATH_MAX];
+		struct dirent *de;
+		DIR *d;
+
+		if (!image_dir_path[0])
+			return;
+		d = opendir(image_dir_path);
+		if (d) {
+			while ((de = readdir(d)) != NULL) {
+				if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+					continue;
+				snprintf(path, sizeof(path), "%s/%s", image_dir_path, de->d_name);
+				unlink(path);
+			}
+			closedir(d);
+		}
+		rmdir(image_dir_path);
+		image_dir_path[0] = '\0';
+	}
+};
+
+static ::testing::Environment *const image_dir_env =
+	::testing::AddGlobalTestEnvironment(new ImageDirEnvironment);
+
+static int write_png(const char *name, const unsigned char *rgba, int w, int h) {
+	char path[320];
+	FILE *fp;
+	png_structp png;
+	png_infop info;
+
+	snprintf(path, sizeof(path), "%s/%s.png", image_dir(), name);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return -1;
+	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png ? png_create_info_struct(png) : NULL;
+	if (!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(fp);
+		return -1;
+	}
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+		     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for (int y = 0; y < h; y++)
+		png_write_row(png, (png_bytep)rgba + y * w * 4);
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return fclose(fp);
+}
+
+// Push every row of a w x h image, return the rows it completed.
+static int scale_image(GRScaler *s, const unsigned char *src, int w, int h, unsigned char *dst,
+		       int dst_w) {
+	int rows = 0;
+	for (int y = 0; y < h; y++) {
+		const unsigned char *row = gr_scaler_push(s, src + y * w * 4);
+		if (row)
+			memcpy(dst + rows++ * dst_w * 4, row, dst_w * 4);
+	}
+	return rows;
+}
+
+TEST(scale, half){
+	// Each output pixel is the mean of a 2x2 block, rounded half up.
+	static const unsigned char src[4 * 2 * 4] = {
+		10, 0, 200, 255,   20, 0, 200, 255,    0, 1, 7, 255,    0, 2, 7, 0,
+		30, 0, 200, 255,   41, 2, 200, 255,    0, 3, 7, 255,    0, 4, 7, 255,
+	};
+	static const unsigned char expect[2 * 1 * 4] = {
+		25, 1, 200, 255,   0, 3, 7, 191,
+	};
+	unsigned char dst[sizeof(expect)];
+	printf("POF-UTIT------------------scale_test\n");
+
+	EXPECT_TRUE(gr_scaler_create(4, 2, 5, 1) == NULL);
+	GRScaler *s = gr_scaler_create(4, 2, 2, 1);
+	ASSERT_TRUE(s != NULL);
+	EXPECT_EQ(1, scale_image(s, src, 4, 2, dst, 2));
+	EXPECT_EQ(0, memcmp(expect, dst, sizeof(expect)));
+	gr_scaler_destroy(s);
+}
+
+TEST(scale, two_thirds){
+	// 3 -> 2 along both axes: output pixel 0 is 2/3 of input 0 and 1/3
+	// of input 1, output 1 is 1/3 of input 1 and 2/3 of input 2.
+	// R varies across, G down, B is flat and A is opaque.
+	static const unsigned char v[3] = { 0, 255, 90 };
+	unsigned char src[3 * 3 * 4], dst[2 * 2 * 4];
+	static const unsigned char expect[2 * 2 * 4] = {
+		85, 85, 200, 255,   145, 85, 200, 255,
+		85, 145, 200, 255,  145, 145, 200, 255,
+	};
+
+	for (int y = 0; y < 3; y++)
+		for (int x = 0; x < 3; x++) {
+			unsigned char *p = src + (y * 3 + x) * 4;
+			p[0] = v[x];
+			p[1] = v[y];
+			p[2] = 200;
+			p[3] = 255;
+		}
+	GRScaler *s = gr_scaler_create(3, 3, 2, 2);
+	ASSERT_TRUE(s != NULL);
+	EXPECT_EQ(2, scale_image(s, src, 3, 3, dst, 2));
+	EXPECT_EQ(0, memcmp(expect, dst, sizeof(expect)));
+	gr_scaler_destroy(s);
+}
+
+TEST(scale, alpha_runs){
+	// 8x4 halved: the alpha of the 2x2 blocks is, by row,
+	// 255 255 128 0 and 0 128 255 255.
+	static const unsigned char alpha[4][8] = {
+		{ 255, 255, 255, 255, 255, 0, 0, 0 },
+		{ 255, 255, 255, 255, 255, 0, 0, 0 },
+		{ 0, 0, 255, 0, 255, 255, 255, 255 },
+		{ 0, 0, 0, 255, 255, 255, 255, 255 },
+	};
+	unsigned char src[8 * 4 * 4];
+	gr_surface surface;
+
+	memset(src, 0x80, sizeof(src));
+	for (int y = 0; y < 4; y++)
+		for (int x = 0; x < 8; x++)
+			src[(y * 8 + x) * 4 + 3] = alpha[y][x];
+	ASSERT_TRUE(image_dir() != NULL);
+	ASSERT_EQ(0, write_png("scale_alpha", src, 8, 4));
+	ASSERT_EQ(0, res_create_scaled_display_surface("scale_alpha", 1, 2, FB_ROTATE_UR, &surface));
+	EXPECT_EQ(4, surface->width);
+	EXPECT_EQ(2, surface->height);
+	ASSERT_TRUE(surface->alpha != NULL);
+
+	static const unsigned char coverage[8] = { 255, 255, 128, 0, 0, 128, 255, 255 };
+	EXPECT_EQ(0, memcmp(coverage, surface->alpha->coverage, sizeof(coverage)));
+	const int *row_runs = surface->alpha->row_runs;
+	const GRAlphaRun *runs = surface->alpha->runs;
+	EXPECT_EQ(0, row_runs[0]);
+	EXPECT_EQ(2, row_runs[1]);
+	EXPECT_EQ(4, row_runs[2]);
+	EXPECT_EQ(0, runs[0].x); EXPECT_EQ(2, runs[0].n); EXPECT_EQ(1, runs[0].opaque);
+	EXPECT_EQ(2, runs[1].x); EXPECT_EQ(1, runs[1].n); EXPECT_EQ(0, runs[1].opaque);
+	EXPECT_EQ(1, runs[2].x); EXPECT_EQ(1, runs[2].n); EXPECT_EQ(0, runs[2].opaque);
+	EXPECT_EQ(2, runs[3].x); EXPECT_EQ(2, runs[3].n); EXPECT_EQ(1, runs[3].opaque);
+	res_free_surface(surface);
+}
+
+#define TURN_W 7
+#define TURN_H 5
+
+// One image loaded turned by each rotation must be the upright load
+// turned by gr_rotate, with its alpha turned the same way.
+TEST(rotate, surfaces){
+	static const int rotations[] = { FB_ROTATE_CW, FB_ROTATE_UD, FB_ROTATE_CCW };
+	unsigned char rgba[TURN_W * TURN_H * 4];
+	unsigned char expected[TURN_W * TURN_H * 4];
+	gr_surface upright, turned;
+
+	for (int i = 0; i < TURN_W * TURN_H * 4; i++)
+		rgba[i] = (i & 3) == 3 ? test_alpha() : test_random();
+	ASSERT_TRUE(image_dir() != NULL);
+	ASSERT_EQ(0, write_png("turn", rgba, TURN_W, TURN_H));
+	ASSERT_EQ(0, res_create_display_surface("turn", &upright));
+	ASSERT_TRUE(upright->alpha != NULL);
+
+	for (unsigned int r = 0; r < sizeof(rotations) / sizeof(rotations[0]); r++) {
+		int rotation = rotations[r];
+		int sideways = rotation != FB_ROTATE_UD;
+		int w = sideways ? TURN_H : TURN_W, h = sideways ? TURN_W : TURN_H;
+
+		ASSERT_EQ(0, res_create_rotated_display_surface("turn", rotation, &turned));
+		ASSERT_EQ(w, turned->width);
+		ASSERT_EQ(h, turned->height);
+		if (rotation == FB_ROTATE_CW) {
+			gr_rotate_cw(upright->data, upright->row_bytes, expected, w * GR_PIXEL_BYTES,
+				     TURN_W, TURN_H);
+		} else if (rotation == FB_ROTATE_CCW) {
+			gr_rotate_ccw(upright->data, upright->row_bytes, expected, w * GR_PIXEL_BYTES,
+				      TURN_W, TURN_H);
+		} else {
+			for (int y = 0; y < TURN_H; y++)
+				memcpy(expected + y * TURN_W * GR_PIXEL_BYTES,
+				       upright->data + y * upright->row_bytes, TURN_W * GR_PIXEL_BYTES);
+			gr_rotate_180_inplace(expected, TURN_W * GR_PIXEL_BYTES, TURN_W, TURN_H);
+		}
+		for (int y = 0; y < h; y++)
+			EXPECT_EQ(0, memcmp(expected + y * w * GR_PIXEL_BYTES,
+					    turned->data + y * turned->row_bytes, w * GR_PIXEL_BYTES))
+				<< "rotation " << rotation << " row " << y;
+
+		// Upright pixel (x, y) lands where gr_rotate puts it.
+		ASSERT_TRUE(turned->alpha != NULL);
+		for (int y = 0; y < TURN_H; y++)
+			for (int x = 0; x < TURN_W; x++) {
+				int tx = rotation == FB_ROTATE_CW ? TURN_H - 1 - y :
+					 rotation == FB_ROTATE_CCW ? y : TURN_W - 1 - x;
+				int ty = rotation == FB_ROTATE_CW ? x :
+					 rotation == FB_ROTATE_CCW ? TURN_W - 1 - x : TURN_H - 1 - y;
+				EXPECT_EQ(upright->alpha->coverage[y * TURN_W + x],
+					  turned->alpha->coverage[ty * w + tx]);
+			}
+		GRSurfaceAlpha *alpha = gr_surface_alpha_create(turned->alpha->coverage, w, w, h);
+		ASSERT_TRUE(alpha != NULL);
+		EXPECT_EQ(0, memcmp(alpha->row_runs, turned->alpha->row_runs, (h + 1) * sizeof(int)));
+		for (int k = 0; k < alpha->row_runs[h]; k++) {
+			EXPECT_EQ(alpha->runs[k].x, turned->alpha->runs[k].x);
+			EXPECT_EQ(alpha->runs[k].n, turned->alpha->runs[k].n);
+			EXPECT_EQ(alpha->runs[k].opaque, turned->alpha->runs[k].opaque);
+		}
+		free(alpha);
+		res_free_surface(turned);
+	}
+	res_free_surface(upright);
+}
+
+static int write_test_image(const char *name, int w, int h) {
+	unsigned char *rgba = (unsigned char *)malloc(w * h * 4);
+	for (int i = 0; i < w * h * 4; i++)
+		rgba[i] = i * 7;
+	for (int i = 3; i < w * h * 4; i += 4)
+		rgba[i] = 255;
+	int ret = write_png(name, rgba, w, h);
+	free(rgba);
+	return ret;
+}
+
+TEST(cache, refs){
+	ResCacheStats s0, s1;
+	gr_surface a1, a2, a3, rot, batch[2];
+	printf("POF-UTIT------------------cache_test\n");
+
+	ASSERT_TRUE(image_dir() != NULL);
+	ASSERT_EQ(0, write_test_image("cache_a", 4, 4));
+	res_cache_trim();
+	res_cache_get_stats(&s0);
+
+	// The same image, at the same scale and rotation, is one surface.
+	ASSERT_EQ(0, res_acquire_display_surface("cache_a", 1, 1, FB_ROTATE_UR, &a1));
+	ASSERT_EQ(0, res_acquire_display_surface("cache_a", 2, 1, FB_ROTATE_UR, &a2));
+	EXPECT_EQ(a1, a2);
+	ASSERT_EQ(0, res_acquire_display_surface("cache_a", 1, 1, FB_ROTATE_CW, &rot));
+	EXPECT_NE(a1, rot);
+	ResRequest requests[2] = {
+		{ "cache_a", 1, 1, FB_ROTATE_UR, &batch[0], 0 },
+		{ "cache_a", 1, 1, FB_ROTATE_UR, &batch[1], 0 },
+	};
+	EXPECT_EQ(0, res_acquire_display_surfaces(requests, 2));
+	EXPECT_EQ(a1, batch[0]);
+	EXPECT_EQ(a1, batch[1]);
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.misses + 2, s1.misses);
+	EXPECT_EQ(s0.hits + 3, s1.hits);
+	EXPECT_EQ(s0.entries + 2, s1.entries);
+
+	// A surface someone holds survives a trim.
+	for (int i = 0; i < 3; i++)
+		res_release_surface(a1);
+	res_release_surface(rot);
+	res_cache_trim();
+	ASSERT_EQ(0, res_acquire_display_surface("cache_a", 1, 1, FB_ROTATE_UR, &a3));
+	EXPECT_EQ(a1, a3);
+	res_release_surface(a1);
+	res_release_surface(a3);
+	res_cache_trim();
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.entries, s1.entries);
+	EXPECT_EQ(s0.bytes, s1.bytes);
+}
+
+TEST(cache, budget){
+	ResCacheStats s0, s1;
+	gr_surface b, c, d;
+
+	ASSERT_TRUE(image_dir() != NULL);
+	ASSERT_EQ(0, write_test_image("cache_b", 8, 8));
+	ASSERT_EQ(0, write_test_image("cache_c", 8, 8));
+	ASSERT_EQ(0, write_test_image("cache_d", 8, 8));
+	res_cache_trim();
+	res_cache_get_stats(&s0);
+
+	ASSERT_EQ(0, res_acquire_display_surface("cache_b", 1, 1, FB_ROTATE_UR, &b));
+	res_release_surface(b);
+	res_cache_get_stats(&s1);
+	size_t size = s1.bytes - s0.bytes;
+	EXPECT_LT(8U * 8U, size);
+	res_cache_set_budget(s0.bytes + 2 * size);
+
+	// Over budget, the least recently used surface nobody holds goes.
+	ASSERT_EQ(0, res_acquire_display_surface("cache_c", 1, 1, FB_ROTATE_UR, &c));
+	res_release_surface(c);
+	ASSERT_EQ(0, res_acquire_display_surface("cache_d", 1, 1, FB_ROTATE_UR, &d));
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.evictions + 1, s1.evictions);
+	EXPECT_EQ(s0.bytes + 2 * size, s1.bytes);
+	ASSERT_EQ(0, res_acquire_display_surface("cache_c", 1, 1, FB_ROTATE_UR, &c));
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.misses + 3, s1.misses);
+
+	// Held surfaces stay, even over budget; b comes back as a miss.
+	ASSERT_EQ(0, res_acquire_display_surface("cache_b", 1, 1, FB_ROTATE_UR, &b));
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.misses + 4, s1.misses);
+	EXPECT_EQ(s0.evictions + 1, s1.evictions);
+	EXPECT_EQ(s0.bytes + 3 * size, s1.bytes);
+	res_release_surface(b);
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.evictions + 2, s1.evictions);
+
+	res_cache_set_budget(1);
+	res_release_surface(c);
+	res_release_surface(d);
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.evictions + 4, s1.evictions);
+	EXPECT_EQ(s0.bytes, s1.bytes);
+	EXPECT_EQ(s0.entries, s1.entries);
+	res_cache_set_budget(0);
+}
+
+TEST(cache, failure){
+	ResCacheStats s0, s1;
+	gr_surface surface;
+	char path[320];
+
+	ASSERT_TRUE(image_dir() != NULL);
+	snprintf(path, sizeof(path), "%s/cache_late.png", image_dir());
+	unlink(path);
+	res_cache_trim();
+	res_cache_get_stats(&s0);
+
+	// A failed load is remembered: the image is not looked for again
+	// until the cache is trimmed.
+	EXPECT_GT(0, res_acquire_display_surface("cache_late", 1, 1, FB_ROTATE_UR, &surface));
+	EXPECT_TRUE(surface == NULL);
+	ASSERT_EQ(0, write_test_image("cache_late", 4, 4));
+	EXPECT_GT(0, res_acquire_display_surface("cache_late", 1, 1, FB_ROTATE_UR, &surface));
+	EXPECT_TRUE(surface == NULL);
+	res_release_surface(surface);
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.misses + 1, s1.misses);
+	EXPECT_EQ(s0.hits + 1, s1.hits);
+	EXPECT_EQ(s0.entries + 1, s1.entries);
+	EXPECT_EQ(s0.bytes, s1.bytes);
+
+	res_cache_trim();
+	ASSERT_EQ(0, res_acquire_display_surface("cache_late", 1, 1, FB_ROTATE_UR, &surface));
+	EXPECT_TRUE(surface != NULL);
+	res_release_surface(surface);
+	res_cache_trim();
+}
+
+static int write_file(const char *name, const void *data, size_t size) {
+	char path[320];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", image_dir(), name);
+	fp = fopen(path, "wb");
+	if (!fp)
+		return -1;
+	if (fwrite(data, 1, size, fp) != size) {
+		fclose(fp);
+		return -1;
+	}
+	return fclose(fp);
+}
+
+// Same pixels, and same alpha down to the runs.
+static void expect_same_surface(gr_surface a, gr_surface b) {
+	ASSERT_TRUE(a != NULL && b != NULL);
+	ASSERT_EQ(a->width, b->width);
+	ASSERT_EQ(a->height, b->height);
+	ASSERT_EQ(a->row_bytes, b->row_bytes);
+	EXPECT_EQ(0, memcmp(a->data, b->data, a->row_bytes * a->height));
+	ASSERT_EQ(a->alpha == NULL, b->alpha == NULL);
+	if (!a->alpha)
+		return;
+	EXPECT_EQ(0, memcmp(a->alpha->coverage, b->alpha->coverage, a->width * a->height));
+	EXPECT_EQ(0, memcmp(a->alpha->row_runs, b->alpha->row_runs,
+			    (a->height + 1) * sizeof(int)));
+	EXPECT_EQ(0, memcmp(a->alpha->runs, b->alpha->runs,
+			    a->alpha->row_runs[a->height] * sizeof(GRAlphaRun)));
+}
+
+// A 4 x 2 QOI image with one of each op, and its pixels.
+static const unsigned char qoi_image[] = {
+	'q', 'o', 'i', 'f', 0, 0, 0, 4, 0, 0, 0, 2, 4, 0,
+	0xfe, 10, 20, 30,		// RGB
+	0x76,				// DIFF +1 -1 0
+	0xb5, 0x77,			// LUMA +20 +21 +20
+	0xc1,				// RUN 2
+	0x09,				// INDEX of the first pixel
+	0xff, 1, 2, 3, 128,		// RGBA
+	0x00,				// INDEX 0, never written: transparent black
+	0, 0, 0, 0, 0, 0, 0, 1,
+};
+static const unsigned char qoi_pixels[] = {
+	10, 20, 30, 255,  11, 19, 30, 255,  31, 40, 50, 255,  31, 40, 50, 255,
+	31, 40, 50, 255,  10, 20, 30, 255,  1, 2, 3, 128,     0, 0, 0, 0,
+};
+
+TEST(qoi, round_trip){
+	gr_surface qoi, png;
+	printf("POF-UTIT--------------------qoi_test\n");
+
+	ASSERT_TRUE(image_dir() != NULL);
+	ASSERT_EQ(0, write_file("qoi_ops.qoi", qoi_image, sizeof(qoi_image)));
+	ASSERT_EQ(0, write_png("qoi_ops_ref", qoi_pixels, 4, 2));
+	ASSERT_EQ(0, res_create_display_surface("qoi_ops", &qoi));
+	ASSERT_EQ(0, res_create_display_surface("qoi_ops_ref", &png));
+	expect_same_surface(qoi, png);
+	res_free_surface(qoi);
+	res_free_surface(png);
+}
+
+TEST(qoi, truncated){
+	gr_surface surface;
+	const size_t end = sizeof(qoi_image) - 8;
+
+	ASSERT_TRUE(image_dir() != NULL);
+	// Cut anywhere before the end marker, some pixels are missing.
+	for (size_t size = 0; size < end; size++) {
+		ASSERT_EQ(0, write_file("qoi_short.qoi", qoi_image, size));
+		surface = NULL;
+		EXPECT_GT(0, res_create_display_surface("qoi_short", &surface)) << size;
+		EXPECT_TRUE(surface == NULL) << size;
+	}
+}
+
+TEST(qoi, huge){
+	gr_surface surface;
+	unsigned char image[sizeof(qoi_image)];
+
+	ASSERT_TRUE(image_dir() != NULL);
+	memcpy(image, qoi_image, sizeof(image));
+	memset(image + 4, 0x7f, 4);
+	memset(image + 8, 0x7f, 4);
+	ASSERT_EQ(0, write_file("qoi_huge.qoi", image, sizeof(image)));
+	surface = NULL;
+	EXPECT_GT(0, res_create_display_surface("qoi_huge", &surface));
+	EXPECT_TRUE(surface == NULL);
+
+	// Just over the largest size minui takes, one side at a time.
+	memcpy(image, qoi_image, sizeof(image));
+	image[6] = 0x40;
+	image[7] = 0x01;
+	ASSERT_EQ(0, write_file("qoi_huge.qoi", image, sizeof(image)));
+	EXPECT_GT(0, res_create_display_surface("qoi_huge", &surface));
+	memcpy(image, qoi_image, sizeof(image));
+	image[10] = 0x40;
+	image[11] = 0x01;
+	ASSERT_EQ(0, write_file("qoi_huge.qoi", image, sizeof(image)));
+	EXPECT_GT(0, res_create_display_surface("qoi_huge", &surface));
+}
+
+// Encode w x h R, G, B, A pixels as QOI, with only the RGBA and RUN ops.
+static size_t qoi_encode(unsigned char *out, const unsigned char *rgba, int w, int h) {
+	unsigned char prev[4] = { 0, 0, 0, 255 };
+	size_t n = 0;
+	int run = 0;
+
+	memcpy(out, "qoif", 4);
+	for (int i = 0; i < 4; i++) {
+		out[4 + i] = w >> (24 - i * 8);
+		out[8 + i] = h >> (24 - i * 8);
+	}
+	out[12] = 4;
+	out[13] = 0;
+	n = 14;
+	for (int i = 0; i < w * h; i++) {
+		const unsigned char *px = rgba + i * 4;
+		if (!memcmp(px, prev, 4)) {
+			if (++run == 62) {
+				out[n++] = 0xc0 | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+		if (run) {
+			out[n++] = 0xc0 | (run - 1);
+			run = 0;
+		}
+		out[n++] = 0xff;
+		memcpy(out + n, px, 4);
+		memcpy(prev, px, 4);
+		n += 4;
+	}
+	if (run)
+		out[n++] = 0xc0 | (run - 1);
+	memset(out + n, 0, 7);
+	out[n + 7] = 1;
+	return n + 8;
+}
+
+// A batch naming conc_1 twice, acquired by two threads at once.
+#define CONC_COUNT 5
+static const char *conc_names[CONC_COUNT] = { "conc_0", "conc_1", "conc_2", "conc_1", "conc_3" };
+static pthread_barrier_t conc_barrier;
+
+static int conc_acquire(gr_surface *surfaces) {
+	ResRequest requests[CONC_COUNT];
+
+	for (int i = 0; i < CONC_COUNT; i++) {
+		requests[i].name = conc_names[i];
+		requests[i].scale_num = requests[i].scale_den = 1;
+		requests[i].rotation = FB_ROTATE_UR;
+		requests[i].surface = &surfaces[i];
+	}
+	return res_acquire_display_surfaces(requests, CONC_COUNT);
+}
+
+static void *conc_thread(void *surfaces) {
+	pthread_barrier_wait(&conc_barrier);
+	return (void *)(intptr_t)conc_acquire((gr_surface *)surfaces);
+}
+
+TEST(cache, concurrent){
+	gr_surface t1[CONC_COUNT], t2[CONC_COUNT], serial[CONC_COUNT], decoded;
+	ResCacheStats s0, s1;
+	pthread_t thread;
+	void *ret;
+	char name[16];
+
+	ASSERT_TRUE(image_dir() != NULL);
+	for (int i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "conc_%d", i);
+		ASSERT_EQ(0, write_test_image(name, 6 + i, 9 - i));
+	}
+	res_cache_trim();
+	res_cache_get_stats(&s0);
+
+	// Both threads miss, decode, and one of them publishes.
+	ASSERT_EQ(0, pthread_barrier_init(&conc_barrier, NULL, 2));
+	ASSERT_EQ(0, pthread_create(&thread, NULL, conc_thread, t2));
+	EXPECT_EQ(0, (intptr_t)conc_thread(t1));
+	ASSERT_EQ(0, pthread_join(thread, &ret));
+	EXPECT_EQ(0, (intptr_t)ret);
+	pthread_barrier_destroy(&conc_barrier);
+	ASSERT_EQ(0, conc_acquire(serial));
+
+	EXPECT_EQ(t1[1], t1[3]);
+	for (int i = 0; i < CONC_COUNT; i++) {
+		EXPECT_EQ(t1[i], t2[i]);
+		EXPECT_EQ(t1[i], serial[i]);
+		ASSERT_EQ(0, res_create_display_surface(conc_names[i], &decoded));
+		expect_same_surface(decoded, t1[i]);
+		res_free_surface(decoded);
+	}
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.entries + 4, s1.entries);
+
+	// Each request holds three references.  With all but one reference
+	// of each surface dropped they all stay cached, then they all go.
+	for (int k = 0; k < 3; k++)
+		for (int i = 0; i < CONC_COUNT; i++)
+			if (k < 2 || i == 3)
+				res_release_surface(t1[i]);
+	res_cache_trim();
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.entries + 4, s1.entries);
+	for (int i = 0; i < CONC_COUNT; i++)
+		if (i != 3)
+			res_release_surface(t1[i]);
+	res_cache_trim();
+	res_cache_get_stats(&s1);
+	EXPECT_EQ(s0.entries, s1.entries);
+	EXPECT_EQ(s0.bytes, s1.bytes);
+}
+
+#define ANIM_W 6
+#define ANIM_H 5
+#define ANIM_FRAMES 3
+
+TEST(anim, ut){
+	// Frame 0 is a key frame, 1 and 2 each change one rectangle.  The
+	// player keeps just those two in its canvas and decodes the rest of
+	// the key frame again, around which the image is transparent.
+	static const GRRect rects[ANIM_FRAMES] = { { 1, 1, 4, 4 }, { 2, 2, 2, 2 }, { 2, 4, 3, 1 } };
+	unsigned char pixels[ANIM_FRAMES][ANIM_W * ANIM_H * 4];
+	unsigned char file[4096], delta[ANIM_W * ANIM_H * 4];
+	ResAnimHeader header = { RES_ANIM_MAGIC, RES_ANIM_VERSION, ANIM_W, ANIM_H, ANIM_FRAMES };
+	ResAnimFrame frames[ANIM_FRAMES];
+	gr_surface expected[ANIM_FRAMES], prev;
+	ResAnimation *anim;
+	char name[32];
+	size_t size;
+	printf("POF-UTIT-------------------anim_test\n");
+
+	ASSERT_TRUE(image_dir() != NULL);
+	memset(pixels[0], 0, sizeof(pixels[0]));
+	for (int y = rects[0].y; y < rects[0].y + rects[0].h; y++)
+		for (int x = rects[0].x * 4; x < (rects[0].x + rects[0].w) * 4; x++)
+			pixels[0][y * ANIM_W * 4 + x] = (x & 3) == 3 ? 255 : (y * ANIM_W * 4 + x) * 13;
+	for (int f = 1; f < ANIM_FRAMES; f++) {
+		memcpy(pixels[f], pixels[f - 1], sizeof(pixels[f]));
+		const GRRect *r = &rects[f];
+		for (int y = r->y; y < r->y + r->h; y++)
+			for (int x = r->x; x < r->x + r->w; x++) {
+				unsigned char *px = pixels[f] + (y * ANIM_W + x) * 4;
+				px[0] = 40 * f + x;
+				px[1] = 90 - y;
+				px[2] = 200;
+				px[3] = x & 1 ? 128 : 255;
+			}
+	}
+
+	size = sizeof(header) + sizeof(frames);
+	for (int f = 0; f < ANIM_FRAMES; f++) {
+		const GRRect *r = &rects[f];
+		unsigned char *d = delta;
+		for (int y = r->y; y < r->y + r->h; y++)
+			for (int x = 0; x < r->w * 4; x++) {
+				int i = (y * ANIM_W + r->x) * 4 + x;
+				*d++ = pixels[f][i] ^ (f ? pixels[f - 1][i] : 0);
+			}
+		frames[f].offset = size;
+		frames[f].size = qoi_encode(file + size, delta, r->w, r->h);
+		frames[f].x = r->x;
+		frames[f].y = r->y;
+		frames[f].w = r->w;
+		frames[f].h = r->h;
+		frames[f].duration_ms = 100 * (f + 1);
+		frames[f].flags = f ? 0 : RES_ANIM_KEY;
+		size += frames[f].size;
+		ASSERT_GE(sizeof(file), size);
+	}
+	memcpy(file, &header, sizeof(header));
+	memcpy(file + sizeof(header), frames, sizeof(frames));
+	ASSERT_EQ(0, write_file("anim_test.anim", file, size));
+	for (int f = 0; f < ANIM_FRAMES; f++) {
+		snprintf(name, sizeof(name), "anim_test%d", f);
+		ASSERT_EQ(0, write_png(name, pixels[f], ANIM_W, ANIM_H));
+		ASSERT_EQ(0, res_create_display_surface(name, &expected[f]));
+	}
+
+	EXPECT_EQ(-1, res_open_animation("anim_missing", 1, 1, FB_ROTATE_UR, &anim));
+	ASSERT_EQ(0, res_open_animation("anim_test", 1, 1, FB_ROTATE_UR, &anim));
+	EXPECT_EQ(ANIM_FRAMES, res_animation_frames(anim));
+	EXPECT_EQ(0, res_animation_index(anim));
+	EXPECT_EQ(100, res_animation_duration(anim));
+	expect_same_surface(expected[0], res_animation_surface(anim));
+
+	// Past the end it starts over from frame 0.
+	static const int order[] = { 1, 2, 0, 1 };
+	for (int k = 0; k < 4; k++) {
+		prev = res_animation_surface(anim);
+		ASSERT_EQ(0, res_animation_next(anim));
+		int f = order[k];
+		EXPECT_EQ(f, res_animation_index(anim));
+		EXPECT_EQ(100 * (f + 1), res_animation_duration(anim));
+		EXPECT_NE(prev, res_animation_surface(anim));
+		expect_same_surface(expected[f], res_animation_surface(anim));
+	}
+
+	// Looping back to frame 1 has to decode it from the key frame again.
+	res_animation_set_loop(anim, 1);
+	static const int loop[] = { 2, 1, 2, 1 };
+	for (int k = 0; k < 4; k++) {
+		ASSERT_EQ(0, res_animation_next(anim));
+		EXPECT_EQ(loop[k], res_animation_index(anim));
+		expect_same_surface(expected[loop[k]], res_animation_surface(anim));
+	}
+
+	res_free_animation(anim);
+	for (int f = 0; f < ANIM_FRAMES; f++)
+		res_free_surface(expected[f]);
+}
+
+// A 4x2 bundle entry "bundle_test" with alpha: the data, coverage,
+// row runs and runs blocks, one RES_BUNDLE_ALIGN apart after the index.
+#define BUNDLE_W 4
+#define BUNDLE_H 2
+#define BUNDLE_DATA (2 * RES_BUNDLE_ALIGN)
+#define BUNDLE_COVERAGE (3 * RES_BUNDLE_ALIGN)
+#define BUNDLE_ROW_RUNS (4 * RES_BUNDLE_ALIGN)
+#define BUNDLE_RUNS (5 * RES_BUNDLE_ALIGN)
+#define BUNDLE_SIZE (6 * RES_BUNDLE_ALIGN)
+
+static void bundle_build(unsigned char *file) {
+	static const unsigned char coverage[BUNDLE_W * BUNDLE_H] = { 255, 255, 0, 128, 0, 0, 0, 0 };
+	static const int32_t row_runs[BUNDLE_H + 1] = { 0, 2, 2 };
+	static const GRAlphaRun runs[2] = { { 0, 2, 1 }, { 3, 1, 0 } };
+	ResBundleHeader header = { RES_BUNDLE_MAGIC, RES_BUNDLE_VERSION, RES_BUNDLE_FORMAT, 1 };
+	ResBundleEntry entry;
+
+	memset(file, 0, BUNDLE_SIZE);
+	memset(&entry, 0, sizeof(entry));
+	strcpy(entry.name, "bundle_test");
+	entry.scale_num = entry.scale_den = 1;
+	entry.rotation = FB_ROTATE_UR;
+	entry.width = BUNDLE_W;
+	entry.height = BUNDLE_H;
+	entry.row_bytes = BUNDLE_W * GR_PIXEL_BYTES;
+	entry.data = BUNDLE_DATA;
+	entry.coverage = BUNDLE_COVERAGE;
+	entry.row_runs = BUNDLE_ROW_RUNS;
+	entry.runs = BUNDLE_RUNS;
+	memcpy(file, &header, sizeof(header));
+	memcpy(file + sizeof(header), &entry, sizeof(entry));
+	for (int i = 0; i < BUNDLE_W * BUNDLE_H * GR_PIXEL_BYTES; i++)
+		file[BUNDLE_DATA + i] = i * 5;
+	memcpy(file + BUNDLE_COVERAGE, coverage, sizeof(coverage));
+	memcpy(file + BUNDLE_ROW_RUNS, row_runs, sizeof(row_runs));
+	memcpy(file + BUNDLE_RUNS, runs, sizeof(runs));
+}
+
+static ResBundleEntry *bundle_entry(unsigned char *file) {
+	return (ResBundleEntry *)(file + sizeof(ResBundleHeader));
+}
+
+// Write file as a bundle and load "bundle_test", which has no image to
+// fall back to, from it.
+static int bundle_load(const unsigned char *file, size_t size, gr_surface *surface) {
+	char path[320];
+
+	if (write_file("test.bundle", file, size) < 0)
+		return -100;
+	snprintf(path, sizeof(path), "%s/test.bundle", image_dir());
+	if (res_set_bundle(path) < 0)
+		return -101;
+	return res_create_display_surface("bundle_test", surface);
+}
+
+TEST(bundle, reject){
+	static unsigned char file[BUNDLE_SIZE];
+	gr_surface surface;
+	int32_t *row_runs = (int32_t *)(file + BUNDLE_ROW_RUNS);
+	GRAlphaRun *runs = (GRAlphaRun *)(file + BUNDLE_RUNS);
+
+	ASSERT_TRUE(image_dir() != NULL);
+	bundle_build(file);
+	ASSERT_EQ(0, bundle_load(file, BUNDLE_SIZE, &surface));
+	EXPECT_EQ(BUNDLE_W, surface->width);
+	EXPECT_EQ(BUNDLE_H, surface->height);
+	EXPECT_EQ(0, memcmp(file + BUNDLE_DATA, surface->data, BUNDLE_W * BUNDLE_H * GR_PIXEL_BYTES));
+	ASSERT_TRUE(surface->alpha != NULL);
+	EXPECT_EQ(3, surface->alpha->runs[1].x);
+	res_free_surface(surface);
+
+	// Row runs going backwards, though all inside the runs.
+	row_runs[0] = 1;
+	row_runs[1] = 0;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+
+	// A run past the end of its row.
+	bundle_build(file);
+	runs[1].n = 2;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+
+	// Blocks, and the runs row_runs counts, outside the file.
+	bundle_build(file);
+	bundle_entry(file)->data = BUNDLE_SIZE;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+	bundle_build(file);
+	bundle_entry(file)->coverage = BUNDLE_SIZE + RES_BUNDLE_ALIGN;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+	bundle_build(file);
+	bundle_entry(file)->height = 100;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+	bundle_build(file);
+	row_runs[1] = row_runs[2] = 100;
+	EXPECT_GT(0, bundle_load(file, BUNDLE_SIZE, &surface));
+
+	// A header cut short, or counting more entries than the file holds.
+	bundle_build(file);
+	EXPECT_EQ(-101, bundle_load(file, sizeof(ResBundleHeader) - 1, &surface));
+	EXPECT_EQ(-101, bundle_load(file, sizeof(ResBundleHeader) + sizeof(ResBundleEntry) - 1,
+				    &surface));
+	((ResBundleHeader *)file)->count = BUNDLE_SIZE;
+	EXPECT_EQ(-101, bundle_load(file, BUNDLE_SIZE, &surface));
+
+	EXPECT_EQ(0, res_set_bundle(NULL));
+}
+
+// ELEM_COUNT of ui.c.
+#define DAMAGE_ELEMS 10
+#define DAMAGE_SPRITES 6
+#define DAMAGE_W 64
+#define DAMAGE_H 48
+
+struct damage_elem {
+	gr_surface surface;
+	int x, y;
+};
+
+// The whole screen cleared and every element blended over it, in order.
+static void damage_repaint(unsigned char *fb, const struct damage_elem *elems, int count) {
+	for (int y = 0; y < DAMAGE_H; y++)
+		gr_span_c.fill(fb + y * DAMAGE_W * 4, DAMAGE_W, GR_COLOR(0, 0, 0, 255));
+	for (int i = 0; i < count; i++) {
+		gr_surface s = elems[i].surface;
+		if (!s)
+			continue;
+		for (int y = 0; y < s->height; y++)
+			for (int x = 0; x < s->width; x++) {
+				const unsigned char *a = s->alpha ? s->alpha->coverage + y * s->width + x : NULL;
+				const unsigned char *src = s->data + y * s->row_bytes + x * 4;
+				unsigned char *dst = fb + ((elems[i].y + y) * DAMAGE_W + elems[i].x + x) * 4;
+				if (!a || *a == 255)
+					memcpy(dst, src, 4);
+				else if (*a)
+					gr_span_c.over(src, a, dst, 1);
+			}
+	}
+}
+
+// First pixel whose color differs, or -1.  The fourth byte is padding
+// that fills leave as it was.
+static int damage_diff(const unsigned char *a, const unsigned char *b) {
+	for (int i = 0; i < DAMAGE_W * DAMAGE_H * 4; i++)
+		if (i % 4 != 3 && a[i] != b[i])
+			return i / 4;
+	return -1;
+}
+
+// Every frame drawn through the damage tracking of ui.c must show
+// what repainting the whole screen would: on one buffer copied by
+// damage, two or three flipped buffers, and buffers of unknown age.
+TEST(damage, full_repaint){
+	static const int displays[][2] = { { 1, 1 }, { 2, 1 }, { 3, 1 }, { 2, 0 } };
+	unsigned char rgba[12 * 10 * 4];
+	unsigned char expected[DAMAGE_W * DAMAGE_H * 4];
+	gr_surface sprites[DAMAGE_SPRITES];
+	struct damage_elem elems[DAMAGE_ELEMS];
+	char name[32];
+
+	// Sprites of different sizes with transparent and partly
+	// transparent pixels, which show a box that was not cleared.
+	ASSERT_TRUE(image_dir() != NULL);
+	for (int i = 0; i < DAMAGE_SPRITES; i++) {
+		int w = 6 + i, h = 10 - i;
+		for (int p = 0; p < w * h; p++) {
+			rgba[p * 4] = test_random();
+			rgba[p * 4 + 1] = test_random();
+			rgba[p * 4 + 2] = test_random();
+			rgba[p * 4 + 3] = test_alpha();
+		}
+		snprintf(name, sizeof(name), "damage%d", i);
+		ASSERT_EQ(0, write_png(name, rgba, w, h));
+		ASSERT_EQ(0, res_create_display_surface(name, &sprites[i]));
+	}
+
+	set_gr_value(DAMAGE_H, DAMAGE_W);
+	for (unsigned int d = 0; d < sizeof(displays) / sizeof(displays[0]); d++) {
+		mock_display_open(displays[d][0], displays[d][1]);
+		ui_test_invalidate();
+		memset(elems, 0, sizeof(elems));
+		for (int frame = 0; frame < 60; frame++) {
+			// Most elements stay, some change, move or go away.
+			for (int i = 0; i < DAMAGE_ELEMS; i++) {
+				uint32_t r = test_random();
+				if (frame && r % 8 > 2)
+					continue;
+				elems[i].surface = r % 8 == 0 ? NULL : sprites[(r >> 3) % DAMAGE_SPRITES];
+				elems[i].x = (r >> 8) % (DAMAGE_W - 12);
+				elems[i].y = (r >> 16) % (DAMAGE_H - 10);
+			}
+			for (int i = 0; i < DAMAGE_ELEMS; i++)
+				ui_test_place(i, elems[i].surface, elems[i].x, elems[i].y);
+			ui_test_present();
+
+			damage_repaint(expected, elems, DAMAGE_ELEMS);
+			ASSERT_EQ(-1, damage_diff(expected, mock_display_shown()))
+				<< displays[d][0] << " buffers, ages " << displays[d][1]
+				<< ", frame " << frame;
+		}
+	}
+	mock_display_close();
+	for (int i = 0; i < DAMAGE_SPRITES; i++)
+		res_free_surface(sprites[i]);
+}
+
 TEST(rtc,ut){
 	printf("POF-UTIT------------------rtc_test");
 	EXPECT_EQ(0,validate_rtc_time());
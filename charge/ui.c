@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <linux/fb.h>
 #include <linux/input.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -32,6 +33,7 @@
 #include "common.h"
 #include "minui/minui.h"
 #include "battery.h"
+#include "frame_clock.h"
 #include <errno.h>
 
 #define MAX_COLS 64
@@ -42,11 +44,20 @@
 
 #define PICTURE_SHOW_PERCENT_SUPPORT
 
+// 圆环动画宏开关: the ring and lightning icon instead of the progress
+// bar.  Off until the lightning images are shipped in images/.
+#ifndef CIRCLE_CHARGE_UI_SUPPORT
+#define CIRCLE_CHARGE_UI_SUPPORT 0
+#endif
+
 static pthread_mutex_t gUpdateMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t gchargeMutex = PTHREAD_MUTEX_INITIALIZER;
 static gr_surface gProgressBarIndeterminate[PROGRESSBAR_INDETERMINATE_STATES];
 static gr_surface gProgressBarEmpty;
 static gr_surface gProgressBarFill;
+// The bar frames streamed from one file, see res_open_animation(); NULL
+// when they are loaded as separate images instead.
+static ResAnimation *gProgressBarAnimation;
 static gr_surface gNumber[10];
 static gr_surface gPercent;
 static gr_surface gColon;
@@ -54,16 +65,18 @@ static gr_surface gProgressBarError[3];
 
 int alarm_flag_check(void);
 extern int rotate;
+#if CIRCLE_CHARGE_UI_SUPPORT
+static void draw_circle_charge_ui(int percent, int is_fast_charging);
+#endif
 
-const char *gm = "_360X640";
-const char *gh = "_480X800";
-const char *gxh = "_720X1280";
-const char *gxxh = "_1080X1920";
-const char *gxxxh = "_1440X2560";
+// Every image is drawn for a 1440x2560 panel and shrunk at load time
+// to fit the actual one.
+#define RES_MASTER_SHORT 1440
+#define RES_MASTER_LONG 2560
+const char *gMaster = "_1440X2560";
 const char *gIndeterminate = "indeterminate";
 const char *gNo = "number";
 const char *gError = "error";
-const char *ro = "_rotate";
 
 char gPer[33] = "number_percent";
 char gCol[33] = "colon";
@@ -71,30 +84,25 @@ char gErr[3][33] = {0};
 char gIndex[7][33] = {0};
 char gNoIndex[10][33] = {0};
 
-static int res_pixel_identify(void)
+// The scale, as num / den, that fits the master images to the panel in
+// either orientation.  At most 1.
+static void res_scale(int *num, int *den)
 {
 	int x = gr_fb_width();
 	int y = gr_fb_height();
-	int size = 0;
-
-	if((x<= 360) && (y <= 640)){
-		size = SIZE_360X640;
-	}else if((x<=480) && (y<=800)){
-		size = SIZE_480X800;
-	}else if((x<=480) && (y<=854)) {
-		size = SIZE_480X800;
-		LOGD("480 * 854 Use res of 480 * 800\n");
-	}else if((x<=720) && (y<=1280)){
-		size = SIZE_720X1280;
-	}else if((x<=1080) && (y<=1920)){
-		size = SIZE_1080X1920;
-	}else if((x<=1440) && (y<=2560)){
-		size = SIZE_1440X2560;
-	}else{
-		LOGE("Picture size is not standard size\n");
-	}
+	int s = x < y ? x : y;
+	int l = x < y ? y : x;
 
-		return size;
+	if ((long)s * RES_MASTER_LONG <= (long)l * RES_MASTER_SHORT) {
+		*num = s;
+		*den = RES_MASTER_SHORT;
+	} else {
+		*num = l;
+		*den = RES_MASTER_LONG;
+	}
+	if (*num > *den)
+		*num = *den;
+	LOGD("%dx%d panel, images scaled by %d/%d\n", x, y, *num, *den);
 }
 
 static void res_init(void)
@@ -102,66 +110,32 @@ static void res_init(void)
 	int i = 0;
 	int j = 0;
 	int k = 0;
-	char *temp;
-
-	switch (res_pixel_identify()){
-		case SIZE_360X640:
-				temp =(char *) gm;
-			break;
-		case SIZE_480X800:
-				temp =(char *) gh;
-			break;
-		case SIZE_720X1280:
-				temp =(char *) gxh;
-			break;
-		case SIZE_1080X1920:
-				temp =(char *) gxxh;
-			break;
-		case SIZE_1440X2560:
-				temp =(char *) gxxxh;
-			break;
-		default:
-				temp =(char *) gm;
-			break;
-	}
+	const char *temp = gMaster;
 
 	for(i = 0; i<=6; i++){
-		if(rotate)
-			snprintf(&gIndex[i][0], sizeof(gIndex[i])-1, "%s%d%s%s", gIndeterminate,i,temp,ro);
-		else
-			snprintf(&gIndex[i][0], sizeof(gIndex[i])-1, "%s%d%s", gIndeterminate,i,temp);
+		snprintf(&gIndex[i][0], sizeof(gIndex[i])-1, "%s%d%s", gIndeterminate,i,temp);
 		LOGD("picture is %s\n",gIndex[i]);
 	}
 
 	for(j = 0;j<10;j++){
-		if(rotate)
-			snprintf(&gNoIndex[j][0], sizeof(gNoIndex[j])-1, "%s_%d%s%s", gNo,j,temp,ro);
-		else
-			snprintf(&gNoIndex[j][0], sizeof(gNoIndex[j])-1,"%s_%d%s", gNo,j,temp);
+		snprintf(&gNoIndex[j][0], sizeof(gNoIndex[j])-1,"%s_%d%s", gNo,j,temp);
 		LOGD("number is %s\n",gNoIndex[j]);
 	}
 
 	for(k = 0;k<3;k++){
-		if(rotate)
-			snprintf(&gErr[k][0], sizeof(gErr[k])-1,"%s_%d%s%s", gError,k+1,temp,ro);
-		else
-			snprintf(&gErr[k][0], sizeof(gErr[k])-1,"%s_%d%s", gError,k+1,temp);
+		snprintf(&gErr[k][0], sizeof(gErr[k])-1,"%s_%d%s", gError,k+1,temp);
 		LOGD("error is %s\n",gErr[k]);
 	}
 
-	if(rotate)
-		snprintf(gPer + 14,sizeof(gPer) - 15,"%s%s",temp,ro);
-	else
-		snprintf(gPer + 14,sizeof(gPer) - 15,"%s",temp);
+	snprintf(gPer + 14,sizeof(gPer) - 15,"%s",temp);
 
 	snprintf(gCol + 5,sizeof(gCol) - 6,"%s",temp);
 
 	return;
 }
 
-static int charge_health_check(void)
+static int charge_health_check(int health_status)
 {
-	int health_status = battery_health();
 	int value = 0;
 	switch (health_status){
 		case BATTERY_HEALTH_OVERHEAT:
@@ -184,34 +158,45 @@ static int charge_health_check(void)
 	return value;
 }
 
-static const struct { gr_surface* surface; char *name; } BITMAPS[] = {
-        { &gProgressBarIndeterminate[0],	&gIndex[0][0] },
-        { &gProgressBarIndeterminate[1],	&gIndex[1][0] },
-        { &gProgressBarIndeterminate[2],	&gIndex[2][0] },
-        { &gProgressBarIndeterminate[3],	&gIndex[3][0] },
-        { &gProgressBarIndeterminate[4],	&gIndex[4][0] },
-        { &gProgressBarIndeterminate[5],	&gIndex[5][0] },
-        { &gProgressBarIndeterminate[6],	&gIndex[6][0] },
-        { &gProgressBarEmpty,		&gIndex[0][0] },
-        { &gProgressBarFill,		&gIndex[6][0] },
-        { &gNumber[0],		&gNoIndex[0][0]},
-        { &gNumber[1],		&gNoIndex[1][0]},
-        { &gNumber[2],		&gNoIndex[2][0]},
-        { &gNumber[3],		&gNoIndex[3][0]},
-        { &gNumber[4],		&gNoIndex[4][0]},
-        { &gNumber[5],		&gNoIndex[5][0]},
-        { &gNumber[6],		&gNoIndex[6][0]},
-        { &gNumber[7],		&gNoIndex[7][0]},
-        { &gNumber[8],		&gNoIndex[8][0]},
-        { &gNumber[9],		&gNoIndex[9][0]},
-        { &gPercent,	gPer},
-        { &gColon,		gCol},
-        { &gProgressBarError[0], 	&gErr[0][0]},
-        { &gProgressBarError[1], 	&gErr[1][0]},
-        { &gProgressBarError[2], 	&gErr[2][0]},
-        { NULL,		NULL },
+// With rotate set, the surfaces marked rotated are turned clockwise at
+// load time for the sideways layout in draw_text_picture().  The ones
+// marked animated are not loaded when gProgressBarAnimation is there.
+static const struct { gr_surface* surface; char *name; int rotated; int animated; } BITMAPS[] = {
+        { &gProgressBarIndeterminate[0],	&gIndex[0][0],	1,	1 },
+        { &gProgressBarIndeterminate[1],	&gIndex[1][0],	1,	1 },
+        { &gProgressBarIndeterminate[2],	&gIndex[2][0],	1,	1 },
+        { &gProgressBarIndeterminate[3],	&gIndex[3][0],	1,	1 },
+        { &gProgressBarIndeterminate[4],	&gIndex[4][0],	1,	1 },
+        { &gProgressBarIndeterminate[5],	&gIndex[5][0],	1,	1 },
+        { &gProgressBarIndeterminate[6],	&gIndex[6][0],	1,	1 },
+        { &gProgressBarEmpty,		&gIndex[0][0],	1,	1 },
+        { &gProgressBarFill,		&gIndex[6][0],	1,	1 },
+        { &gNumber[0],		&gNoIndex[0][0],	1,	0 },
+        { &gNumber[1],		&gNoIndex[1][0],	1,	0 },
+        { &gNumber[2],		&gNoIndex[2][0],	1,	0 },
+        { &gNumber[3],		&gNoIndex[3][0],	1,	0 },
+        { &gNumber[4],		&gNoIndex[4][0],	1,	0 },
+        { &gNumber[5],		&gNoIndex[5][0],	1,	0 },
+        { &gNumber[6],		&gNoIndex[6][0],	1,	0 },
+        { &gNumber[7],		&gNoIndex[7][0],	1,	0 },
+        { &gNumber[8],		&gNoIndex[8][0],	1,	0 },
+        { &gNumber[9],		&gNoIndex[9][0],	1,	0 },
+        { &gPercent,	gPer,	1,	0 },
+        { &gColon,		gCol,	0,	0 },
+        { &gProgressBarError[0], 	&gErr[0][0],	1,	0 },
+        { &gProgressBarError[1], 	&gErr[1][0],	1,	0 },
+        { &gProgressBarError[2], 	&gErr[2][0],	1,	0 },
+        { NULL,		NULL,	0,	0 },
 };
 
+// Any frame of the bar, for its size.
+static gr_surface progress_bar_surface(void)
+{
+	if (gProgressBarAnimation)
+		return res_animation_surface(gProgressBarAnimation);
+	return gProgressBarIndeterminate[0];
+}
+
 static gr_surface gCurrentIcon = NULL;
 
 static enum ProgressBarType {
@@ -223,6 +208,208 @@ static enum ProgressBarType {
 
 static int text_col = 0,  text_row = 0,  text_top = 0;
 
+/*
+ * Damage tracking for draw_progress_locked().  The drawing code places
+ * each element (battery sprite or error icon, digits, percent sign,
+ * time line) into gNextElems; ui_present_locked() compares that with
+ * what was drawn last time and only clears and redraws the areas whose
+ * content changed.  The back buffer may be several frames old
+ * (gr_fb_buffer_age()), so the changes of those frames are repainted
+ * as well, from a short history.
+ */
+enum {
+	ELEM_BAR,
+	ELEM_HUNDRED,
+	ELEM_TEN,
+	ELEM_BIT,
+	ELEM_PERCENT,
+	ELEM_HOUR,
+	ELEM_HOUR_UNIT,
+	ELEM_COLON,
+	ELEM_MIN,
+	ELEM_MIN_UNIT,
+	ELEM_COUNT
+};
+
+#define UI_DAMAGE_MAX 8
+#define UI_DAMAGE_HISTORY 3
+#define UI_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define UI_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+struct ui_elem {
+	gr_surface surface;
+	GRRect box;
+};
+
+struct ui_damage {
+	int count;
+	GRRect rects[UI_DAMAGE_MAX];
+};
+
+static struct ui_elem gElems[ELEM_COUNT];
+static struct ui_elem gNextElems[ELEM_COUNT];
+// gDamageHistory[0] holds the changes made by the previous frame,
+// [1] the frame before, and so on.
+static struct ui_damage gDamageHistory[UI_DAMAGE_HISTORY];
+static int gFullRepaint = 1;
+
+static int rect_empty(const GRRect *r) {
+	return r->w <= 0 || r->h <= 0;
+}
+
+static int rect_overlaps(const GRRect *a, const GRRect *b) {
+	return a->x < b->x + b->w && b->x < a->x + a->w &&
+	       a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static void rect_bound(GRRect *a, const GRRect *b) {
+	int x2 = UI_MAX(a->x + a->w, b->x + b->w);
+	int y2 = UI_MAX(a->y + a->h, b->y + b->h);
+
+	a->x = UI_MIN(a->x, b->x);
+	a->y = UI_MIN(a->y, b->y);
+	a->w = x2 - a->x;
+	a->h = y2 - a->y;
+}
+
+static void damage_add(struct ui_damage *d, const GRRect *r) {
+	GRRect c = *r;
+	int i;
+
+	// gr_fill() rejects rectangles that leave the screen.
+	if (c.x < 0) { c.w += c.x; c.x = 0; }
+	if (c.y < 0) { c.h += c.y; c.y = 0; }
+	c.w = UI_MIN(c.w, gr_fb_width() - c.x);
+	c.h = UI_MIN(c.h, gr_fb_height() - c.y);
+	if (rect_empty(&c))
+		return;
+
+	for (i = 0; i < d->count; i++) {
+		if (rect_overlaps(&d->rects[i], &c)) {
+			rect_bound(&d->rects[i], &c);
+			return;
+		}
+	}
+	if (d->count == UI_DAMAGE_MAX) {
+		// Out of slots, fall back to one bounding box.
+		for (i = 1; i < d->count; i++)
+			rect_bound(&d->rects[0], &d->rects[i]);
+		rect_bound(&d->rects[0], &c);
+		d->count = 1;
+		return;
+	}
+	d->rects[d->count++] = c;
+}
+
+static int damage_overlaps(const struct ui_damage *d, const GRRect *r) {
+	int i;
+
+	for (i = 0; i < d->count; i++)
+		if (rect_overlaps(&d->rects[i], r))
+			return 1;
+	return 0;
+}
+
+// Repaint everything on the next two frames, e.g. after something else
+// drew into the framebuffers.
+static void ui_invalidate(void) {
+	gFullRepaint = 1;
+}
+
+static void ui_place(int id, gr_surface surface, int x, int y) {
+	struct ui_elem *e = &gNextElems[id];
+
+	e->surface = surface;
+	e->box.x = x;
+	e->box.y = y;
+	e->box.w = surface ? (int)gr_get_width(surface) : 0;
+	e->box.h = surface ? (int)gr_get_height(surface) : 0;
+}
+
+static void ui_present_locked(void) {
+	struct ui_damage changed = { 0 };
+	struct ui_damage damage;
+	char redraw[ELEM_COUNT];
+	int age = gr_fb_buffer_age();
+	int i, j, grown;
+
+	if (age <= 0 || age > UI_DAMAGE_HISTORY + 1)
+		gFullRepaint = 1;
+	if (gFullRepaint) {
+		GRRect all = { 0, 0, gr_fb_width(), gr_fb_height() };
+		damage_add(&changed, &all);
+		gFullRepaint = 0;
+	} else {
+		for (i = 0; i < ELEM_COUNT; i++) {
+			if (gElems[i].surface == gNextElems[i].surface &&
+			    !memcmp(&gElems[i].box, &gNextElems[i].box, sizeof(GRRect)))
+				continue;
+			damage_add(&changed, &gElems[i].box);
+			damage_add(&changed, &gNextElems[i].box);
+		}
+	}
+
+	damage = changed;
+	for (j = 0; j < age - 1 && j < UI_DAMAGE_HISTORY; j++)
+		for (i = 0; i < gDamageHistory[j].count; i++)
+			damage_add(&damage, &gDamageHistory[j].rects[i]);
+
+	// Elements are blended over their whole box, so every box the
+	// damage touches is cleared with it; else the part outside would
+	// be blended over the last frame again.  Growing the damage can
+	// reach more elements, hence the loop.
+	memset(redraw, 0, sizeof(redraw));
+	do {
+		grown = 0;
+		for (i = 0; i < ELEM_COUNT; i++) {
+			struct ui_elem *e = &gNextElems[i];
+			if (e->surface && !redraw[i] && damage_overlaps(&damage, &e->box)) {
+				damage_add(&damage, &e->box);
+				redraw[i] = 1;
+				grown = 1;
+			}
+		}
+	} while (grown);
+
+	gr_color(0,  0,  0,  255);
+	for (i = 0; i < damage.count; i++) {
+		GRRect *r = &damage.rects[i];
+		gr_fill(r->x,  r->y,  r->x + r->w,  r->y + r->h);
+	}
+	for (i = 0; i < ELEM_COUNT; i++) {
+		struct ui_elem *e = &gNextElems[i];
+		if (redraw[i])
+			gr_blit_blend(e->surface,  0,  0,  e->box.w,  e->box.h,  e->box.x,  e->box.y);
+	}
+
+	memcpy(gElems, gNextElems, sizeof(gElems));
+	memset(gNextElems, 0, sizeof(gNextElems));
+	memmove(&gDamageHistory[1], &gDamageHistory[0],
+		sizeof(gDamageHistory) - sizeof(gDamageHistory[0]));
+	gDamageHistory[0] = changed;
+}
+
+// Present the frame, telling the display what changed since the last one.
+static void ui_flip_locked(void) {
+	gr_flip_damage(gDamageHistory[0].rects, gDamageHistory[0].count);
+}
+
+#ifdef UTIT_TEST
+// The damage tracking on its own, for tests/test.cpp.
+void ui_test_place(int id, gr_surface surface, int x, int y) {
+	ui_place(id, surface, x, y);
+}
+
+void ui_test_present(void) {
+	ui_present_locked();
+	ui_flip_locked();
+}
+
+void ui_test_invalidate(void) {
+	ui_invalidate();
+}
+#endif
+
 static void draw_background_locked(gr_surface icon) {
     gr_color(0,  0,  0,  255);
     gr_fill(0,  0,  gr_fb_width(),  gr_fb_height());
@@ -258,25 +445,25 @@ static void draw_text_picture(int level)
 	ten = (level%100)/10;
 	bit = level%10;
 	if(rotate) {
-		ProgressBar_w = gr_get_width(gProgressBarIndeterminate[0]);
+		ProgressBar_w = gr_get_width(progress_bar_surface());
 		dx = gr_fb_width()/2 + ProgressBar_w/2 +  height/2;
 		dy = (gr_fb_height() - height*4 - catpcity_h)/2;
 		if(hundred == 1)
-			gr_blit(gNumber[hundred],0,0,width,height,dx,dy);
+			ui_place(ELEM_HUNDRED,gNumber[hundred],dx,dy);
 		if(level >= 10)
-			gr_blit(gNumber[ten],0,0,width,height,dx,dy + height);
-		gr_blit(gNumber[bit],0,0,width,height,dx,dy + height*2);
-		gr_blit(gPercent,0,0,capacity_w,catpcity_h,dx,dy + height*3);
+			ui_place(ELEM_TEN,gNumber[ten],dx,dy + height);
+		ui_place(ELEM_BIT,gNumber[bit],dx,dy + height*2);
+		ui_place(ELEM_PERCENT,gPercent,dx,dy + height*3);
 	} else {
-		ProgressBar_h = gr_get_height(gProgressBarIndeterminate[0]);
+		ProgressBar_h = gr_get_height(progress_bar_surface());
 		dx = (gr_fb_width() - width*4 - capacity_w)/2;
 		dy = gr_fb_height()/2 - ProgressBar_h/2 -  height *2;
 		if(hundred == 1)
-			gr_blit(gNumber[hundred],0,0,width,height,dx,dy);
+			ui_place(ELEM_HUNDRED,gNumber[hundred],dx,dy);
 		if(level >= 10)
-			gr_blit(gNumber[ten],0,0,width,height,dx + width,dy);
-		gr_blit(gNumber[bit],0,0,width,height,dx + width*2 ,dy);
-		gr_blit(gPercent,0,0,capacity_w,catpcity_h,dx + width*3,dy);
+			ui_place(ELEM_TEN,gNumber[ten],dx + width,dy);
+		ui_place(ELEM_BIT,gNumber[bit],dx + width*2 ,dy);
+		ui_place(ELEM_PERCENT,gPercent,dx + width*3,dy);
 	}
 }
 
@@ -294,10 +481,9 @@ static void draw_time_line(void)
 	int width = gr_get_width(gNumber[0]);
 	int height = gr_get_height(gNumber[0]);
 	int colon_w = gr_get_width(gColon);
-	int colon_h = gr_get_height(gColon);
 
 	int dx = (gr_fb_width() - width*4 - colon_w)/2;   // set fist number persion
-	int dy= gr_fb_height()/2 + gr_get_height(gProgressBarIndeterminate[0])/2 +  height;
+	int dy= gr_fb_height()/2 + gr_get_height(progress_bar_surface())/2 +  height;
 
 	property_get("persist.sys.timezone",  time_zone,  "");
 	if(time_zone[0] == '\0'){
@@ -316,13 +502,13 @@ static void draw_time_line(void)
 	min_unit = t_time->tm_min%10;
     LOGE("t_time->tm_hour = %d t_time->tm_min =%d\n", t_time->tm_hour, t_time->tm_min);
 
-	gr_blit(gNumber[hour], 0, 0, width, height, dx, dy);
-	gr_blit(gNumber[hour_unit], 0, 0, width, height, dx+width, dy);
+	ui_place(ELEM_HOUR, gNumber[hour], dx, dy);
+	ui_place(ELEM_HOUR_UNIT, gNumber[hour_unit], dx+width, dy);
 
-	gr_blit(gColon, 0, 0, colon_w, colon_h, dx+width*2, dy);
+	ui_place(ELEM_COLON, gColon, dx+width*2, dy);
 
-	gr_blit(gNumber[min], 0, 0, width, height, dx+width*2+colon_w, dy);
-	gr_blit(gNumber[min_unit], 0, 0, width, height, dx+width*3+colon_w, dy);
+	ui_place(ELEM_MIN, gNumber[min], dx+width*2+colon_w, dy);
+	ui_place(ELEM_MIN_UNIT, gNumber[min_unit], dx+width*3+colon_w, dy);
 
 	memset(timer_buf,0,sizeof(timer_buf));
 	result = strftime(timer_buf , sizeof(timer_buf) , "%Y-%m-%d" , t_time);
@@ -336,6 +522,24 @@ static void draw_time_line(void)
 }
 #endif
 
+// Go to frame first of the streamed bar and loop back to it after the
+// last one, like the separate frames do.
+static void animation_start(ResAnimation *anim, int first)
+{
+	res_animation_set_loop(anim, first);
+	while (res_animation_index(anim) != first)
+		if (res_animation_next(anim) < 0)
+			break;
+}
+
+static long monotonic_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC,  &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 char bat[10]={0};
 static void draw_progress_locked(int level) {
 #if CIRCLE_CHARGE_UI_SUPPORT
@@ -348,33 +552,36 @@ static void draw_progress_locked(int level) {
     return;
 #else
     gr_sync();
-    int width = gr_get_width(gProgressBarEmpty);
-    int height = gr_get_height(gProgressBarEmpty);
+    int width = gr_get_width(progress_bar_surface());
+    int height = gr_get_height(progress_bar_surface());
 
     int dx = (gr_fb_width() - width)/2;
     int dy = (gr_fb_height() - height)/2;
 
     static int frame = 0;
+    static long frame_end;
 
-    // Erase behind the progress bar (in case this was a progress-only update)
-    gr_color(0,  0,  0,  255);
-    gr_fill(0,  0,  gr_fb_width(),  gr_fb_height());
-
-    gr_color(64,  96,  255,  255);
+#ifndef PICTURE_SHOW_PERCENT_SUPPORT
+    // gr_text() output is not tracked, repaint the whole screen.
+    ui_invalidate();
+#endif
 
 	if( status_index > 0){
 #ifdef PICTURE_SHOW_PERCENT_SUPPORT
 		draw_text_picture(level);
-#else
-		draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
 #endif
 		led_off();
-		gr_blit(gProgressBarError[status_index-1],  0,  0,  width,  height,  dx,  dy);
+		ui_place(ELEM_BAR,  gProgressBarError[status_index-1],  dx,  dy);
 
 #ifdef SHOW_TIME_DATE_SUPPORT
 		draw_time_line();
 #endif
-		gr_flip();
+		ui_present_locked();
+#ifndef PICTURE_SHOW_PERCENT_SUPPORT
+		gr_color(64,  96,  255,  255);
+		draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
+#endif
+		ui_flip_locked();
 		return;
 	}
 
@@ -389,23 +596,43 @@ static void draw_progress_locked(int level) {
 #endif
 #ifdef PICTURE_SHOW_PERCENT_SUPPORT
 	draw_text_picture(level);
-#else
-	draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
 #endif
     if (gProgressBarType == PROGRESSBAR_TYPE_NORMAL) {
         frame = level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100;
-        gr_blit(gProgressBarIndeterminate[frame],  0,  0,  width,  height,  dx,  dy);
+        if (gProgressBarAnimation) {
+            animation_start(gProgressBarAnimation,
+                    level * (res_animation_frames(gProgressBarAnimation) - 1) / 100);
+            frame_end = monotonic_ms() + res_animation_duration(gProgressBarAnimation);
+        }
 		 gProgressBarType = PROGRESSBAR_TYPE_INDETERMINATE;
     }
 
-    if (gProgressBarType == PROGRESSBAR_TYPE_INDETERMINATE) {
-        gr_blit(gProgressBarIndeterminate[frame],  0,  0,  width,  height,  dx,  dy);
+    if (gProgressBarAnimation) {
+        ui_place(ELEM_BAR,  res_animation_surface(gProgressBarAnimation),  dx,  dy);
+    } else if (gProgressBarType == PROGRESSBAR_TYPE_INDETERMINATE) {
+        ui_place(ELEM_BAR,  gProgressBarIndeterminate[frame],  dx,  dy);
         frame = (frame + 1);
         if (frame >= PROGRESSBAR_INDETERMINATE_STATES) {
             frame = level * (PROGRESSBAR_INDETERMINATE_STATES - 1) / 100;
         }
     }
-	gr_flip();
+	ui_present_locked();
+#ifndef PICTURE_SHOW_PERCENT_SUPPORT
+	gr_color(64,  96,  255,  255);
+	draw_text_xy((dy + height),  (gr_fb_width()/2 - 20),  bat);
+#endif
+	ui_flip_locked();
+
+    // Move the streamed bar on once its frame has been up long enough;
+    // that decodes the frame after, off the path of the flip.
+    if (gProgressBarAnimation && monotonic_ms() >= frame_end) {
+        res_animation_set_loop(gProgressBarAnimation,
+                level * (res_animation_frames(gProgressBarAnimation) - 1) / 100);
+        res_animation_next(gProgressBarAnimation);
+        frame_end += res_animation_duration(gProgressBarAnimation);
+        if (frame_end < monotonic_ms())
+            frame_end = monotonic_ms();
+    }
 #endif
 }
 
@@ -421,7 +648,7 @@ static void led_control(int level) {
         level = 100;
       else if (level < 0)
         level = 0;
-      if (level < 90) {
+      if (level < LED_GREEN_LEVEL) {
         if (led_flag != LED_RED) {
             led_on(LED_RED);
             led_flag = LED_RED;
@@ -436,8 +663,50 @@ static void led_control(int level) {
 
 extern int screen_on_flag;
 
+// Lock-free read of the published battery state.  Only when nothing has
+// been published yet (power_thread not running) is it produced here.
+static int battery_snapshot_read(struct battery_snapshot *snap) {
+	if (battery_snapshot_get(snap) == 0)
+		return 0;
+	if (battery_snapshot_update() < 0)
+		return -1;
+	return battery_snapshot_get(snap);
+}
+
+int charge_ui_update(struct battery_snapshot *snap) {
+	int bat_level;
+	int health;
+
+	if (battery_snapshot_read(snap) < 0) {
+		bat_level = -1;
+		health = BATTERY_HEALTH_UNKNOWN;
+	} else {
+		bat_level = snap->level;
+		health = snap->health;
+	}
+	pthread_mutex_lock(&gchargeMutex);
+	led_control(bat_level);
+	status_index = charge_health_check(health);
+	if (screen_on_flag == 1) {
+	   draw_progress_locked(bat_level);
+	}
+	pthread_mutex_unlock(&gchargeMutex);
+	return bat_level;
+}
+
+int charge_plugged_out(void) {
+	struct battery_snapshot snap;
+
+	return battery_snapshot_update() == 0 && battery_snapshot_get(&snap) == 0 &&
+	       snap.ac_online == 0 && snap.usb_online == 0;
+}
+
 void *charge_thread(void *cookie) {
+    struct battery_snapshot snap;
+    struct frame_clock clock;
     int bat_level = 0;
+
+    frame_clock_init(&clock, frame_clock_fps());
     for (; !is_exit; ) {
 	if(thread_ext_ctrl == CHARGE_THREAD_CTRL){
 		thread_count++;
@@ -446,27 +715,38 @@ void *charge_thread(void *cookie) {
 			thread_count = 0;
 		}
 	}
-        usleep(1000000/ PROGRESSBAR_INDETERMINATE_FPS);
-        bat_level = battery_capacity();
+	// Frames are paced by absolute deadlines, so drawing time does not
+	// stretch the period.
+	if (screen_on_flag == 1) {
+		if (!clock.running)
+			frame_clock_start(&clock);
+		if (frame_clock_wait(&clock) < 0)
+			usleep(1000000 / clock.fps);
+	} else {
+		frame_clock_stop(&clock);
+	}
+	bat_level = charge_ui_update(&snap);
 	if(bat_level < 0){
 		thread_st = CHARGE_THREAD_EXIT_ERROR;
 	}else{
 		thread_st = CHARGE_THREAD_OK;
 	}
-	pthread_mutex_lock(&gchargeMutex);
-	led_control(bat_level);
-	status_index = charge_health_check();
-	if (screen_on_flag == 1) {
-	   draw_progress_locked(bat_level);
-	}
-	pthread_mutex_unlock(&gchargeMutex);
-        usleep(500000);
+        if (bat_level < 0)
+            usleep(500000);
+        else if (screen_on_flag != 1)
+            // Nothing to animate: only the LED and health check need
+            // another pass, and only once the battery state changes.
+            battery_sampler_wait(snap.timestamp_ms, battery_sample_interval());
     }
 
+    LOGD("charge_thread: %lu frames,  %lu missed\n",  clock.frames,  clock.missed);
+    frame_clock_exit(&clock);
     usleep(200);
     return NULL;
 }
 
+// power_thread is the producer of the battery snapshot, everyone else
+// only reads it.
 void *power_thread(void *cookie) {
     for (; !is_exit; ) {
 	 if(thread_ext_ctrl == POWER_THREAD_CTRL){
@@ -476,7 +756,7 @@ void *power_thread(void *cookie) {
                         thread_count = 0;
                 }
         }
-        if (battery_ac_online() == 0 && battery_usb_online() == 0) {
+        if (charge_plugged_out()) {
             LOGE("charger not present,  power off device\n");
 	    thread_st = POWER_THREAD_EXIT_PLUGOUT;
             is_exit = 1;
@@ -486,7 +766,10 @@ void *power_thread(void *cookie) {
         }else{
 		thread_st = POWER_THREAD_OK;
 	}
-	 usleep(500000);
+	 // Sleep until the kernel reports a power_supply change or the
+	 // next sample is due.
+	 if (battery_uevent_wait(battery_sample_interval()) < 0)
+		usleep(battery_sample_interval() * 1000);
     }
     return NULL;
 }
@@ -599,7 +882,12 @@ key_check:
 }
 
 int ui_init(void) {
-	int i, result = 0;
+	int i, n, result = 0;
+	int num, den;
+	char name[40];
+	ResCacheStats stats;
+	ResRequest requests[sizeof(BITMAPS) / sizeof(BITMAPS[0])];
+	struct timespec start,  end;
 
 	result = gr_init();
 	if (result < 0) {
@@ -612,25 +900,56 @@ int ui_init(void) {
 		return result;
 	}
 	res_init();
-
-	for (i = 0; BITMAPS[i].name != NULL; ++i) {
-		result = res_create_display_surface(BITMAPS[i].name,  BITMAPS[i].surface);
-		if (result < 0) {
-			if (result == -2) {
-				LOGI("Bitmap %s missing header\n",  BITMAPS[i].name);
+	res_scale(&num, &den);
+
+	clock_gettime(CLOCK_MONOTONIC,  &start);
+	// The bar frames are streamed from one file when there is one, else
+	// loaded with the other images.
+	snprintf(name, sizeof(name), "%s%s", gIndeterminate, gMaster);
+	result = res_open_animation(name, num, den, rotate ? FB_ROTATE_CW : FB_ROTATE_UR,
+			&gProgressBarAnimation);
+	if (result < 0 && result != -1)
+		LOGE("Cannot play %s.anim\n(Code %d)\n",  name,  result);
+
+	// Every image is decoded at once, in parallel; the first frame
+	// waits on all of them.
+	for (i = 0, n = 0; BITMAPS[i].name != NULL; ++i) {
+		*BITMAPS[i].surface = NULL;
+		if (gProgressBarAnimation && BITMAPS[i].animated)
+			continue;
+		requests[n].name = BITMAPS[i].name;
+		requests[n].scale_num = num;
+		requests[n].scale_den = den;
+		requests[n].rotation = (rotate && BITMAPS[i].rotated) ? FB_ROTATE_CW : FB_ROTATE_UR;
+		requests[n].surface = BITMAPS[i].surface;
+		requests[n].result = 0;
+		++n;
+	}
+	// A missing or broken image is logged and left out of the drawing;
+	// only gr_init() and ev_init() failures fail ui_init().
+	res_acquire_display_surfaces(requests,  n);
+	clock_gettime(CLOCK_MONOTONIC,  &end);
+	for (i = 0; i < n; ++i) {
+		if (requests[i].result < 0) {
+			if (requests[i].result == -2) {
+				LOGI("Bitmap %s missing header\n",  requests[i].name);
 			} else {
-				LOGE("Missing bitmap %s\n(Code %d)\n",  BITMAPS[i].name,  result);
+				LOGE("Missing bitmap %s\n(Code %d)\n",  requests[i].name,  requests[i].result);
 			}
-			*BITMAPS[i].surface = NULL;
+			*requests[i].surface = NULL;
 		}
 	}
-	return result;
+	res_cache_get_stats(&stats);
+	LOGD("images: %lu loaded, %lu shared, %zu bytes in %ld ms\n",  stats.misses,  stats.hits,  stats.bytes,
+			(end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+	return 0;
 }
 
 void ui_set_background(void) {
     pthread_mutex_lock(&gUpdateMutex);
     gr_sync();
     draw_background_locked(gCurrentIcon);
+    ui_invalidate();
     gr_flip();
     pthread_mutex_unlock(&gUpdateMutex);
 }
@@ -690,24 +1009,9 @@ int alarm_flag_check(void) {
    return 0;
 }
 
-// 新增：圆环动画宏开关
-#define CIRCLE_CHARGE_UI_SUPPORT 1
-// 画圆环进度条
-static void draw_circle_progress(int cx, int cy, int radius, float percent, uint32_t color, int thickness) {
-    float start_angle = -90.0f; // 从正上方开始
-    float end_angle = start_angle + 360.0f * percent;
-    float step = 2.0f; // 每2度画一段
-    for (float angle = start_angle; angle < end_angle; angle += step) {
-        float rad1 = angle * M_PI / 180.0f;
-        float rad2 = (angle + step) * M_PI / 180.0f;
-        int x1 = cx + (int)(radius * cos(rad1));
-        int y1 = cy + (int)(radius * sin(rad1));
-        int x2 = cx + (int)(radius * cos(rad2));
-        int y2 = cy + (int)(radius * sin(rad2));
-        gr_color((color>>16)&0xFF, (color>>8)&0xFF, color&0xFF, 255);
-        gr_thick_line(x1, y1, x2, y2, thickness);
-    }
-}
+#if CIRCLE_CHARGE_UI_SUPPORT
+// 圆环进度条: 灰色底环 + 绿色进度弧, 只在创建时计算一次几何
+static GRRing *gChargeRing;
 
 // 新圆环UI
 static void draw_circle_charge_ui(int percent, int is_fast_charging) {
@@ -716,18 +1020,24 @@ static void draw_circle_charge_ui(int percent, int is_fast_charging) {
     int radius = 120;
     int thickness = 12;
     uint32_t green = 0x00FF00; // RGB绿色
-    // 1. 灰色底环
-    draw_circle_progress(center_x, center_y, radius, 1.0, 0x444444, thickness);
-    // 2. 绿色进度环
-    draw_circle_progress(center_x, center_y, radius, percent / 100.0f, green, thickness);
-    // 3. 闪电图标
+    // 1. 灰色底环 2. 绿色进度环
+    if (!gChargeRing)
+        gChargeRing = gr_ring_create(radius, thickness, 0x444444, green);
+    gr_ring_set(gChargeRing, percent, 100);
+    gr_surface ring = gr_ring_surface(gChargeRing);
+    if (ring) {
+        int ring_w = gr_get_width(ring);
+        int ring_h = gr_get_height(ring);
+        gr_blit_blend(ring, 0, 0, ring_w, ring_h, center_x - ring_w/2, center_y - ring_h/2);
+    }
+    // 3. 闪电图标, 只在第一次解码, 之后从缓存取
     const char* icon = is_fast_charging ? "charge/images/lightning_double.png" : "charge/images/lightning_single.png";
     gr_surface lightning = NULL;
-    if (res_create_display_surface(icon, &lightning) == 0 && lightning) {
+    if (res_acquire_display_surface(icon, 1, 1, FB_ROTATE_UR, &lightning) == 0 && lightning) {
         int icon_w = gr_get_width(lightning);
         int icon_h = gr_get_height(lightning);
-        gr_blit(lightning, 0, 0, icon_w, icon_h, center_x - icon_w/2, center_y - icon_h/2);
-        res_free_surface(lightning);
+        gr_blit_blend(lightning, 0, 0, icon_w, icon_h, center_x - icon_w/2, center_y - icon_h/2);
+        res_release_surface(lightning);
     }
     // 4. 百分比和状态
     char text[32];
@@ -741,3 +1051,4 @@ static void draw_circle_charge_ui(int percent, int is_fast_charging) {
     gr_color(255, 255, 255, 255);
     gr_text(text_x, text_y, text, 0);
 }
+#endif